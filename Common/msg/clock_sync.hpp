@@ -0,0 +1,187 @@
+#pragma once
+#include "message_format.hpp"
+
+/*
+   The devices estimate the clock of the server (the Controller) like NTP does.
+   A device sends a ClockSync with its time, the server answers right away
+   with the same message and its own time:
+       round_trip = received - request_time
+       offset     = server_time - (request_time + round_trip / 2)
+   The server answers when it handles the message, the time it waited in the
+   socket is part of the round trip. The sample with the smallest round trip
+   of the last few is the most accurate, its error is at most round_trip / 2.
+   The drift of the device clock is measured between two samples 10s apart or
+   more. All the times are in microseconds.
+   A sample with a round trip much longer than the best recent one waited
+   somewhere, it is thrown away. An offset far from the estimate only resets
+   it when a few samples in a row agree on it: the server restarted.
+*/
+struct ClockSync
+{
+    ClockSync() {}
+
+    MessageHeader
+    getHeader()
+    {
+        return MessageHeader{MessageType::ClockSync};
+    }
+    void
+    serialize(Serializer& s)
+    {
+        Serialize(request_time, s);
+        Serialize(server_time, s);
+    }
+
+    u64 request_time = 0; // Device time when the request was sent
+    u64 server_time  = 0; // Server time of the answer, 0 in the request
+};
+
+struct ClockSample
+{
+    s64 offset     = 0;
+    u64 local_time = 0;
+    u32 round_trip = 0;
+};
+
+struct ClockEstimate
+{
+    static constexpr u32 sample_count = 8;
+    // More than that between the estimate and a sample, the server restarted
+    static constexpr s64 max_offset_jump    = 100000;     // 100 ms
+    static constexpr u64 min_drift_interval = 10000000;   // 10 s
+    static constexpr u64 max_anchor_age     = 1800000000; // 30 min
+    static constexpr f32 max_drift          = 500e-6f;
+    // Slower than 2 * the best round trip + this, a sample is rejected
+    static constexpr u32 round_trip_margin     = 1000; // 1 ms
+    // In a row, the network got slower and the samples are used anyway
+    static constexpr u32 max_rejected_samples  = 8;
+    // Samples in a row that agree on a jump before the estimate is reset
+    static constexpr u32 jump_sample_count     = 3;
+    static constexpr s64 max_jump_disagreement = 10000; // 10 ms
+
+    ClockSample samples[sample_count];
+    u32         samples_filled = 0;
+    u32         next_sample    = 0;
+
+    // The drift is measured from the anchor, the longer ago the better
+    ClockSample anchor;
+
+    bool synced      = false;
+    s64  offset      = 0; // Server time - local time, at reference
+    u64  reference   = 0; // Local time
+    f32  drift       = 0; // Server microseconds per local microsecond, - 1
+    bool drift_valid = false;
+    u32  round_trip  = 0; // Of the last sample used
+
+    u32 rejected_samples = 0;
+    u32 jump_samples     = 0;
+    s64 jump_offset      = 0; // Of the first sample of the jump
+};
+
+inline s64
+ClockOffset(const ClockEstimate& estimate, u64 local_time)
+{
+    s64 elapsed = (s64)(local_time - estimate.reference);
+    return estimate.offset + (s64)(estimate.drift * (f32)elapsed);
+}
+
+inline void
+AddClockSample(ClockEstimate& estimate, u64 request_time, u64 server_time,
+               u64 received)
+{
+    ClockSample sample;
+    sample.round_trip = (u32)(received - request_time);
+    sample.local_time = request_time + sample.round_trip / 2;
+    sample.offset     = (s64)(server_time - sample.local_time);
+
+    if (estimate.synced)
+    {
+        u32 best_round_trip = estimate.samples[0].round_trip;
+        for (u32 i = 1; i < estimate.samples_filled; i++)
+        {
+            if (estimate.samples[i].round_trip < best_round_trip)
+                best_round_trip = estimate.samples[i].round_trip;
+        }
+        if (sample.round_trip
+                > 2 * best_round_trip + estimate.round_trip_margin
+            && estimate.rejected_samples + 1 < estimate.max_rejected_samples)
+        {
+            estimate.rejected_samples++;
+            return;
+        }
+        estimate.rejected_samples = 0;
+
+        s64 error = sample.offset - ClockOffset(estimate, sample.local_time);
+        if (error > estimate.max_offset_jump
+            || error < -estimate.max_offset_jump)
+        {
+            s64 disagreement = sample.offset - estimate.jump_offset;
+            if (!estimate.jump_samples
+                || disagreement > estimate.max_jump_disagreement
+                || disagreement < -estimate.max_jump_disagreement)
+            {
+                estimate.jump_samples = 0;
+                estimate.jump_offset  = sample.offset;
+            }
+            estimate.jump_samples++;
+            if (estimate.jump_samples < estimate.jump_sample_count)
+                return;
+            estimate = ClockEstimate{};
+        }
+        estimate.jump_samples = 0;
+    }
+
+    estimate.samples[estimate.next_sample] = sample;
+    estimate.next_sample = (estimate.next_sample + 1) % estimate.sample_count;
+    if (estimate.samples_filled < estimate.sample_count)
+        estimate.samples_filled++;
+
+    ClockSample best = estimate.samples[0];
+    for (u32 i = 1; i < estimate.samples_filled; i++)
+    {
+        if (estimate.samples[i].round_trip < best.round_trip)
+            best = estimate.samples[i];
+    }
+
+    if (!estimate.synced
+        || (best.local_time - estimate.anchor.local_time
+                < estimate.min_drift_interval
+            && best.round_trip < estimate.anchor.round_trip))
+    {
+        // The first samples, or a better one before the drift is measured
+        estimate.synced     = true;
+        estimate.anchor     = best;
+        estimate.offset     = best.offset;
+        estimate.reference  = best.local_time;
+        estimate.round_trip = best.round_trip;
+        return;
+    }
+    if (best.local_time == estimate.reference)
+        return;
+
+    u64 interval = best.local_time - estimate.anchor.local_time;
+    if (interval < estimate.min_drift_interval)
+        return;
+
+    f32 drift = (f32)(best.offset - estimate.anchor.offset) / (f32)interval;
+    if (drift > estimate.max_drift)
+        drift = estimate.max_drift;
+    if (drift < -estimate.max_drift)
+        drift = -estimate.max_drift;
+    estimate.drift       = drift;
+    estimate.drift_valid = true;
+
+    // The samples are noisy, the estimate only moves part of the way
+    s64 predicted       = ClockOffset(estimate, best.local_time);
+    estimate.offset     = predicted + (best.offset - predicted) / 4;
+    estimate.reference  = best.local_time;
+    estimate.round_trip = best.round_trip;
+
+    if (interval > estimate.max_anchor_age)
+    {
+        // The drift changes with the temperature
+        estimate.anchor.offset     = estimate.offset;
+        estimate.anchor.local_time = estimate.reference;
+        estimate.anchor.round_trip = estimate.round_trip;
+    }
+}
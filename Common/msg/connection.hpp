@@ -1,6 +1,7 @@
 #pragma once
 #ifdef CONTROLLER
 #    include <asio.hpp>
+#    include <string>
 
 using Endpoint  = asio::ip::udp::endpoint;
 using Socket    = asio::ip::udp::socket;
@@ -11,9 +12,12 @@ struct Connection
     Connection() {}
     Endpoint  endpoint;
     SocketPtr socket;
+    // Set when the client is reached through its USB serial port
+    std::string serial_port;
 };
 
-#else
+#elif defined(ARDUINO)
+#    include <IPAddress.h>
 
 struct Connection
 {
@@ -24,4 +28,12 @@ struct Connection
     u16       port = 0;
 };
 
+#else
+
+// Tools that run on a computer without the network (Targets/replay)
+struct Connection
+{
+    Connection() {}
+};
+
 #endif
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 #include "alias.hpp"
 #include "connection.hpp"
+#include <string.h>
 #include <type_traits>
 
 enum class ClientId : u8
@@ -25,6 +26,9 @@ enum class MessageType : u8
     Multicast = 1,
     Reset,
     Log,
+    Telemetry, // message_telemetry.hpp
+    ClockSync, // clock_sync.hpp
+    Hello,
 
     // message_door_lock.hpp
     DoorLockCommand = 20,
@@ -226,7 +230,26 @@ struct Reset
         return MessageHeader{MessageType::Reset};
     }
     void
-    serialize(Serializer& s)
+    serialize(Serializer& /*s*/)
+    {}
+};
+
+/*
+   Sent by a device to a server it found: after the multicast message, to the
+   server it remembers, and on a serial port where the server sent the
+   multicast message. The server answers with the multicast message.
+*/
+struct Hello
+{
+    Hello() {}
+
+    MessageHeader
+    getHeader()
+    {
+        return MessageHeader{MessageType::Hello};
+    }
+    void
+    serialize(Serializer& /*s*/)
     {}
 };
 
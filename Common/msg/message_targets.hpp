@@ -2,7 +2,16 @@
 #include "message_format.hpp"
 #include <vector>
 
-constexpr u8 target_count = 4;
+/*
+   A board has up to max_target_count targets (2 per ADS1115). The messages
+   only carry the targets the board has: count is serialized first, then the
+   values of each target.
+*/
+constexpr u8 max_target_count = 16;
+
+// One bit per target
+using TargetMask                = u16;
+constexpr TargetMask all_targets = 0xFFFF;
 
 enum class TargetsDoorState : u8
 {
@@ -33,13 +42,12 @@ struct TargetsCommand
         Serialize(enable, s);
         Serialize(door_state, s);
 
-        auto target_count_msg = target_count;
-        Serialize(target_count_msg, s);
+        Serialize(count, s);
         // If we receive more targets than we have we don't deserialize them.
-        if (target_count < target_count_msg)
-            target_count_msg = target_count;
+        if (count > max_target_count)
+            count = max_target_count;
 
-        for (u32 i = 0; i < target_count_msg; i++)
+        for (u32 i = 0; i < count; i++)
         {
             Serialize(hitpoints[i], s);
             Serialize(set_hitpoints[i], s);
@@ -48,11 +56,12 @@ struct TargetsCommand
     }
 
     u8               ask_for_ack = 0;
-    u8               enable      = 0xFF;
+    TargetMask       enable      = all_targets;
     TargetsDoorState door_state  = TargetsDoorState::OpenWhenTargetsAreDead;
-    s8               hitpoints[target_count]     = {0};
-    s8               set_hitpoints[target_count] = {0};
-    u8               send_sensor_data            = 0;
+    u8               count       = max_target_count;
+    s8               hitpoints[max_target_count]     = {0};
+    s8               set_hitpoints[max_target_count] = {0};
+    u8               send_sensor_data                = 0;
 };
 
 struct TargetsStatus
@@ -76,27 +85,37 @@ struct TargetsStatus
         Serialize(ask_for_ack, s);
         Serialize(enabled, s);
         Serialize(door_state, s);
+        Serialize(hit_time, s);
 
-        auto target_count_msg = target_count;
-        Serialize(target_count_msg, s);
+        Serialize(count, s);
         // If we receive more targets than we have we don't deserialize them.
-        if (target_count < target_count_msg)
-            target_count_msg = target_count;
+        if (count > max_target_count)
+            count = max_target_count;
 
-        for (u32 i = 0; i < target_count_msg; i++)
+        for (u32 i = 0; i < count; i++)
         {
             Serialize(hitpoints[i], s);
         }
     }
 
     u8               ask_for_ack = 0;
-    u8               enabled     = 0xFF;
+    TargetMask       enabled     = all_targets;
     TargetsDoorState door_state  = TargetsDoorState::OpenWhenTargetsAreDead;
-    s8               hitpoints[target_count]  = {0};
-    u16              thresholds[target_count] = {0};
-    u8               send_sensor_data         = 0;
+    u8               count       = max_target_count; // Targets of the board
+    s8               hitpoints[max_target_count]  = {0};
+    u16              thresholds[max_target_count] = {0};
+    u8               send_sensor_data             = 0;
+    // ServerMicros() of the last hit, 0 when the clock isn't synced
+    u64 hit_time = 0;
 };
 
+/*
+   The sensor values of each target since the last message. A target with no
+   new sample only sends its count. The samples of a target are evenly spaced:
+   sample i was taken at start_time + i * sample_period, so the Controller can
+   put all the targets on the same time axis even when their buffers were not
+   filled at the same time.
+*/
 struct TargetsGraph
 {
     TargetsGraph() {}
@@ -110,9 +129,19 @@ struct TargetsGraph
     void
     serialize(Serializer& s)
     {
-        for (u16 j = 0; j < target_count; j++)
+        Serialize(server_time, s);
+        Serialize(count, s);
+        if (count > max_target_count)
+            count = max_target_count;
+        for (u16 j = 0; j < count; j++)
         {
             Serialize(buffer_count[j], s);
+            if (buffer_count[j] > buffer_max_count)
+                buffer_count[j] = buffer_max_count;
+            if (!buffer_count[j])
+                continue;
+            Serialize(start_time[j], s);
+            Serialize(sample_period[j], s);
             auto* target_buffer = buffer[j];
             for (u16 i = 0; i < buffer_count[j]; i++)
             {
@@ -121,7 +150,26 @@ struct TargetsGraph
         }
     }
 
-    static constexpr u16 buffer_max_count                       = 64;
-    u16                  buffer[target_count][buffer_max_count] = {0};
-    u16                  buffer_count[target_count]             = {0};
-};
\ No newline at end of file
+    // Samples per target that fit in a packet when all the targets are full
+    static u16
+    bufferLimit(u8 target_count, u32 packet_size)
+    {
+        constexpr u32 header_size = 4;  // MessageHeader, server_time, count
+        constexpr u32 target_size = 14; // buffer_count, times
+        if (!target_count)
+            return buffer_max_count;
+        u32 per_target = (packet_size - header_size) / target_count;
+        u32 limit      = (per_target - target_size) / sizeof(u16);
+        return (limit < buffer_max_count) ? (u16)limit : buffer_max_count;
+    }
+
+    static constexpr u16 buffer_max_count                           = 64;
+    u16                  buffer[max_target_count][buffer_max_count] = {0};
+    u16                  buffer_count[max_target_count]             = {0};
+    // In microseconds, ServerMicros() when server_time is set, otherwise the
+    // clock of the device
+    u64 start_time[max_target_count]    = {0};
+    u32 sample_period[max_target_count] = {0};
+    u8  server_time                     = 0;
+    u8  count                           = max_target_count;
+};
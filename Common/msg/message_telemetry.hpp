@@ -0,0 +1,48 @@
+#pragma once
+#include "message_format.hpp"
+
+/*
+   Telemetry is sent by every device every few seconds, it tells how well it
+   runs. The loop times are measured between two calls to DispatchMessages.
+*/
+struct Telemetry
+{
+    Telemetry() {}
+
+    MessageHeader
+    getHeader()
+    {
+        return MessageHeader{MessageType::Telemetry};
+    }
+    void
+    serialize(Serializer& s)
+    {
+        Serialize(uptime, s);
+        Serialize(reset_reason, s);
+        Serialize(loop_time_min, s);
+        Serialize(loop_time_avg, s);
+        Serialize(loop_time_max, s);
+        Serialize(free_heap, s);
+        Serialize(largest_free_block, s);
+        Serialize(rssi, s);
+        Serialize(packets_sent, s);
+        Serialize(packets_received, s);
+        Serialize(packets_dropped, s);
+        Serialize(clock_round_trip, s);
+        Serialize(samples_dropped, s);
+    }
+
+    u32 uptime             = 0; // milliseconds
+    u8  reset_reason       = 0; // esp_reset_reason_t
+    u32 loop_time_min      = 0; // microseconds
+    u32 loop_time_avg      = 0; // microseconds
+    u32 loop_time_max      = 0; // microseconds
+    u32 free_heap          = 0; // bytes
+    u32 largest_free_block = 0; // bytes
+    s8  rssi               = 0; // dBm, 0 when not connected to an access point
+    u32 packets_sent       = 0; // UDP packets
+    u32 packets_received   = 0;
+    u32 packets_dropped    = 0; // Too big for packet_buffer
+    u32 clock_round_trip   = 0; // microseconds, 0 when the clock isn't synced
+    u32 samples_dropped    = 0; // Sensor samples the device had no room for
+};
@@ -15,10 +15,12 @@ struct TimerCommand
     {
         Serialize(paused, s);
         Serialize(time_left, s);
+        Serialize(server_time, s);
     }
 
-    u8  paused    = false;
-    s32 time_left = 0; // milliseconds
+    u8  paused      = false;
+    s32 time_left   = 0; // milliseconds
+    u64 server_time = 0; // ServerMicros() when time_left was measured
 };
 
 struct TimerStatus
@@ -1,25 +1,195 @@
 #include "msg.hpp"
+#include "message_telemetry.hpp"
+#include "clock_sync.hpp"
 #include "wifi_config.hpp"
+#include "serial_in.hpp"
 #include <Wifi.h>
+#include <Preferences.h>
+#include <esp_system.h>
+#include <esp_timer.h>
 
 WiFiUDP udp;
 
 Connection multicast_connection = {IPAddress(239, 255, 0, 1), 55872};
 Connection server_connection;
 
+// Last message over WiFi, the serial link has time_last_serial_message
 u32           time_last_message_received = 0;
 constexpr u32 timeout_period             = 3000;
 
 u8 packet_buffer[udp_packet_size];
 
+ServerLink server_link              = ServerLink::Wifi;
+u32        time_last_serial_message = 0;
+u8         frame_buffer[FrameSize(udp_packet_size)];
+
+u32 packets_sent     = 0;
+u32 packets_received = 0;
+u32 packets_dropped  = 0;
+u32 samples_dropped  = 0;
+
+// Loop times measured between two calls to MeasureLoopTime
+constexpr u32 telemetry_period = 2000;
+u32           time_telemetry_sent = 0;
+u32           time_last_dispatch  = 0;
+u32           loop_time_min       = UINT32_MAX;
+u32           loop_time_max       = 0;
+u32           loop_time_sum       = 0;
+u32           loop_count          = 0;
+
+// Written by the core that receives the messages, read by the application
+ClockEstimate clock_estimate;
+portMUX_TYPE  clock_mux = portMUX_INITIALIZER_UNLOCKED;
+// Faster until there are enough samples to choose from
+constexpr u32 clock_request_fast_period = 100;
+constexpr u32 clock_request_period      = 1000;
+u32           time_clock_request_sent   = 0;
+
+MessageHandler message_handlers[(u8)MessageType::MessageTypeMax] = {};
+// A flood of packets can't block the loop for longer than this
+constexpr u32 max_messages_per_dispatch = 16;
+
 WifiState wifi_state = WifiState::WifiOff;
 
 bool create_access_point = false;
 
+/*
+   The last server we were connected to and the access point we used are kept
+   in NVS. We connect directly to this access point and say hello to this
+   server instead of scanning all the channels and waiting for a multicast
+   message, which is only sent every second.
+*/
+struct ServerCache
+{
+    u32 address  = 0;
+    u16 port     = 0;
+    s32 channel  = 0; // 0 in AP mode
+    u8  bssid[6] = {};
+};
+ServerCache server_cache;
+bool        server_cache_valid = false;
+bool        wifi_from_cache    = false;
+
+constexpr u32 cached_wifi_timeout   = 2000;
+constexpr u32 cached_server_timeout = 500;
+constexpr u32 hello_resend_period   = 100;
+u32           time_wifi_begin       = 0;
+u32           time_server_hello     = 0;
+u32           time_hello_sent       = 0;
+
+void
+LoadServerCache()
+{
+    Preferences preferences;
+    preferences.begin("msg", true);
+    u32 size = preferences.getBytes("server", &server_cache,
+                                    sizeof(server_cache));
+    preferences.end();
+    server_cache_valid = (size == sizeof(server_cache) && server_cache.port);
+}
+
+void
+SaveServerCache()
+{
+    ServerCache cache;
+    cache.address = (u32)server_connection.address;
+    cache.port    = server_connection.port;
+    if (!create_access_point)
+    {
+        cache.channel = WiFi.channel();
+        memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+    }
+    server_cache_valid = true;
+
+    // The flash is only written when something changed
+    if (memcmp(&cache, &server_cache, sizeof(cache)) == 0)
+        return;
+    server_cache = cache;
+
+    Preferences preferences;
+    preferences.begin("msg", false);
+    preferences.putBytes("server", &server_cache, sizeof(server_cache));
+    preferences.end();
+}
+
+// channel 1, 6, and 11 are non-overlapping and preferred
+constexpr u8  ap_channels[]           = {1, 6, 11};
+constexpr u8  default_ap_channel      = 1;
+constexpr s32 max_ap_connection_count = 6;
+u8            ap_channel              = default_ap_channel;
+bool          ap_scan_running         = false;
+
+/*
+   Each network costs more when it is strong and close to the channel, the
+   channels 5 apart or more don't overlap. A weak network still costs
+   something, it takes air time.
+*/
+f32
+ChannelCost(u8 channel, s32 network_count)
+{
+    f32 cost = 0.f;
+    for (s32 i = 0; i < network_count; i++)
+    {
+        s32 distance = abs(WiFi.channel(i) - (s32)channel);
+        if (distance >= 5)
+            continue;
+        f32 overlap  = 1.f - distance / 5.f;
+        f32 strength = (WiFi.RSSI(i) + 100) / 70.f; // -100dBm: 0, -30dBm: 1
+        strength     = constrain(strength, 0.f, 1.f);
+        cost += overlap * (0.5f + strength);
+    }
+    return cost;
+}
+
+void
+UpdateAccessPoint()
+{
+    if (!ap_scan_running)
+        return;
+    s32 n = WiFi.scanComplete();
+    if (n == WIFI_SCAN_RUNNING)
+        return;
+    ap_scan_running = false;
+
+    if (n < 0)
+    {
+        Serial.println(F("Wifi scan failed"));
+        WiFi.mode(WIFI_AP);
+        return;
+    }
+
+    u8  best_channel = ap_channel;
+    f32 best_cost    = ChannelCost(ap_channel, n);
+    Serial.printf("%ld networks found\n", n);
+    for (u8 channel : ap_channels)
+    {
+        f32 cost = ChannelCost(channel, n);
+        Serial.printf("channel %2hhu: cost %.2f\n", channel, cost);
+        if (cost < best_cost)
+        {
+            best_cost    = cost;
+            best_channel = channel;
+        }
+    }
+    WiFi.scanDelete();
+
+    // Scanning needs the station mode, we don't need it anymore
+    WiFi.mode(WIFI_AP);
+    if (best_channel != ap_channel)
+    {
+        Serial.printf("Moving the access point to channel %hhu\n",
+                      best_channel);
+        ap_channel = best_channel;
+        WiFi.softAP(wifi_ssid, wifi_password, ap_channel, 0,
+                    max_ap_connection_count);
+    }
+}
+
 void
 StartWifi(bool access_point)
 {
     create_access_point = access_point;
+    LoadServerCache();
     // WiFi.useStaticBuffers(true);
     WiFi.mode(WIFI_STA);
     WiFi.disconnect();
@@ -28,115 +198,191 @@ StartWifi(bool access_point)
     if (access_point)
     {
         Serial.println(F("Wifi mode: Access Point (AP)"));
-        // channel 1, 6, and 11 are non-overlapping and preferred
-        s32 channel_strengths[3] = {0};
-        u8  channel_indices[3]   = {1, 6, 11};
+        // The AP starts right away, it moves to a better channel when the
+        // scan is done (see UpdateAccessPoint).
+        WiFi.mode(WIFI_AP_STA);
+        ap_channel = default_ap_channel;
+        WiFi.softAP(wifi_ssid, wifi_password, ap_channel, 0,
+                    max_ap_connection_count);
+        WiFi.scanNetworks(true);
+        ap_scan_running = true;
+        wifi_state      = WifiState::StartMulticast;
 
-        for (auto& stren : channel_strengths)
-        {
-            stren = -1000;
-        }
-        Serial.println(F("Start scan"));
-        int n = WiFi.scanNetworks();
-        Serial.println("Scan done");
-        if (n == 0)
+        Serial.print(F("IP address: "));
+        Serial.println(WiFi.softAPIP());
+    }
+    else
+    {
+        Serial.println(F("Wifi mode: Station (STA)"));
+        wifi_from_cache = (server_cache_valid && server_cache.channel);
+        if (wifi_from_cache)
         {
-            Serial.println("no networks found");
+            Serial.printf("Cached access point, channel %ld\n",
+                          server_cache.channel);
+            WiFi.begin(wifi_ssid, wifi_password, server_cache.channel,
+                       server_cache.bssid);
         }
         else
         {
-            Serial.print(n);
-            Serial.println(" networks found\n");
-            Serial.println("Nr | SSID                             | RSSI | CH "
-                           "| Encryption");
-            for (int i = 0; i < n; ++i)
-            {
-                String   ssid;
-                uint8_t  encryption_type;
-                int32_t  rssi;
-                uint8_t* bssid;
-                int32_t  ch;
-                WiFi.getNetworkInfo(i, ssid, encryption_type, rssi, bssid, ch);
-                Serial.printf("%2d", i + 1);
-                Serial.print(" | ");
-                Serial.printf("%-32.32s", ssid);
-                Serial.print(" | ");
-                Serial.printf("%4ld", rssi);
-                Serial.print(" | ");
-                Serial.printf("%2ld", ch);
-                Serial.print(" | ");
-                switch (encryption_type)
-                {
-                case WIFI_AUTH_OPEN: Serial.print("open"); break;
-                case WIFI_AUTH_WEP: Serial.print("WEP"); break;
-                case WIFI_AUTH_WPA_PSK: Serial.print("WPA"); break;
-                case WIFI_AUTH_WPA2_PSK: Serial.print("WPA2"); break;
-                case WIFI_AUTH_WPA_WPA2_PSK: Serial.print("WPA+WPA2"); break;
-                case WIFI_AUTH_WPA2_ENTERPRISE: Serial.print("WPA2-EAP"); break;
-                case WIFI_AUTH_WPA3_PSK: Serial.print("WPA3"); break;
-                case WIFI_AUTH_WPA2_WPA3_PSK: Serial.print("WPA2+WPA3"); break;
-                case WIFI_AUTH_WAPI_PSK: Serial.print("WAPI"); break;
-                default: Serial.print("unknown");
-                }
-                Serial.println();
-                u8 bucket = (ch + 1) / 5;
-                // ch:     1 2 3 4 5 6 7 8  9 10 11
-                //         1 < < > > 6 < <  >  > 11
-                // bucket: 0         1           2
-                if (rssi > channel_strengths[bucket])
-                {
-                    channel_strengths[bucket] = rssi;
-                }
-                Serial.printf("channel bucket: %hhu (index=%hhu)\n",
-                              channel_indices[bucket], bucket);
-            }
+            WiFi.begin(wifi_ssid, wifi_password);
         }
-        Serial.println();
-        WiFi.scanDelete();
+        time_wifi_begin = millis();
+        wifi_state      = WifiState::WaitingForWifi;
+    }
+}
 
-        WiFi.mode(WIFI_AP);
+void
+SerializeHello(Serializer& ser)
+{
+    Hello hello;
+    hello.getHeader().serialize(ser);
+    hello.serialize(ser);
+}
 
-        Serial.println(F("Channels bucket strength"));
-        for (u8 i = 0; i < 3; i++)
-        {
-            Serial.printf("%hhu: %ddBm\n", channel_indices[i],
-                          channel_strengths[i]);
-        }
+void
+SendFrame(BufferPtr buffer)
+{
+    u32 size = EncodeFrame(buffer.start, buffer.size(), frame_buffer,
+                           sizeof(frame_buffer));
+    if (size)
+    {
+        Serial.write(frame_buffer, size);
+    }
+}
 
-        s32 channel      = 1;
-        s32 min_strength = channel_strengths[0];
+void
+SendToServer(Serializer& ser)
+{
+    BufferPtr buffer = {ser.full_buffer.start, ser.buffer.start};
+    if (server_link == ServerLink::Serial)
+    {
+        SendFrame(buffer);
+        return;
+    }
+    udp.beginPacket(server_connection.address, server_connection.port);
+    udp.write(buffer.start, buffer.end - buffer.start);
+    udp.endPacket();
+    packets_sent++;
+}
 
-        for (u8 i = 1; i < 3; i++)
-        {
-            if (channel_strengths[i] < min_strength)
-            {
-                min_strength = channel_strengths[i];
-                channel      = channel_indices[i];
-            }
-        }
-        Serial.printf("Picked channel %2ld\n", channel);
-        Serial.println();
+/*
+   Messages from the server over USB serial. The server sends its multicast
+   message on all its serial ports, we say hello so that it knows which device
+   is on the port, but we keep using WiFi until it sends us something else.
+*/
+bool
+ReceiveSerialMessage(Message& message)
+{
+    u8* data = nullptr;
+    u32 size = ReadSerialFrame(data);
+    if (size < 2)
+        return false;
 
-        constexpr s32 max_connection_count = 6;
-        WiFi.softAP(wifi_ssid, wifi_password, channel, 0, max_connection_count);
-        wifi_state = WifiState::StartMulticast;
+    time_last_serial_message = millis();
 
-        Serial.print(F("IP address: "));
-        Serial.println(WiFi.softAPIP());
-    }
-    else
+    message.deserializer =
+        Serializer(SerializerMode::Deserialize, {data, size});
+    message.header.serialize(message.deserializer);
+    message.from = {};
+    if (message.header.type == MessageType::Multicast)
     {
-        Serial.println(F("Wifi mode: Station (STA)"));
-        WiFi.begin(wifi_ssid, wifi_password);
-        wifi_state = WifiState::WaitingForWifi;
+        message = {};
+
+        u8   hello_buffer[64];
+        auto ser = Serializer(SerializerMode::Serialize,
+                              {hello_buffer, (u32)sizeof(hello_buffer)});
+        SerializeHello(ser);
+        SendFrame({ser.full_buffer.start, ser.buffer.start});
+        return false;
     }
+    server_link = ServerLink::Serial;
+    return true;
+}
+
+void
+UpdateClockSync()
+{
+    if (!IsServerConnected())
+        return;
+
+    u32 period = clock_request_period;
+    if (clock_estimate.samples_filled < ClockEstimate::sample_count)
+        period = clock_request_fast_period;
+    if (millis() - time_clock_request_sent < period)
+        return;
+    time_clock_request_sent = millis();
+
+    ClockSync request;
+    request.request_time = esp_timer_get_time();
+
+    u8   request_buffer[32];
+    auto ser = Serializer(SerializerMode::Serialize,
+                          {request_buffer, (u32)sizeof(request_buffer)});
+    request.getHeader().serialize(ser);
+    request.serialize(ser);
+    SendToServer(ser);
+}
+
+void
+ReceiveClockSync(Message& message)
+{
+    u64       received = esp_timer_get_time();
+    ClockSync answer;
+    answer.serialize(message.deserializer);
+    if (!answer.server_time || answer.request_time > received)
+        return;
+
+    taskENTER_CRITICAL(&clock_mux);
+    AddClockSample(clock_estimate, answer.request_time, answer.server_time,
+                   received);
+    taskEXIT_CRITICAL(&clock_mux);
+}
+
+bool
+IsClockSynced()
+{
+    return clock_estimate.synced;
+}
+
+u64
+ToServerMicros(u64 local_time)
+{
+    taskENTER_CRITICAL(&clock_mux);
+    s64 offset = ClockOffset(clock_estimate, local_time);
+    taskEXIT_CRITICAL(&clock_mux);
+    return local_time + offset;
+}
+
+u64
+ServerMicros()
+{
+    return ToServerMicros(esp_timer_get_time());
+}
+
+u32
+ClockRoundTrip()
+{
+    return clock_estimate.synced ? clock_estimate.round_trip : 0;
 }
 
 Message
-ReceiveMessage()
+ReceiveAnyMessage()
 {
     Message message;
 
+    if (ReceiveSerialMessage(message))
+    {
+        return message;
+    }
+    UpdateAccessPoint();
+
+    if (server_link == ServerLink::Serial
+        && millis() - time_last_serial_message > timeout_period)
+    {
+        server_link = ServerLink::Wifi;
+        Serial.println(F("Serial link timed out!"));
+    }
+
     switch (wifi_state)
     {
     case WifiState::WifiOff: StartWifi(create_access_point); break;
@@ -151,10 +397,29 @@ ReceiveMessage()
 
             // TODO: Reset after waiting too much?
         }
+        else if (wifi_from_cache
+                 && millis() - time_wifi_begin > cached_wifi_timeout)
+        {
+            // The access point may have changed, we scan all the channels
+            Serial.println(F("Cached access point not found"));
+            wifi_from_cache = false;
+            WiFi.disconnect();
+            WiFi.begin(wifi_ssid, wifi_password);
+        }
     }
     break;
     case WifiState::StartMulticast:
     {
+        if (server_cache_valid)
+        {
+            server_connection = {IPAddress(server_cache.address),
+                                 server_cache.port};
+            udp.begin(0);
+            time_server_hello = millis();
+            time_hello_sent   = 0;
+            wifi_state        = WifiState::WaitingForServer;
+            break;
+        }
         if (!udp.beginMulticast(multicast_connection.address,
                                 multicast_connection.port))
         {
@@ -163,6 +428,61 @@ ReceiveMessage()
         wifi_state = WifiState::WaitingForMulticast;
     }
     break;
+    case WifiState::WaitingForServer:
+    {
+        // The server answers to a hello like to a client that just connected
+        auto t = millis();
+        if (t - time_hello_sent >= hello_resend_period)
+        {
+            auto ser = Serializer(SerializerMode::Serialize,
+                                  {packet_buffer, udp_packet_size});
+            SerializeHello(ser);
+
+            udp.beginPacket(server_connection.address, server_connection.port);
+            udp.write(ser.full_buffer.start,
+                      ser.buffer.start - ser.full_buffer.start);
+            udp.endPacket();
+            packets_sent++;
+            time_hello_sent = t;
+        }
+
+        auto packet_size = udp.parsePacket();
+        if (packet_size >= 2 && packet_size <= udp_packet_size
+            && udp.remoteIP() == server_connection.address)
+        {
+            udp.read(packet_buffer, packet_size);
+            packets_received++;
+            message.deserializer = Serializer(
+                SerializerMode::Deserialize, {packet_buffer, (u32)packet_size});
+            message.header.serialize(message.deserializer);
+            if (message.header.client_id == ClientId::Server)
+            {
+                Serial.printf("Reconnected to the cached server in %lu ms\n",
+                              t - time_server_hello);
+                message.from               = {udp.remoteIP(), udp.remotePort()};
+                server_link                = ServerLink::Wifi;
+                time_last_message_received = t;
+                wifi_state                 = WifiState::Connected;
+                break;
+            }
+            message = {};
+        }
+        else if (t - time_server_hello > cached_server_timeout)
+        {
+            // Until we find the server with a multicast message
+            Serial.println(F("Cached server not found"));
+            server_cache_valid = false;
+            udp.stop();
+            wifi_state = WifiState::StartMulticast;
+        }
+
+        if (!create_access_point && WiFi.status() != WL_CONNECTED)
+        {
+            udp.stop();
+            wifi_state = WifiState::WaitingForWifi;
+        }
+    }
+    break;
     case WifiState::WaitingForMulticast:
     {
         server_connection = Connection{};
@@ -173,12 +493,14 @@ ReceiveMessage()
             if (packet_size > udp_packet_size)
             {
                 Serial.println(F("Packet too big!"));
+                packets_dropped++;
                 break;
             }
             server_connection.address = udp.remoteIP();
             server_connection.port    = udp.remotePort();
 
             udp.read(packet_buffer, packet_size);
+            packets_received++;
 
             Serial.print(F("Received packet from : "));
             Serial.print(udp.remoteIP());
@@ -207,14 +529,10 @@ ReceiveMessage()
                     udp.stop();
                     udp.begin(0);
 
-                    auto        ser = Serializer(SerializerMode::Serialize,
-                                          {packet_buffer, (u32)packet_size});
-                    const char* txt = "Hello";
-                    LogMessage  log = {};
-                    log.severity    = LogSeverity::Info;
-                    log.string      = {(u8*)txt, strlen(txt)};
-                    log.getHeader().serialize(ser);
-                    log.serialize(ser);
+                    auto ser = Serializer(
+                        SerializerMode::Serialize,
+                        {packet_buffer, (u32)packet_size});
+                    SerializeHello(ser);
 
                     udp.beginPacket(server_connection.address,
                                     server_connection.port);
@@ -222,7 +540,9 @@ ReceiveMessage()
                                         ser.buffer.start};
                     udp.write(buffer.start, buffer.end - buffer.start);
                     udp.endPacket();
+                    packets_sent++;
                     wifi_state = WifiState::Connected;
+                    SaveServerCache();
                 }
                 else
                 {
@@ -251,13 +571,16 @@ ReceiveMessage()
             if (packet_size > udp_packet_size)
             {
                 Serial.println(F("Packet too big!"));
+                packets_dropped++;
                 break;
             }
             udp.read(packet_buffer, packet_size);
+            packets_received++;
             message.deserializer = Serializer(
                 SerializerMode::Deserialize, {packet_buffer, (u32)packet_size});
             message.header.serialize(message.deserializer);
             message.from = {udp.remoteIP(), udp.remotePort()};
+            server_link  = ServerLink::Wifi;
         }
 
         if (t - time_last_message_received > timeout_period)
@@ -272,6 +595,113 @@ ReceiveMessage()
     return message;
 }
 
+// The ClockSync answers are handled here, the application never sees them
+Message
+ReceiveMessage()
+{
+    UpdateClockSync();
+    Message message = ReceiveAnyMessage();
+    if (message.header.type == MessageType::ClockSync)
+    {
+        ReceiveClockSync(message);
+        return {};
+    }
+    return message;
+}
+
+void
+SetMessageHandler(MessageType type, MessageHandler handler)
+{
+    if ((u8)type < (u8)MessageType::MessageTypeMax)
+    {
+        message_handlers[(u8)type] = handler;
+    }
+}
+
+void
+HandleMessage(Message& message)
+{
+    u8 type = (u8)message.header.type;
+    if (type < (u8)MessageType::MessageTypeMax && message_handlers[type])
+    {
+        message_handlers[type](message);
+    }
+}
+
+void
+MeasureLoopTime()
+{
+    u32 now = micros();
+    if (time_last_dispatch)
+    {
+        u32 loop_time = now - time_last_dispatch;
+        loop_time_min = min(loop_time_min, loop_time);
+        loop_time_max = max(loop_time_max, loop_time);
+        loop_time_sum += loop_time;
+        loop_count++;
+    }
+    time_last_dispatch = now;
+}
+
+bool
+IsTelemetryDue()
+{
+    return IsServerConnected()
+           && millis() - time_telemetry_sent >= telemetry_period;
+}
+
+void
+SerializeTelemetry(Serializer& ser)
+{
+    Telemetry telemetry;
+    telemetry.uptime             = millis();
+    telemetry.reset_reason       = (u8)esp_reset_reason();
+    telemetry.loop_time_min      = loop_count ? loop_time_min : 0;
+    telemetry.loop_time_avg      = loop_count ? loop_time_sum / loop_count : 0;
+    telemetry.loop_time_max      = loop_time_max;
+    telemetry.free_heap          = ESP.getFreeHeap();
+    telemetry.largest_free_block = ESP.getMaxAllocHeap();
+    telemetry.rssi = (WiFi.status() == WL_CONNECTED) ? WiFi.RSSI() : 0;
+    telemetry.packets_sent     = packets_sent;
+    telemetry.packets_received = packets_received;
+    telemetry.packets_dropped  = packets_dropped;
+    telemetry.clock_round_trip = ClockRoundTrip();
+    telemetry.samples_dropped  = samples_dropped;
+
+    telemetry.getHeader().serialize(ser);
+    telemetry.serialize(ser);
+
+    time_telemetry_sent = millis();
+    loop_time_min       = UINT32_MAX;
+    loop_time_max       = 0;
+    loop_time_sum       = 0;
+    loop_count          = 0;
+}
+
+u32
+DispatchMessages()
+{
+    MeasureLoopTime();
+    if (IsTelemetryDue())
+    {
+        auto ser = Serializer(SerializerMode::Serialize,
+                              {packet_buffer, udp_packet_size});
+        SerializeTelemetry(ser);
+        SendToServer(ser);
+    }
+
+    u32 count = 0;
+    while (count < max_messages_per_dispatch)
+    {
+        Message message = ReceiveMessage();
+        if (message.header.type == MessageType::Invalid)
+            break;
+        count++;
+        HandleMessage(message);
+    }
+    return count;
+}
+
 void
 WifiScan()
 {
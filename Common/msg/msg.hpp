@@ -11,17 +11,68 @@ extern Connection server_connection;
 constexpr u32 udp_packet_size = 1024;
 extern u8     packet_buffer[udp_packet_size];
 
+/*
+   The server can talk to us over WiFi or over USB serial when we are cabled.
+   We answer on the link its last message came from.
+*/
+enum class ServerLink
+{
+    Wifi,
+    Serial,
+};
+extern ServerLink server_link;
+
 enum class WifiState
 {
     WifiOff,
     WaitingForWifi,
     StartMulticast,
+    WaitingForServer, // Hello sent to the cached server
     WaitingForMulticast,
     Connected,
 };
 extern WifiState wifi_state;
 
+// We can talk to the server over WiFi or USB serial
+inline bool
+IsServerConnected()
+{
+    return wifi_state == WifiState::Connected
+           || server_link == ServerLink::Serial;
+}
+
+/*
+   The clock of the server is estimated with ClockSync messages sent by
+   ReceiveMessage, see clock_sync.hpp. The times are in microseconds, local
+   times come from esp_timer_get_time(). They can be called from any core.
+*/
+bool IsClockSynced();
+u64  ServerMicros();
+u64  ToServerMicros(u64 local_time);
+u32  ClockRoundTrip(); // 0 when the clock isn't synced
+
 void    StartWifi(bool access_point = false);
+void    UpdateAccessPoint(); // Called by ReceiveMessage
 Message ReceiveMessage();
+void    SendToServer(Serializer& ser);
+
+/*
+   DispatchMessages receives all the messages waiting and calls the handler set
+   for their type. The message is only valid during the call.
+*/
+using MessageHandler = void (*)(Message& message);
+void SetMessageHandler(MessageType type, MessageHandler handler);
+void HandleMessage(Message& message);
+u32  DispatchMessages();
+
+/*
+   A Telemetry message is sent every few seconds by DispatchMessages. The loop
+   time is the time between two calls to MeasureLoopTime. The devices that
+   read sensors count the samples they lose in samples_dropped.
+*/
+extern u32 samples_dropped;
+void       MeasureLoopTime();
+bool       IsTelemetryDue();
+void       SerializeTelemetry(Serializer& ser);
 
 void WifiScan();
\ No newline at end of file
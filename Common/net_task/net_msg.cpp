@@ -0,0 +1,104 @@
+#include "net_msg.hpp"
+#include "serial_in.hpp"
+
+u8 app_packet_buffer[udp_packet_size];
+
+static_assert(net_line_size == serial_in_buffer_size,
+              "A serial line must fit in a NetLine");
+
+// Messages received in one update of the network task
+constexpr u32 max_messages_per_update = 16;
+
+// The application keeps the front line until the next call to ReadNetSerial
+bool net_line_returned = false;
+
+// Called by the network task
+void
+UpdateNetMsg()
+{
+    for (u32 i = 0; i < max_messages_per_update; i++)
+    {
+        Message message = ReceiveMessage();
+        if (message.header.type == MessageType::Invalid)
+            break;
+        auto& buffer = message.deserializer.full_buffer;
+        PushNetPacket(net_inbound, buffer.start, buffer.size(),
+                      net_inbound_dropped);
+    }
+
+    while (NetPacket* packet = net_outbound.front())
+    {
+        auto ser = Serializer(SerializerMode::Serialize,
+                              {packet->data, net_packet_size});
+        ser.buffer.start += packet->size;
+        SendToServer(ser);
+        net_outbound.pop();
+    }
+
+    PollSerial();
+    if (serial_in_line_ready)
+    {
+        if (NetLine* line = net_lines.back())
+        {
+            memcpy(line->text, serial_in_line, net_line_size);
+            net_lines.push();
+        }
+        serial_in_line_ready = false;
+    }
+}
+
+bool
+StartNetMsgTask(bool access_point)
+{
+    StartWifi(access_point);
+    return StartNetTask(UpdateNetMsg);
+}
+
+bool
+QueueToServer(Serializer& ser)
+{
+    return PushNetPacket(net_outbound, ser.full_buffer.start,
+                         ser.buffer.start - ser.full_buffer.start,
+                         net_outbound_dropped);
+}
+
+u32
+DispatchNetMessages()
+{
+    MeasureLoopTime();
+    if (IsTelemetryDue())
+    {
+        auto ser = Serializer(SerializerMode::Serialize,
+                              {app_packet_buffer, udp_packet_size});
+        SerializeTelemetry(ser);
+        QueueToServer(ser);
+    }
+
+    u32 count = 0;
+    while (NetPacket* packet = net_inbound.front())
+    {
+        Message message;
+        message.deserializer = Serializer(SerializerMode::Deserialize,
+                                          {packet->data, packet->size});
+        message.header.serialize(message.deserializer);
+        HandleMessage(message);
+        net_inbound.pop();
+        count++;
+    }
+    return count;
+}
+
+const char*
+ReadNetSerial()
+{
+    if (net_line_returned)
+    {
+        net_lines.pop();
+        net_line_returned = false;
+    }
+    NetLine* line = net_lines.front();
+    if (!line)
+        return nullptr;
+    net_line_returned = true;
+    return line->text;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "alias.hpp"
+#include "net_task.hpp"
+#include "msg.hpp"
+
+/*
+   Runs the msg state machine (WiFi, UDP and the USB serial port) in the
+   network task. Once it is started the application must not call the msg
+   functions that use udp, packet_buffer or the serial input, it uses these
+   instead:
+   - QueueToServer instead of SendToServer, serialized in app_packet_buffer
+   - DispatchNetMessages instead of DispatchMessages
+   - ReadNetSerial instead of ReadSerial
+   The handlers set with SetMessageHandler are called by DispatchNetMessages
+   in the application loop.
+*/
+
+static_assert(net_packet_size >= udp_packet_size,
+              "A UDP packet must fit in a NetPacket");
+
+extern u8 app_packet_buffer[udp_packet_size];
+
+bool        StartNetMsgTask(bool access_point = false);
+bool        QueueToServer(Serializer& ser);
+u32         DispatchNetMessages();
+const char* ReadNetSerial();
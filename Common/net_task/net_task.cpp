@@ -0,0 +1,121 @@
+#include "net_task.hpp"
+#include <string.h>
+
+#ifdef ARDUINO
+#    include <Arduino.h>
+#else
+#    include <chrono>
+#    include <thread>
+#endif
+
+SpscQueue<NetPacket, net_queue_size> net_inbound;
+SpscQueue<NetPacket, net_queue_size> net_outbound;
+SpscQueue<NetLine, 4>                net_lines;
+
+u32 net_inbound_dropped  = 0;
+u32 net_outbound_dropped = 0;
+
+NetUpdate         net_update    = nullptr;
+u32               net_period_ms = 1;
+std::atomic<bool> net_task_running{false};
+
+#ifdef ARDUINO
+
+// Above the Arduino loop task, below the WiFi task
+constexpr UBaseType_t net_task_priority   = 2;
+constexpr u32         net_task_stack_size = 8192;
+constexpr BaseType_t  net_task_core       = 0;
+
+std::atomic<bool> net_task_done{true};
+
+void
+NetTask(void*)
+{
+    while (net_task_running)
+    {
+        net_update();
+        vTaskDelay(pdMS_TO_TICKS(net_period_ms));
+    }
+    net_task_done = true;
+    vTaskDelete(nullptr);
+}
+
+bool
+StartNetTask(NetUpdate update, u32 period_ms)
+{
+    if (net_task_running)
+        return false;
+    net_update       = update;
+    net_period_ms    = period_ms;
+    net_task_running = true;
+    net_task_done    = false;
+    if (xTaskCreatePinnedToCore(NetTask, "net", net_task_stack_size, nullptr,
+                                net_task_priority, nullptr, net_task_core)
+        != pdPASS)
+    {
+        Serial.println(F("Can't create the network task"));
+        net_task_running = false;
+        net_task_done    = true;
+        return false;
+    }
+    return true;
+}
+
+void
+StopNetTask()
+{
+    net_task_running = false;
+    while (!net_task_done)
+    {
+        delay(1);
+    }
+}
+
+#else
+
+std::thread net_thread;
+
+bool
+StartNetTask(NetUpdate update, u32 period_ms)
+{
+    if (net_task_running)
+        return false;
+    net_update       = update;
+    net_period_ms    = period_ms;
+    net_task_running = true;
+    net_thread       = std::thread([]() {
+        while (net_task_running)
+        {
+            net_update();
+            std::this_thread::sleep_for(
+                std::chrono::milliseconds(net_period_ms));
+        }
+    });
+    return true;
+}
+
+void
+StopNetTask()
+{
+    net_task_running = false;
+    if (net_thread.joinable())
+        net_thread.join();
+}
+
+#endif
+
+bool
+PushNetPacket(SpscQueue<NetPacket, net_queue_size>& queue, const u8* data,
+              u32 size, u32& dropped)
+{
+    NetPacket* packet = queue.back();
+    if (!packet || size > net_packet_size)
+    {
+        dropped++;
+        return false;
+    }
+    memcpy(packet->data, data, size);
+    packet->size = size;
+    queue.push();
+    return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "alias.hpp"
+#include "spsc_queue.hpp"
+
+/*
+   The network task runs the network code on its own core so that the
+   application loop (sensors, LEDs...) is never blocked by WiFi or the serial
+   port. The two sides only talk through the SPSC queues below:
+   - net_inbound: the messages received from the server, for the application
+   - net_outbound: the messages the application sends to the server
+   - net_lines: the text lines received on the serial port
+
+   On the ESP32 the task is a FreeRTOS task pinned to core 0, the Arduino loop
+   runs on core 1. On a single core ESP32 (C3) it is a task with a higher
+   priority than the loop. Anywhere else it is a std::thread, so the queues and
+   the application side can be tested on a computer.
+*/
+
+constexpr u32 net_packet_size = 1024;
+constexpr u32 net_queue_size  = 8;
+constexpr u32 net_line_size   = 256;
+
+struct NetPacket
+{
+    u32 size = 0;
+    u8  data[net_packet_size];
+};
+
+struct NetLine
+{
+    char text[net_line_size];
+};
+
+extern SpscQueue<NetPacket, net_queue_size> net_inbound;
+extern SpscQueue<NetPacket, net_queue_size> net_outbound;
+extern SpscQueue<NetLine, 4>                net_lines;
+
+// Packets lost because a queue was full
+extern u32 net_inbound_dropped;
+extern u32 net_outbound_dropped;
+
+/*
+   update is called in a loop by the network task, it must not block for long.
+   The task sleeps for period_ms between two calls.
+*/
+using NetUpdate = void (*)();
+bool StartNetTask(NetUpdate update, u32 period_ms = 1);
+// Waits for the task to return
+void StopNetTask();
+
+// Copies a packet to a queue, counts it in dropped when the queue is full
+bool PushNetPacket(SpscQueue<NetPacket, net_queue_size>& queue, const u8* data,
+                   u32 size, u32& dropped);
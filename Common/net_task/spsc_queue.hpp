@@ -0,0 +1,61 @@
+#pragma once
+#include "alias.hpp"
+#include <atomic>
+
+/*
+   Lock-free queue with a single producer and a single consumer, each one can
+   run on its own core. The elements are written and read in place:
+       if (T* packet = queue.back()) { fill packet; queue.push(); }
+       if (T* packet = queue.front()) { read packet; queue.pop(); }
+   read and write are free-running counters, the element i is at
+   i % capacity.
+*/
+template<typename T, u32 capacity>
+struct SpscQueue
+{
+    static_assert(capacity && (capacity & (capacity - 1)) == 0,
+                  "The capacity must be a power of 2");
+
+    // Producer side, nullptr when the queue is full
+    T*
+    back()
+    {
+        u32 w = write.load(std::memory_order_relaxed);
+        if (w - read.load(std::memory_order_acquire) == capacity)
+            return nullptr;
+        return &elements[w % capacity];
+    }
+    void
+    push()
+    {
+        write.store(write.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+    }
+
+    // Consumer side, nullptr when the queue is empty
+    T*
+    front()
+    {
+        u32 r = read.load(std::memory_order_relaxed);
+        if (r == write.load(std::memory_order_acquire))
+            return nullptr;
+        return &elements[r % capacity];
+    }
+    void
+    pop()
+    {
+        read.store(read.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+    }
+
+    u32
+    size()
+    {
+        return write.load(std::memory_order_acquire)
+               - read.load(std::memory_order_acquire);
+    }
+
+    T                elements[capacity];
+    std::atomic<u32> read{0};
+    std::atomic<u32> write{0};
+};
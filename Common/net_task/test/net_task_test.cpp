@@ -0,0 +1,234 @@
+/*
+   Checks SpscQueue and the std::thread branch of net_task.cpp:
+   - a full and an empty queue, the free-running counters wrapping around
+   - PushNetPacket counting the dropped packets
+   - the network task as the producer of net_inbound and as the consumer of
+     net_outbound, with the main thread on the other side
+
+   Exit code 1 when a check fails.
+*/
+#include "net_task.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+constexpr u32 packet_count = 10000;
+
+u32 failures = 0;
+
+#define CHECK(condition)                                                      \
+    do                                                                        \
+    {                                                                         \
+        if (!(condition))                                                     \
+        {                                                                     \
+            printf("%s:%d: %s\n", __FILE__, __LINE__, #condition);            \
+            failures++;                                                       \
+        }                                                                     \
+    } while (0)
+
+/*
+   Pushes and pops count elements through the queue, with at most fill
+   elements in it. The elements are numbered from first.
+*/
+template<typename Queue>
+void
+PushPop(Queue& queue, u32 count, u32 fill, u32 first)
+{
+    u32 pushed = 0;
+    u32 popped = 0;
+    while (popped < count)
+    {
+        while (pushed < count && queue.size() < fill)
+        {
+            u32* element = queue.back();
+            CHECK(element);
+            if (!element)
+                return;
+            *element = first + pushed++;
+            queue.push();
+        }
+        u32* element = queue.front();
+        CHECK(element && *element == first + popped);
+        if (!element)
+            return;
+        queue.pop();
+        popped++;
+    }
+    CHECK(!queue.front());
+    CHECK(queue.size() == 0);
+}
+
+void
+TestQueue()
+{
+    SpscQueue<u32, 4> queue;
+    CHECK(!queue.front());
+    CHECK(queue.size() == 0);
+
+    // Full
+    for (u32 i = 0; i < 4; i++)
+    {
+        u32* element = queue.back();
+        CHECK(element);
+        *element = i;
+        queue.push();
+    }
+    CHECK(!queue.back());
+    CHECK(queue.size() == 4);
+
+    // Empty again, in order
+    for (u32 i = 0; i < 4; i++)
+    {
+        u32* element = queue.front();
+        CHECK(element && *element == i);
+        queue.pop();
+    }
+    CHECK(!queue.front());
+    CHECK(queue.back());
+
+    // The elements wrap around the end of the array
+    for (u32 fill = 1; fill <= 4; fill++)
+    {
+        PushPop(queue, 37, fill, fill * 100);
+    }
+
+    // The counters wrap around the end of u32, full and empty on both sides
+    SpscQueue<u32, 4> wrapping;
+    wrapping.read  = 0xFFFFFFFE;
+    wrapping.write = 0xFFFFFFFE;
+    CHECK(!wrapping.front());
+    for (u32 i = 0; i < 4; i++)
+    {
+        *wrapping.back() = i;
+        wrapping.push();
+    }
+    CHECK(!wrapping.back());
+    CHECK(wrapping.size() == 4);
+    CHECK(wrapping.write == 2);
+    for (u32 i = 0; i < 4; i++)
+    {
+        u32* element = wrapping.front();
+        CHECK(element && *element == i);
+        wrapping.pop();
+    }
+    CHECK(!wrapping.front());
+    CHECK(wrapping.size() == 0);
+    PushPop(wrapping, 37, 3, 0);
+}
+
+void
+TestPushNetPacket()
+{
+    SpscQueue<NetPacket, net_queue_size> queue;
+    u32                                  dropped = 0;
+    u8                                   data[net_packet_size + 1] = {};
+
+    CHECK(!PushNetPacket(queue, data, sizeof(data), dropped));
+    CHECK(dropped == 1);
+    for (u32 i = 0; i < net_queue_size; i++)
+    {
+        data[0] = (u8)i;
+        CHECK(PushNetPacket(queue, data, i + 1, dropped));
+    }
+    CHECK(!PushNetPacket(queue, data, 1, dropped));
+    CHECK(dropped == 2);
+    for (u32 i = 0; i < net_queue_size; i++)
+    {
+        NetPacket* packet = queue.front();
+        CHECK(packet && packet->size == i + 1 && packet->data[0] == i);
+        queue.pop();
+    }
+}
+
+// The network task side: fills net_inbound and drains net_outbound
+u32 task_sent     = 0;
+u32 task_received = 0;
+u32 task_errors   = 0;
+
+void
+NetTaskUpdate()
+{
+    while (task_sent < packet_count)
+    {
+        NetPacket* packet = net_inbound.back();
+        if (!packet)
+            break;
+        memcpy(packet->data, &task_sent, sizeof(task_sent));
+        packet->size = sizeof(task_sent);
+        net_inbound.push();
+        task_sent++;
+    }
+    while (NetPacket* packet = net_outbound.front())
+    {
+        u32 number;
+        memcpy(&number, packet->data, sizeof(number));
+        if (packet->size != sizeof(number) || number != task_received)
+            task_errors++;
+        net_outbound.pop();
+        task_received++;
+    }
+}
+
+void
+TestNetTask()
+{
+    CHECK(StartNetTask(NetTaskUpdate, 0));
+    CHECK(!StartNetTask(NetTaskUpdate, 0));
+
+    u32 sent     = 0;
+    u32 received = 0;
+    while (received < packet_count || sent < packet_count)
+    {
+        bool idle = true;
+        if (sent < packet_count)
+        {
+            u8 data[sizeof(sent)];
+            memcpy(data, &sent, sizeof(sent));
+            u32 dropped = 0;
+            if (PushNetPacket(net_outbound, data, sizeof(data), dropped))
+            {
+                sent++;
+                idle = false;
+            }
+        }
+        if (NetPacket* packet = net_inbound.front())
+        {
+            u32 number;
+            memcpy(&number, packet->data, sizeof(number));
+            CHECK(packet->size == sizeof(number) && number == received);
+            net_inbound.pop();
+            received++;
+            idle = false;
+        }
+        if (idle)
+            std::this_thread::yield();
+    }
+    // The task reads the last packets before it stops
+    while (net_outbound.size())
+    {
+        std::this_thread::yield();
+    }
+    StopNetTask();
+
+    CHECK(task_sent == packet_count);
+    CHECK(task_received == packet_count);
+    CHECK(task_errors == 0);
+    CHECK(!net_inbound.front());
+    CHECK(!net_outbound.front());
+}
+
+int
+main()
+{
+    TestQueue();
+    TestPushNetPacket();
+    TestNetTask();
+
+    if (failures)
+    {
+        printf("%u checks failed\n", failures);
+        return 1;
+    }
+    printf("Passed\n");
+    return 0;
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include "alias.hpp"
+
+/*
+   Messages sent over USB serial are framed so they can be mixed with the text
+   printed by the firmware. A frame is:
+       0, COBS(message + crc16 of the message), 0
+   COBS removes all the 0 bytes from the data and text never contains one, so a
+   0 always starts or ends a frame. When a frame can't be decoded, the bytes
+   before the 0 were text and the 0 starts the next frame.
+*/
+
+constexpr u32 frame_max_message_size = 1024;
+
+// Size of the frame of a message of message_size bytes, with the delimiters
+constexpr u32
+FrameSize(u32 message_size)
+{
+    return message_size + 2 + (message_size + 2) / 254 + 1 + 2;
+}
+
+// CRC-16/CCITT-FALSE
+inline u16
+Crc16(const u8* data, u32 size)
+{
+    u16 crc = 0xFFFF;
+    for (u32 i = 0; i < size; i++)
+    {
+        crc ^= (u16)(data[i] << 8);
+        for (u8 bit = 0; bit < 8; bit++)
+        {
+            if (crc & 0x8000)
+                crc = (u16)((crc << 1) ^ 0x1021);
+            else
+                crc = (u16)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+// Returns the size of the frame written to frame, or 0 if it doesn't fit
+inline u32
+EncodeFrame(const u8* message, u32 size, u8* frame, u32 frame_size)
+{
+    if (frame_size < FrameSize(size))
+        return 0;
+
+    u16 crc          = Crc16(message, size);
+    u8  crc_bytes[2] = {(u8)(crc & 0xFF), (u8)(crc >> 8)};
+
+    u8* out      = frame;
+    *out++       = 0;
+    u8* code_ptr = out++;
+    u8  code     = 1;
+
+    auto push = [&](u8 byte) {
+        if (byte != 0)
+        {
+            *out++ = byte;
+            code++;
+        }
+        if (byte == 0 || code == 0xFF)
+        {
+            *code_ptr = code;
+            code_ptr  = out++;
+            code      = 1;
+        }
+    };
+    for (u32 i = 0; i < size; i++)
+        push(message[i]);
+    push(crc_bytes[0]);
+    push(crc_bytes[1]);
+
+    *code_ptr = code;
+    *out++    = 0;
+    return (u32)(out - frame);
+}
+
+/*
+   Decodes the content of a frame in place, without the delimiters. Returns the
+   size of the message, or 0 if the frame is invalid.
+*/
+inline u32
+DecodeFrame(u8* frame, u32 size)
+{
+    u32 read  = 0;
+    u32 write = 0;
+    while (read < size)
+    {
+        u8 code = frame[read++];
+        if (code == 0 || read + code - 1 > size)
+            return 0;
+        for (u8 i = 1; i < code; i++)
+        {
+            frame[write++] = frame[read++];
+        }
+        if (code != 0xFF && read < size)
+        {
+            frame[write++] = 0;
+        }
+    }
+
+    if (write <= 2)
+        return 0;
+    u32 message_size = write - 2;
+    u16 crc = (u16)(frame[message_size] | (frame[message_size + 1] << 8));
+    if (crc != Crc16(frame, message_size))
+        return 0;
+    return message_size;
+}
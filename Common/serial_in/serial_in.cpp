@@ -1,4 +1,12 @@
 #include "serial_in.hpp"
 
 char serial_in_buffer[serial_in_buffer_size] = {};
-u32  serial_in_buffer_next                   = 0;
\ No newline at end of file
+u32  serial_in_buffer_next                   = 0;
+char serial_in_line[serial_in_buffer_size]   = {};
+bool serial_in_line_ready                    = false;
+
+u8   serial_frame_buffer[serial_frame_buffer_size] = {};
+u32  serial_frame_next                             = 0;
+bool serial_in_frame                               = false;
+u32  serial_frame_message_size                     = 0;
+bool serial_frame_returned                         = false;
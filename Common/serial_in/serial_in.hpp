@@ -1,39 +1,121 @@
 #pragma once
 #include <Arduino.h>
 #include "alias.hpp"
+#include "frame.hpp"
 
 constexpr u32 serial_in_buffer_size = 256;
 extern char   serial_in_buffer[serial_in_buffer_size];
 extern u32    serial_in_buffer_next;
+// Last line received, a line that wasn't read is replaced by the next one
+extern char serial_in_line[serial_in_buffer_size];
+extern bool serial_in_line_ready;
 
-inline const char*
-ReadSerial()
+// Frames sent by the Controller, see frame.hpp
+constexpr u32 serial_frame_buffer_size = FrameSize(frame_max_message_size);
+extern u8     serial_frame_buffer[serial_frame_buffer_size];
+extern u32    serial_frame_next;
+extern bool   serial_in_frame;
+// Size of the message decoded in serial_frame_buffer, 0 if there is none
+extern u32  serial_frame_message_size;
+extern bool serial_frame_returned;
+
+inline void
+ReadSerialTextChar(char c)
 {
-    const char* out = nullptr;
-    while (Serial.available())
+    Serial.print(c);
+
+    if (c == '\r')
+    {
+        c = '\0';
+    }
+
+    if (c == '\n' || (serial_in_buffer_next + 1 >= serial_in_buffer_size))
+    {
+        serial_in_buffer[serial_in_buffer_next] = '\0';
+        serial_in_buffer_next                   = 0;
+
+        memcpy(serial_in_line, serial_in_buffer, serial_in_buffer_size);
+        serial_in_line_ready = true;
+        Serial.print(F(">"));
+        Serial.println(serial_in_line);
+    }
+    else
     {
-        char c = (char)Serial.read();
-        Serial.print(c);
+        serial_in_buffer[serial_in_buffer_next++] = c;
+    }
+}
 
-        if (c == '\r')
+/*
+   Reads the text and the frames received. It stops when a frame is waiting to
+   be read.
+*/
+inline void
+PollSerial()
+{
+    while (!serial_frame_message_size && Serial.available())
+    {
+        u8 c = (u8)Serial.read();
+        if (serial_in_frame)
         {
-            c = '\0';
+            if (c == 0)
+            {
+                // Either the end of a frame, or the start of one if the bytes
+                // before were not a frame. We drop them.
+                if (serial_frame_next)
+                {
+                    serial_frame_message_size =
+                        DecodeFrame(serial_frame_buffer, serial_frame_next);
+                    serial_in_frame = (serial_frame_message_size == 0);
+                }
+                serial_frame_next = 0;
+            }
+            else if (serial_frame_next < serial_frame_buffer_size)
+            {
+                serial_frame_buffer[serial_frame_next++] = c;
+            }
+            else
+            {
+                Serial.println(F("Serial frame too big!"));
+                serial_frame_next = 0;
+                serial_in_frame   = false;
+            }
         }
-
-        if (c == '\n' || (serial_in_buffer_next + 1 >= serial_in_buffer_size))
+        else if (c == 0)
         {
-            serial_in_buffer[serial_in_buffer_next] = '\0';
-            serial_in_buffer_next                   = 0;
-
-            out = serial_in_buffer;
-            Serial.print(F(">"));
-            Serial.println(serial_in_buffer);
-            break;
+            serial_in_frame   = true;
+            serial_frame_next = 0;
         }
         else
         {
-            serial_in_buffer[serial_in_buffer_next++] = c;
+            ReadSerialTextChar((char)c);
         }
     }
-    return out;
-}
\ No newline at end of file
+}
+
+inline const char*
+ReadSerial()
+{
+    PollSerial();
+    if (!serial_in_line_ready)
+        return nullptr;
+    serial_in_line_ready = false;
+    return serial_in_line;
+}
+
+/*
+   Returns the size of the message received in a frame and sets message to
+   it, or 0 if there is none. The message is valid until the next call.
+*/
+inline u32
+ReadSerialFrame(u8*& message)
+{
+    if (serial_frame_returned)
+    {
+        serial_frame_message_size = 0;
+        serial_frame_returned     = false;
+    }
+    PollSerial();
+    message               = serial_frame_buffer;
+    serial_frame_returned = (serial_frame_message_size != 0);
+    return serial_frame_message_size;
+}
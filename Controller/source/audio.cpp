@@ -6,8 +6,12 @@
 #include <alext.h>
 #include <sndfile.h>
 
+#include <future>
+
 /*
-   A Source plays one sound file at a time.
+   A Source plays one sound file at a time. A streaming source can have a next
+   stream that is decoded right after the current one, in the same buffer
+   queue, so there is no gap between them.
 */
 struct Source
 {
@@ -19,14 +23,43 @@ struct Source
     bool should_stop     = false;
     bool streaming       = false;
     // Streaming:
-    SF_INFO  sf_info;
-    SNDFILE* snd_file = nullptr;
+    std::shared_ptr<StreamDecoder> stream;
+    std::shared_ptr<StreamDecoder> next_stream;
 
     sconst u32 buffer_count             = 4;
     sconst s32 buffer_size              = 8 * 1024;
     u32        al_buffers[buffer_count] = {0};
 };
 
+/*
+   StreamDecoder reads a streamed file. The file is opened and the first
+   buffers are decoded in another thread (see PrepareStream), the rest is read
+   when the source needs more data.
+*/
+struct StreamDecoder
+{
+    StreamDecoder() {}
+    ~StreamDecoder()
+    {
+        if (opened.valid())
+            opened.wait();
+        if (snd_file)
+            sf_close(snd_file);
+    }
+
+    Path     path;
+    SF_INFO  sf_info  = {};
+    SNDFILE* snd_file = nullptr;
+    bool     valid    = false;
+    bool     started  = false;
+    Str      error; // Printed by WaitStream, Print isn't thread safe
+
+    std::vector<f32> first_samples;
+    u64              first_samples_read = 0;
+
+    std::future<bool> opened;
+};
+
 struct Audio
 {
     Audio() {}
@@ -40,8 +73,8 @@ struct Audio
 Audio audio;
 
 bool
-LoadFileToBuffer(SNDFILE* sndfile, SF_INFO sf_info, ALuint al_buffer,
-                 sf_count_t sample_count)
+UploadToBuffer(const f32* samples, sf_count_t frame_count, SF_INFO sf_info,
+               ALuint al_buffer)
 {
     auto format = AL_NONE;
     if (sf_info.channels == 1)
@@ -53,6 +86,24 @@ LoadFileToBuffer(SNDFILE* sndfile, SF_INFO sf_info, ALuint al_buffer,
         format = AL_FORMAT_STEREO_FLOAT32;
     }
 
+    alBufferData(al_buffer, format, samples,
+                 (ALsizei)(frame_count * sf_info.channels * sizeof(f32)),
+                 sf_info.samplerate);
+
+    auto err = alGetError();
+    if (err != AL_NO_ERROR)
+    {
+        PrintError("OpenAL Error: {}\n", alGetString(err));
+        return {};
+    }
+
+    return true;
+}
+
+bool
+LoadFileToBuffer(SNDFILE* sndfile, SF_INFO sf_info, ALuint al_buffer,
+                 sf_count_t sample_count)
+{
     if (sample_count / sizeof(f32) > (sf_count_t)(INT_MAX / sizeof(f32)))
     {
         PrintError("Too many samples ({})\n", sample_count);
@@ -70,18 +121,7 @@ LoadFileToBuffer(SNDFILE* sndfile, SF_INFO sf_info, ALuint al_buffer,
         return false;
     }
 
-    alBufferData(al_buffer, format, audio_buffer.data(),
-                 (ALsizei)audio_buffer.size() * sizeof(f32),
-                 sf_info.samplerate);
-
-    auto err = alGetError();
-    if (err != AL_NO_ERROR)
-    {
-        PrintError("OpenAL Error: {}\n", alGetString(err));
-        return {};
-    }
-
-    return true;
+    return UploadToBuffer(audio_buffer.data(), num_frames, sf_info, al_buffer);
 }
 
 AudioBuffer
@@ -124,28 +164,110 @@ LoadAudioFile(const Path& path, bool streaming)
         }
 
         alGenBuffers(1, &buffer.al_buffer);
-        LoadFileToBuffer(sndfile, sf_info, buffer.al_buffer, sf_info.frames);
+        if (LoadFileToBuffer(sndfile, sf_info, buffer.al_buffer,
+                             sf_info.frames))
+        {
+            buffer.size = (u64)sf_info.frames * sf_info.channels * sizeof(f32);
+        }
     }
 
     return buffer;
 }
 
-void
-InitStream(const Path& path, Source& source)
+bool
+OpenStream(StreamDecoder& stream)
+{
+    // This can run in another thread (see PrepareStream), so no OpenAL calls
+    // and no Print here.
+    auto filename   = stream.path.string();
+    stream.snd_file = sf_open(filename.c_str(), SFM_READ, &stream.sf_info);
+
+    if (!stream.snd_file)
+    {
+        stream.error = fmt::format("Could not open audio in {}: {}\n",
+                                   filename, sf_strerror(stream.snd_file));
+        return false;
+    }
+
+    if (stream.sf_info.frames < 1)
+    {
+        stream.error = fmt::format("Bad sample count in {} ({})\n", filename,
+                                   stream.sf_info.frames);
+        return false;
+    }
+
+    if (stream.sf_info.channels != 1 && stream.sf_info.channels != 2)
+    {
+        stream.error = fmt::format("Unsupported channel count in {} ({})\n",
+                                   filename, stream.sf_info.channels);
+        return false;
+    }
+
+    // Decode enough to fill all the buffers of a source
+    sf_count_t frame_count = Source::buffer_count * Source::buffer_size;
+    stream.first_samples.resize((u64)stream.sf_info.channels * frame_count);
+    auto num_frames = sf_readf_float(
+        stream.snd_file, stream.first_samples.data(), frame_count);
+    if (num_frames < 1)
+    {
+        stream.error = fmt::format("Can't decode {}\n", filename);
+        return false;
+    }
+    stream.first_samples.resize((u64)stream.sf_info.channels * num_frames);
+
+    return true;
+}
+
+bool
+WaitStream(StreamDecoder& stream)
 {
-    auto filename   = path.string();
-    source.snd_file = sf_open(filename.c_str(), SFM_READ, &source.sf_info);
+    if (stream.opened.valid())
+    {
+        stream.valid = stream.opened.get();
+        if (!stream.valid)
+        {
+            PrintError("{}", stream.error);
+        }
+    }
+    return stream.valid;
+}
+
+bool
+LoadStreamToBuffer(StreamDecoder& stream, ALuint al_buffer)
+{
+    auto             channels = (u64)stream.sf_info.channels;
+    std::vector<f32> audio_buffer(channels * Source::buffer_size);
+
+    // The samples decoded in advance are used first
+    u64 copied = std::min(stream.first_samples.size()
+                              - stream.first_samples_read,
+                          audio_buffer.size());
+    std::copy_n(stream.first_samples.data() + stream.first_samples_read,
+                copied, audio_buffer.data());
+    stream.first_samples_read += copied;
 
-    if (!source.snd_file)
+    sf_count_t num_frames = copied / channels;
+    if (num_frames < Source::buffer_size)
     {
-        PrintError("Could not open audio in {}: {}\n", filename.c_str(),
-                   sf_strerror(source.snd_file));
+        num_frames +=
+            sf_readf_float(stream.snd_file, audio_buffer.data() + copied,
+                           Source::buffer_size - num_frames);
     }
 
-    if (source.sf_info.frames < 1)
+    if (num_frames < 1)
+    {
+        return false;
+    }
+
+    return UploadToBuffer(audio_buffer.data(), num_frames, stream.sf_info,
+                          al_buffer);
+}
+
+void
+InitStream(Source& source)
+{
+    if (!WaitStream(*source.stream))
     {
-        PrintError("Bad sample count in {} ({})\n", filename.c_str(),
-                   source.sf_info.frames);
         return;
     }
 
@@ -160,8 +282,7 @@ InitStream(const Path& path, Source& source)
     for (u32 i = 0; i < source.buffer_count; i++)
     {
         auto al_buffer = source.al_buffers[i];
-        if (!LoadFileToBuffer(source.snd_file, source.sf_info, al_buffer,
-                              source.buffer_size))
+        if (!LoadStreamToBuffer(*source.stream, al_buffer))
         {
             break;
         }
@@ -176,6 +297,40 @@ InitStream(const Path& path, Source& source)
     }
 }
 
+bool
+SwitchToNextStream(Source& source)
+{
+    if (!source.next_stream)
+    {
+        return false;
+    }
+    auto next          = std::move(source.next_stream);
+    source.next_stream = nullptr;
+
+    // The next stream was prepared long before, this shouldn't wait.
+    if (!WaitStream(*next))
+    {
+        return false;
+    }
+
+    // All the buffers queued on a source must have the same format
+    auto& info = source.stream->sf_info;
+    if (next->sf_info.channels != info.channels
+        || next->sf_info.samplerate != info.samplerate)
+    {
+        PrintWarning("Can't queue {} after {}, the formats are different\n",
+                     next->path.filename().string(),
+                     source.stream->path.filename().string());
+        return false;
+    }
+
+    Print("Queued {} after {}\n", next->path.filename().string(),
+          source.stream->path.filename().string());
+    next->started = true;
+    source.stream = std::move(next);
+    return true;
+}
+
 bool
 UpdateStream(Source& source)
 {
@@ -197,8 +352,17 @@ UpdateStream(Source& source)
         alSourceUnqueueBuffers(source.al_source, 1, &free_buffer);
         processed--;
 
-        if (LoadFileToBuffer(source.snd_file, source.sf_info, free_buffer,
-                             source.buffer_size))
+        if (!source.stream || !source.stream->valid)
+        {
+            continue;
+        }
+
+        bool loaded = LoadStreamToBuffer(*source.stream, free_buffer);
+        if (!loaded && SwitchToNextStream(source))
+        {
+            loaded = LoadStreamToBuffer(*source.stream, free_buffer);
+        }
+        if (loaded)
         {
             alSourceQueueBuffers(source.al_source, 1, &free_buffer);
         }
@@ -233,10 +397,8 @@ UpdateStream(Source& source)
 void
 TerminateStream(Source& source)
 {
-    if (source.snd_file)
-    {
-        sf_close(source.snd_file);
-    }
+    source.stream      = nullptr;
+    source.next_stream = nullptr;
     if (source.al_buffers[0] && alIsBuffer(source.al_buffers[0]))
     {
         alDeleteBuffers(source.buffer_count, source.al_buffers);
@@ -267,8 +429,30 @@ DestroyAudioBuffer(AudioBuffer& buffer)
     }
 }
 
+bool
+IsBufferPlaying(const AudioBuffer& buffer)
+{
+    if (!buffer.al_buffer)
+        return false;
+
+    for (s32 i = 0; i < audio.source_playing_count; i++)
+    {
+        auto& source = audio.sources[i];
+        if (source.playing_id && !source.streaming)
+        {
+            ALint buffer_playing = 0;
+            alGetSourcei(source.al_source, AL_BUFFER, &buffer_playing);
+            if (buffer_playing == buffer.al_buffer)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 AudioPlaying
-PlayAudio(const AudioBuffer& buffer, AudioSettings s)
+AcquireSource(AudioSettings s)
 {
     AudioPlaying playing = {};
 
@@ -300,11 +484,33 @@ PlayAudio(const AudioBuffer& buffer, AudioSettings s)
 
     alSourcef(source.al_source, AL_GAIN, s.gain * s.gain);
     alSourcef(source.al_source, AL_PITCH, s.pitch);
+    source.should_stop = false;
+
+    return playing;
+}
 
+AudioPlaying
+PlayAudio(const AudioBuffer& buffer, AudioSettings s)
+{
+    AudioPlaying playing = AcquireSource(s);
+    if (playing.source_index == -1)
+    {
+        return playing;
+    }
+
+    auto& source     = audio.sources[playing.source_index];
     source.streaming = buffer.streaming;
     if (buffer.streaming)
     {
-        InitStream(buffer.path, source);
+        // Opened on this thread, when InitStream waits for it
+        source.stream   = std::make_shared<StreamDecoder>();
+        auto* stream    = source.stream.get();
+        stream->path    = buffer.path;
+        stream->started = true;
+        stream->opened =
+            std::async(std::launch::deferred,
+                       [stream]() { return OpenStream(*stream); });
+        InitStream(source);
     }
     else
     {
@@ -313,8 +519,6 @@ PlayAudio(const AudioBuffer& buffer, AudioSettings s)
         alSourcePlay(source.al_source);
     }
 
-    source.should_stop = false;
-
     Print("Playing {} on source {} (id {}) gain = {}, pitch = {}\n",
           buffer.path.filename().string(), source.al_source, playing.playing_id,
           s.gain, s.pitch);
@@ -322,6 +526,90 @@ PlayAudio(const AudioBuffer& buffer, AudioSettings s)
     return playing;
 }
 
+PreparedStream
+PrepareStream(const Path& path)
+{
+    PreparedStream stream;
+    stream.decoder       = std::make_shared<StreamDecoder>();
+    stream.decoder->path = path;
+
+    // The decoder waits for the thread in its destructor, the pointer stays
+    // valid.
+    auto* decoder   = stream.decoder.get();
+    decoder->opened = std::async(std::launch::async,
+                                 [decoder]() { return OpenStream(*decoder); });
+    return stream;
+}
+
+bool
+IsStreamReady(const PreparedStream& stream)
+{
+    if (!stream.decoder)
+        return false;
+    auto& opened = stream.decoder->opened;
+    if (!opened.valid())
+        return true;
+    return opened.wait_for(std::chrono::seconds(0))
+           == std::future_status::ready;
+}
+
+bool
+IsStreamFailed(const PreparedStream& stream)
+{
+    return IsStreamReady(stream) && !WaitStream(*stream.decoder);
+}
+
+bool
+IsStreamStarted(const PreparedStream& stream)
+{
+    return stream.decoder && stream.decoder->started;
+}
+
+AudioPlaying
+PlayStream(PreparedStream& stream, AudioSettings s)
+{
+    if (!stream.decoder || stream.decoder->started)
+    {
+        PrintError("This stream can't be played\n");
+        return {};
+    }
+
+    AudioPlaying playing = AcquireSource(s);
+    if (playing.source_index == -1)
+    {
+        return playing;
+    }
+
+    auto& source           = audio.sources[playing.source_index];
+    source.streaming       = true;
+    source.stream          = stream.decoder;
+    source.stream->started = true;
+    InitStream(source);
+
+    Print("Playing {} on source {} (id {}) gain = {}, pitch = {}\n",
+          stream.decoder->path.filename().string(), source.al_source,
+          playing.playing_id, s.gain, s.pitch);
+
+    return playing;
+}
+
+bool
+QueueStream(AudioPlaying playing, const PreparedStream& stream)
+{
+    if (playing.source_index < 0
+        || playing.source_index >= audio.sources.size())
+    {
+        return false;
+    }
+    auto& source = audio.sources[playing.source_index];
+    if (source.playing_id != playing.playing_id || !source.streaming)
+    {
+        return false;
+    }
+    source.next_stream = stream.decoder;
+    return true;
+}
+
 void
 StopAudio(AudioPlaying& playing)
 {
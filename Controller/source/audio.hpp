@@ -1,6 +1,8 @@
 #pragma once
 #include "alias.hpp"
 
+#include <memory>
+
 /*
    AudioBuffer represents a sound file.
 */
@@ -12,10 +14,12 @@ struct AudioBuffer
 
     // Pre loaded:
     u32 al_buffer = 0;
+    u64 size      = 0; // In bytes
 };
 
 AudioBuffer LoadAudioFile(const Path& path, bool streaming = false);
 void        DestroyAudioBuffer(AudioBuffer& buffer);
+bool        IsBufferPlaying(const AudioBuffer& buffer);
 
 /*
    AudioPlaying is a handle to a sound being played.
@@ -66,6 +70,30 @@ bool         IsPlaying(const AudioPlaying& playing);
 void         SetGain(AudioPlaying playing, f32 gain);
 void         SetPitch(AudioPlaying playing, f32 pitch);
 
+/*
+   PreparedStream is a streamed sound file that is opened and decoded ahead of
+   time in another thread. It starts without waiting for the disk and it can be
+   queued after a streamed sound that is playing so there is no gap between
+   them.
+*/
+struct StreamDecoder;
+struct PreparedStream
+{
+    PreparedStream() {}
+    std::shared_ptr<StreamDecoder> decoder;
+};
+
+PreparedStream PrepareStream(const Path& path);
+bool           IsStreamReady(const PreparedStream& stream);
+// True when the stream is ready but its file couldn't be opened
+bool           IsStreamFailed(const PreparedStream& stream);
+// True when the stream was played or when a queue switched to it
+bool           IsStreamStarted(const PreparedStream& stream);
+AudioPlaying   PlayStream(PreparedStream& stream, AudioSettings s = {});
+// The stream will be decoded right after the one played by playing, in the
+// same source. An empty stream removes the queued one.
+bool           QueueStream(AudioPlaying playing, const PreparedStream& stream);
+
 bool InitAudio(u32 source_count);
 void TerminateAudio();
 
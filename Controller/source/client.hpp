@@ -7,6 +7,14 @@ constexpr Duration client_timeout_duration = Milliseconds(1200);
 constexpr Duration heartbeat_period        = Milliseconds(700);
 constexpr Duration command_resend_period   = Milliseconds(100);
 
+enum class ClientLink : u8
+{
+    Auto,   // USB serial when the client answers on it, WiFi otherwise
+    Wifi,   // Always WiFi
+    Serial, // Always USB serial
+    Count
+};
+
 struct Client
 {
     /*
@@ -45,9 +53,47 @@ struct Client
         return (Clock::now() - time_command_sent >= command_resend_period);
     }
 
+    /*
+       A client plugged to the Controller with USB answers on the serial port
+       too. Serial has a lower and more regular latency than WiFi, so we use it
+       when it works.
+    */
+    bool
+    serialConnected()
+    {
+        return serial_connection.serial_port.size()
+               && (Clock::now() - time_last_serial_message
+                   < client_timeout_duration);
+    }
+
+    Connection&
+    link()
+    {
+        switch (link_mode)
+        {
+        case ClientLink::Wifi: return connection;
+        case ClientLink::Serial: return serial_connection;
+        default: break;
+        }
+        return serialConnected() ? serial_connection : connection;
+    }
+
+    bool
+    canSend()
+    {
+        auto& c = link();
+        return c.socket || c.serial_port.size();
+    }
+
     bool connected = false;
+    // Connected once, the discovery slows down when all of them are connected
+    bool expected  = false;
 
     Connection connection;
     Timepoint  time_last_message_received;
     Timepoint  time_command_sent;
+
+    ClientLink link_mode = ClientLink::Auto;
+    Connection serial_connection;
+    Timepoint  time_last_serial_message;
 };
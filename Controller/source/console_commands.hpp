@@ -163,12 +163,13 @@ ArgToTupleSplitter(StrPtr str)
     StrPtr                     this_arg   = std::get<0>(parsedArgs);
     StrPtr                     rest_args  = std::get<1>(parsedArgs);
 
-    auto arg = StringToArg<T>(this_arg);
-    if (arg)
+    auto arg  = StringToArg<T>(this_arg);
+    auto rest = ArgToTupleSplitter<U, Args...>(rest_args);
+    if (arg && rest)
     {
         return std::tuple_cat(
-            std::make_tuple(std::move(arg.value())),  // this argument
-            ArgToTupleSplitter<U, Args...>(rest_args) // rest of arguments
+            std::make_tuple(std::move(arg.value())), // this argument
+            std::move(rest.value())                  // rest of arguments
         );
     }
     return {};
@@ -168,7 +168,7 @@ DoorLock::update(Client& client)
         need_update = true;
     }
 
-    if (client.connection.socket)
+    if (client.canSend())
     {
         if (need_update || client.heartbeatTimeout())
         {
@@ -183,7 +183,7 @@ DoorLock::update(Client& client)
                 command.getHeader().serialize(serializer);
                 command.serialize(serializer);
 
-                SendPacket(client.connection, serializer);
+                SendPacket(client.link(), serializer);
             }
         }
     }
@@ -0,0 +1,115 @@
+#include "latency.hpp"
+#include "print.hpp"
+
+#include <algorithm>
+
+LatencyStats latency_stats;
+
+const char* latency_stage_names[] = {
+    "Hit",
+    "Received",
+    "Dispatched",
+    "Played",
+};
+static_assert(StaticArraySize(latency_stage_names)
+              == (u32)LatencyStage::Count);
+
+void
+BeginLatencyTrace(Timepoint hit)
+{
+    latency_stats.current = {};
+    latency_stats.tracing = true;
+
+    latency_stats.current.stages[(u32)LatencyStage::Hit] = hit;
+    MarkLatency(LatencyStage::Received);
+}
+
+void
+MarkLatency(LatencyStage stage)
+{
+    if (!latency_stats.tracing)
+        return;
+
+    latency_stats.current.stages[(u32)stage] = Clock::now();
+
+    if (stage == LatencyStage::Played)
+    {
+        // Only the first sound played after a message is part of the trace
+        latency_stats.tracing = false;
+        if (latency_stats.traces.size() < latency_stats.max_trace_count)
+        {
+            latency_stats.traces.push_back(latency_stats.current);
+        }
+        else
+        {
+            latency_stats.traces[latency_stats.next_trace] =
+                latency_stats.current;
+        }
+        latency_stats.next_trace =
+            (latency_stats.next_trace + 1) % latency_stats.max_trace_count;
+    }
+}
+
+void
+ResetLatencyStats()
+{
+    latency_stats = {};
+}
+
+Duration
+LatencyPercentile(LatencyStage from, LatencyStage to, f32 percentile)
+{
+    std::vector<Duration> durations;
+    durations.reserve(latency_stats.traces.size());
+    for (auto& trace : latency_stats.traces)
+    {
+        auto start = trace.stages[(u32)from];
+        auto end   = trace.stages[(u32)to];
+        if (start != Timepoint{} && end != Timepoint{})
+        {
+            durations.push_back(
+                std::chrono::duration_cast<Duration>(end - start));
+        }
+    }
+    if (durations.empty())
+        return Duration(-1);
+
+    u64 index = (u64)(percentile * (durations.size() - 1) + 0.5f);
+    std::nth_element(durations.begin(), durations.begin() + index,
+                     durations.end());
+    return durations[index];
+}
+
+void
+PrintLatencyRow(LatencyStage from, LatencyStage to)
+{
+    auto p50 = LatencyPercentile(from, to, 0.5f);
+    auto p99 = LatencyPercentile(from, to, 0.99f);
+    if (p50 < Duration(0))
+    {
+        Print("   {} -> {}: no data\n", latency_stage_names[(u32)from],
+              latency_stage_names[(u32)to]);
+        return;
+    }
+    Print("   {} -> {}: p50 {:.2f} ms, p99 {:.2f} ms\n",
+          latency_stage_names[(u32)from], latency_stage_names[(u32)to],
+          p50.count() / 1000.f, p99.count() / 1000.f);
+}
+
+void
+PrintLatencyReport()
+{
+    u32 with_hit_time = 0;
+    for (auto& trace : latency_stats.traces)
+    {
+        if (trace.stages[(u32)LatencyStage::Hit] != Timepoint{})
+            with_hit_time++;
+    }
+    PrintSuccess("Hit to sound latency, {} hits ({} with the hit time):\n",
+                 latency_stats.traces.size(), with_hit_time);
+    PrintLatencyRow(LatencyStage::Hit, LatencyStage::Received);
+    PrintLatencyRow(LatencyStage::Received, LatencyStage::Dispatched);
+    PrintLatencyRow(LatencyStage::Dispatched, LatencyStage::Played);
+    PrintLatencyRow(LatencyStage::Received, LatencyStage::Played);
+    PrintLatencyRow(LatencyStage::Hit, LatencyStage::Played);
+}
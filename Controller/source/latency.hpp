@@ -0,0 +1,45 @@
+#pragma once
+#include "alias.hpp"
+#include "time.hpp"
+
+/*
+   A LatencyTrace times each stage between a hit on a target and its sound
+   being played. A target that has synced its clock sends the time of the hit,
+   otherwise the trace starts when the message is received. The latency_test
+   target runs simulated hits through the whole path and checks the p99.
+*/
+enum class LatencyStage : u32
+{
+    Hit,        // Hit detected by the target, when its clock is synced
+    Received,   // ReceiveMessage returned the message
+    Dispatched, // Targets::receiveMessage was called
+    Played,     // PlayAudio returned, alSourcePlay was called
+    Count
+};
+
+struct LatencyTrace
+{
+    LatencyTrace() {}
+    Timepoint stages[(u32)LatencyStage::Count] = {};
+};
+
+struct LatencyStats
+{
+    LatencyStats() {}
+    LatencyTrace current;
+    bool         tracing = false;
+
+    sconst u32                max_trace_count = 1024;
+    std::vector<LatencyTrace> traces;
+    u32                       next_trace = 0;
+};
+
+extern LatencyStats latency_stats;
+
+// hit is the time sent by the target, or a default Timepoint
+void BeginLatencyTrace(Timepoint hit);
+void MarkLatency(LatencyStage stage);
+void ResetLatencyStats();
+
+Duration LatencyPercentile(LatencyStage from, LatencyStage to, f32 percentile);
+void     PrintLatencyReport();
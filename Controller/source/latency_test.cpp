@@ -0,0 +1,334 @@
+/*
+   Hit to sound latency benchmark, the hit_to_sound_latency test of ctest.
+
+   A synthetic piezo signal goes through the hit detection of the targets
+   firmware (Targets/src/targets_logic.cpp) in real time. The hits go round
+   the 16 targets of a board, so that they can be closer than the cooldown of
+   a target and the test only takes a few seconds. The TargetsStatus of
+   each hit is sent in a UDP packet to a server socket on the loopback and
+   received with ReceiveMessage. Like in the main loop, the server is polled
+   once per frame and the status is dispatched to Targets::receiveStatus,
+   which plays the sound.
+
+   It fails when a hit is missed, or when the p99 from the hit to
+   alSourcePlay is over the limit. Without an audio device it is skipped.
+
+   latency_test [hit_count] [hit_period_ms] [frame_ms] [max_p99_ms]
+
+   It only links hit_to_sound, the functions of the rest of the game it
+   needs are defined below.
+*/
+#include "alias.hpp"
+#include "latency.hpp"
+#include "print.hpp"
+#include "server.hpp"
+#include "sound_bank.hpp"
+#include "targets.hpp"
+#include "targets_logic.hpp"
+
+#include <fstream>
+#include <random>
+#include <thread>
+
+// Defined by main.cpp, console.cpp and serial_port.cpp in the game
+ClientId           this_client_id = ClientId::Server;
+std::random_device global_random_device;
+std::mt19937       global_mt19937(global_random_device());
+Console            console;
+
+bool
+SendSerialPacket(StrPtr /*port_name*/, Serializer& /*s*/)
+{
+    return false;
+}
+
+// SKIP_RETURN_CODE of the test in CMakeLists.txt
+constexpr s32 skip_exit_code = 77;
+
+constexpr u32 max_hit_count = 1000;
+// An ADS1115 at 860 samples per second
+constexpr u64 sample_period = 1'000'000 / 860;
+constexpr u8  target_count  = max_target_count;
+// Longer than the cooldown between two hits of a target (targets_logic.cpp)
+constexpr u64 target_hit_period = 1'100'000;
+constexpr u64 hit_offset        = 500'000;
+constexpr u64 no_hit            = UINT64_MAX;
+
+const Path sound_directory = "latency_test_sounds";
+
+// The functions targets_logic.cpp needs from the firmware
+void
+TargetDead(u8 /*target*/, const char* /*cause*/)
+{}
+
+void
+SendTargetsGraphMessage()
+{}
+
+bool
+IsClockSynced()
+{
+    return true;
+}
+
+u64
+ToServerMicros(u64 local_time)
+{
+    // The simulated target uses ServerMicros() as its clock
+    return local_time;
+}
+
+// Noise, and a damped oscillation when the target is hit
+s16
+PiezoSignal(u64 time, u64 hit_start, std::mt19937& rng)
+{
+    std::uniform_int_distribution<s32> noise(-40, 40);
+    s32                                value = noise(rng);
+    if (hit_start != no_hit && time >= hit_start)
+    {
+        f32 t     = (time - hit_start) / 1'000'000.f;
+        f32 decay = expf(-t / 0.01f);
+        value += (s32)(12000.f * decay * sinf(2 * 3.14159f * 180 * t));
+    }
+    return (s16)value;
+}
+
+// A 100 ms tone, played as the hurt and death sounds of the orcs
+bool
+WriteTestSound(const Path& path)
+{
+    constexpr u32 rate  = 44100;
+    constexpr u32 count = rate / 10;
+
+    std::vector<u8> file;
+    auto            put32 = [&](u32 v) {
+        for (u32 i = 0; i < 4; i++)
+            file.push_back((u8)(v >> (8 * i)));
+    };
+    auto put16 = [&](u16 v) {
+        file.push_back((u8)v);
+        file.push_back((u8)(v >> 8));
+    };
+    file.insert(file.end(), {'R', 'I', 'F', 'F'});
+    put32(36 + count * 2);
+    file.insert(file.end(), {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '});
+    put32(16);
+    put16(1); // PCM
+    put16(1); // Mono
+    put32(rate);
+    put32(rate * 2);
+    put16(2);
+    put16(16);
+    file.insert(file.end(), {'d', 'a', 't', 'a'});
+    put32(count * 2);
+    for (u32 i = 0; i < count; i++)
+    {
+        put16((u16)(s16)(1000.f * sinf(2 * 3.14159f * 440 * i / rate)));
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    out.write((const char*)file.data(), file.size());
+    return out.good();
+}
+
+bool
+WriteTestManifest(const Path& path)
+{
+    std::ofstream out(path);
+    for (auto name : {"orc", "orc_hurt", "orc_death", "orc_mad"})
+    {
+        out << name << " " << sound_directory.generic_string()
+            << " preload 0\n";
+    }
+    return out.good();
+}
+
+int
+main(int argc, char* argv[])
+{
+    u32 hit_count     = (argc > 1) ? (u32)atoi(argv[1]) : 20;
+    s64 hit_period_ms = (argc > 2) ? atoi(argv[2]) : 100;
+    s64 frame_ms      = (argc > 3) ? atoi(argv[3]) : 16;
+    s64 max_p99_ms    = (argc > 4) ? atoi(argv[4]) : 50;
+    hit_count         = std::clamp(hit_count, 1u, max_hit_count);
+
+    // A target is hit again after target_count hits
+    u64 min_hit_period = target_hit_period / target_count + 1;
+    u64 hit_period = std::max((u64)std::max(hit_period_ms, (s64)0) * 1000,
+                              min_hit_period);
+
+    if (!InitAudio(32))
+    {
+        PrintWarning("No audio device, the test is skipped\n");
+        return skip_exit_code;
+    }
+
+    std::error_code error_code;
+    std::filesystem::create_directories(sound_directory, error_code);
+    if (!WriteTestSound(sound_directory / "tone.wav")
+        || !WriteTestManifest(sound_directory / "sound_banks.txt"))
+    {
+        PrintError("Can't write the test sound\n");
+        return 1;
+    }
+    LoadSoundBankManifest(sound_directory / "sound_banks.txt");
+    if (!GetBankSound(GetSoundBank("orc_hurt"), 0))
+    {
+        PrintError("Can't load the test sound\n");
+        return 1;
+    }
+
+    Targets targets;
+    // Quiet, but the sounds are played
+    targets.gain_global = 1;
+
+    Server           server;
+    asio::error_code error;
+    auto             socket = std::make_shared<Socket>(server.io_context);
+    socket->open(asio::ip::udp::v4(), error);
+    if (!error)
+        socket->bind(Endpoint(asio::ip::address_v4::loopback(), 0), error);
+    Socket device(server.io_context);
+    if (!error)
+        device.open(asio::ip::udp::v4(), error);
+    if (error)
+    {
+        PrintError("Can't open the sockets: {}\n", error.message());
+        return 1;
+    }
+    server.sockets.push_back(socket);
+    Endpoint server_endpoint = socket->local_endpoint();
+
+    // The device side, like the loop of the Targets firmware
+    SetTargetCount(target_count, udp_packet_size);
+    status.enabled = all_targets;
+    for (u8 i = 0; i < target_count; i++)
+    {
+        status.hitpoints[i] = (s8)(hit_count / target_count + 2);
+    }
+    auto send_status = [&]() {
+        status.ask_for_ack = true;
+
+        u8   buffer[udp_packet_size];
+        auto ser = Serializer(SerializerMode::Serialize,
+                              {buffer, (u32)sizeof(buffer)});
+        auto header      = status.getHeader();
+        header.client_id = ClientId::Targets;
+        header.serialize(ser);
+        status.serialize(ser);
+        device.send_to(asio::buffer(buffer, ser.buffer.start - buffer),
+                       server_endpoint, 0, error);
+    };
+
+    // The Controller side, like the message loop of main.cpp
+    Client client;
+    auto   poll_server = [&]() {
+        while (true)
+        {
+            auto message = ReceiveMessage(server);
+            if (message.header.client_id == ClientId::Invalid)
+                break;
+
+            client.connected                  = true;
+            client.time_last_message_received = Clock::now();
+            client.connection                 = message.from;
+            if (message.header.type == MessageType::TargetsStatus)
+                targets.receiveStatus(client, message, false);
+        }
+    };
+
+    u64  frame_period = frame_ms * 1000;
+    u64  next_frame   = ServerMicros();
+    auto wait_until   = [&](u64 time) {
+        while (true)
+        {
+            u64 now = ServerMicros();
+            if (now >= next_frame)
+            {
+                poll_server();
+                next_frame += frame_period;
+                continue;
+            }
+            if (now >= time)
+                return;
+            std::this_thread::yield();
+        }
+    };
+
+    // The Controller learns the hitpoints
+    send_status();
+    wait_until(ServerMicros() + 200'000);
+    if (targets.last_status.count != target_count)
+    {
+        PrintError("The server didn't receive the status\n");
+        return 1;
+    }
+    ResetLatencyStats();
+
+    Print("{} hits, one every {} ms, a frame every {} ms\n", hit_count,
+          hit_period / 1000, frame_ms);
+    std::mt19937 rng(1234);
+    u32          hits_sent  = 0;
+    u64          start      = ServerMicros() + hit_offset;
+    u64          end        = start + hit_count * hit_period;
+    Duration     max_detect = {};
+    // The hit k starts at start + k * hit_period on the target k % count
+    u32 next_hit = 0;
+    u64 hit_starts[target_count];
+    std::fill(std::begin(hit_starts), std::end(hit_starts), no_hit);
+    for (u64 time = start - hit_offset; time < end; time += sample_period)
+    {
+        wait_until(time);
+
+        while (next_hit < hit_count && start + next_hit * hit_period <= time)
+        {
+            hit_starts[next_hit % target_count] =
+                start + next_hit * hit_period;
+            next_hit++;
+        }
+        for (u8 target = 0; target < target_count; target++)
+        {
+            u64 hit_start = hit_starts[target];
+            NewSample(target, PiezoSignal(time, hit_start, rng), time);
+            if (need_resend_status)
+            {
+                need_resend_status = false;
+                send_status();
+                hits_sent++;
+                if (hit_start != no_hit)
+                {
+                    max_detect = std::max(max_detect,
+                                          Microseconds(time - hit_start));
+                }
+            }
+        }
+    }
+    // The sound of the last hit
+    wait_until(ServerMicros() + 200'000);
+
+    PrintLatencyReport();
+    Print("Slowest detection: {:.2f} ms after the start of the hit\n",
+          max_detect.count() / 1000.f);
+
+    bool passed = true;
+    if (hits_sent != hit_count || latency_stats.traces.size() != hit_count)
+    {
+        PrintError("{} hits, {} detected, {} sounds played\n", hit_count,
+                   hits_sent, latency_stats.traces.size());
+        passed = false;
+    }
+    auto p99 =
+        LatencyPercentile(LatencyStage::Hit, LatencyStage::Played, 0.99f);
+    if (p99 < Duration(0) || p99 > Milliseconds(max_p99_ms))
+    {
+        PrintError("p99 hit to sound {:.2f} ms, the limit is {} ms\n",
+                   p99.count() / 1000.f, max_p99_ms);
+        passed = false;
+    }
+
+    TerminateSoundBanks();
+    TerminateAudio();
+    if (passed)
+        PrintSuccess("Passed\n");
+    return passed ? 0 : 1;
+}
@@ -2,6 +2,8 @@
 #include "print.hpp"
 #include "scope_exit.hpp"
 #include "audio.hpp"
+#include "sound_bank.hpp"
+#include "music.hpp"
 #include "console_commands.hpp"
 #include "console.hpp"
 #include "serial_port.hpp"
@@ -9,6 +11,8 @@
 #include "settings.hpp"
 #include "time.hpp"
 #include "random.hpp"
+#include "latency.hpp"
+#include "telemetry.hpp"
 
 #include "door_lock.hpp"
 #include "targets.hpp"
@@ -17,6 +21,7 @@
 
 // #include "msg/message_timer.hpp"
 #include "msg/wifi_config.hpp"
+#include "msg/clock_sync.hpp"
 
 // #define WIN32_LEAN_AND_MEAN
 // #define NOMINMAX
@@ -47,6 +52,9 @@ static_assert(sizeof(client_names) / sizeof(client_names[0])
                   == (u64)ClientId::IdMax,
               "Client name mismatch");
 
+const char* client_link_names[] = {"auto", "wifi", "serial"};
+static_assert(StaticArraySize(client_link_names) == (u64)ClientLink::Count);
+
 std::random_device global_random_device;
 std::mt19937       global_mt19937(global_random_device());
 
@@ -265,26 +273,6 @@ SelectableButton(const char* name, bool selected)
     return pressed;
 }
 
-struct Crossfade
-{
-    Crossfade() {}
-    AudioPlaying fade_out;
-    AudioPlaying fade_in;
-
-    Timepoint start;
-    Duration  duration = Seconds(0);
-};
-
-inline f32
-Clamp(f32 x, f32 min, f32 max)
-{
-    if (x > max)
-        return max;
-    if (x < min)
-        return min;
-    return x;
-}
-
 int
 main(int argc, char* argv[])
 {
@@ -332,12 +320,34 @@ main(int argc, char* argv[])
     InitServer(server);
     SCOPE_EXIT({ TerminateServer(server); });
 
-    auto multicast_period = Milliseconds(1000);
-
     InitAudio(32);
     SCOPE_EXIT({ TerminateAudio(); });
 
+    LoadSoundBankManifest("data/sound_banks.txt");
+    SCOPE_EXIT({ TerminateSoundBanks(); });
+
     std::vector<Client> clients((u64)ClientId::IdMax);
+    for (u64 i = 0; i < clients.size(); i++)
+    {
+        u32 link_mode = 0;
+        if (LoadSettingValue(fmt::format("client.{}.link", i), link_mode)
+            && link_mode < (u32)ClientLink::Count)
+        {
+            clients[i].link_mode = (ClientLink)link_mode;
+        }
+        u32 expected = 0;
+        LoadSettingValue(fmt::format("client.{}.expected", i), expected);
+        clients[i].expected = (expected != 0);
+    }
+    SCOPE_EXIT({
+        for (u64 i = 0; i < clients.size(); i++)
+        {
+            SaveSettingValue(fmt::format("client.{}.link", i),
+                             (u32)clients[i].link_mode);
+            SaveSettingValue(fmt::format("client.{}.expected", i),
+                             (u32)clients[i].expected);
+        }
+    });
     DoorLock            door_lock;
     Targets             targets;
     // Timer               timer;
@@ -345,25 +355,29 @@ main(int argc, char* argv[])
 
     Timer timer;
 
-    std::vector<u16> target_graphs[target_count];
-
-    std::vector<AudioBuffer> musics;
-    AudioPlaying             music_playing;
-    Crossfade                crossfade;
-    s32                      gain_music = 50;
-    LoadSettingValue("music.gain_music", gain_music);
-    SCOPE_EXIT({ SaveSettingValue("music.gain_music", gain_music); });
-
-    for (auto const& dir_entry :
-         std::filesystem::directory_iterator{"data/musics/"})
+    // The samples of all the targets on the same time axis, in seconds from
+    // the first sample received
+    struct TargetGraph
     {
-        if (dir_entry.is_regular_file()
-            && dir_entry.path().extension() != ".txt")
+        std::vector<f64> times;
+        std::vector<f64> values;
+    };
+    TargetGraph target_graphs[max_target_count];
+    u64         target_graph_origin      = 0;
+    u8          target_graph_server_time = 0;
+
+    auto clear_target_graphs = [&]() {
+        for (auto& graph : target_graphs)
         {
-            Print("Loading {}\n", dir_entry.path().string());
-            musics.push_back(LoadAudioFile(dir_entry.path(), true));
+            graph.times.clear();
+            graph.times.shrink_to_fit();
+            graph.values.clear();
+            graph.values.shrink_to_fit();
         }
-    }
+        target_graph_origin = 0;
+    };
+
+    Playlist playlist;
 
     RegisterConsoleCommand(
         "help", {}, std::function([&]() {
@@ -410,6 +424,7 @@ main(int argc, char* argv[])
                                        client.connected = false;
                                    }
                                }
+                               StartDiscoveryBurst(server);
                            }));
     RegisterConsoleCommand(
         "resetall", {}, std::function([&]() {
@@ -418,7 +433,7 @@ main(int argc, char* argv[])
                 auto& client      = clients[i];
                 auto  client_name = client_names[i];
 
-                if (client.connection.socket)
+                if (client.canSend())
                 {
                     client.time_command_sent = Clock::now();
 
@@ -430,7 +445,7 @@ main(int argc, char* argv[])
                     msg.getHeader().serialize(serializer);
                     msg.serialize(serializer);
 
-                    SendPacket(client.connection, serializer);
+                    SendPacket(client.link(), serializer);
                 }
 
                 if (client.connected)
@@ -439,13 +454,57 @@ main(int argc, char* argv[])
                     client.connected = false;
                 }
             }
+            StartDiscoveryBurst(server);
+        }));
+
+    RegisterConsoleCommand(
+        "link", {"client name", "auto|wifi|serial"},
+        std::function([&](StrPtr name, StrPtr mode) {
+            u64 client_index = 0;
+            while (client_index < clients.size()
+                   && name != client_names[client_index])
+            {
+                client_index++;
+            }
+            u32 link_mode = 0;
+            while (link_mode < (u32)ClientLink::Count
+                   && mode != client_link_names[link_mode])
+            {
+                link_mode++;
+            }
+            if (client_index == clients.size()
+                || link_mode == (u32)ClientLink::Count)
+            {
+                PrintError("Unknown client or link: \"{}\" {}\n", name, mode);
+                return;
+            }
+            clients[client_index].link_mode = (ClientLink)link_mode;
+            PrintSuccess("[{}] link = {}\n", name, mode);
+        }));
+    RegisterConsoleCommand(
+        "expect", {"client name", "bool expected"},
+        std::function([&](StrPtr name, u8 expected) {
+            u64 client_index = 0;
+            while (client_index < clients.size()
+                   && name != client_names[client_index])
+            {
+                client_index++;
+            }
+            if (client_index == clients.size())
+            {
+                PrintError("Unknown client: \"{}\"\n", name);
+                return;
+            }
+            clients[client_index].expected = (expected != 0);
+            PrintSuccess("[{}] expected = {}\n", name,
+                         expected ? "true" : "false");
         }));
 
     RegisterConsoleCommand("listserialports", {},
                            std::function([&]() { ListSerialPorts(); }));
 
-    bool               listen_to_serial_ports = false;
-    constexpr Duration serial_scan_period     = Seconds(1);
+    bool listen_to_serial_ports = false;
+    SCOPE_EXIT({ TerminateSerial(); });
     RegisterConsoleCommand(
         "serial", {"bool listen"}, std::function([&](u8 listen) {
             listen_to_serial_ports = listen;
@@ -471,36 +530,37 @@ main(int argc, char* argv[])
                                else
                                {
                                    PrintSuccess("No target sensor data\n");
-                                   for (auto& graph : target_graphs)
-                                   {
-                                       graph.clear();
-                                       graph.shrink_to_fit();
-                                   }
+                                   clear_target_graphs();
                                }
                                targets.command.send_sensor_data = show;
                            }));
 
+    RegisterConsoleCommand("latency", {},
+                           std::function([&]() { PrintLatencyReport(); }));
+    RegisterConsoleCommand("resetlatency", {},
+                           std::function([&]() { ResetLatencyStats(); }));
+
+    bool all_clients_connected = false;
+    StartDiscoveryBurst(server);
+
     auto time_start = Clock::now();
     glfwShowWindow(window);
     while (!glfwWindowShouldClose(window))
     {
-        static Timepoint time_next_multicast = Clock::now();
-        if (Clock::now() >= time_next_multicast)
+        if (IsDiscoveryDue(server, all_clients_connected))
         {
-            time_next_multicast += multicast_period;
-
             std::vector<u8> buffer(udp_packet_size);
             Serializer      serializer(
                 SerializerMode::Serialize,
                 {buffer.data(), buffer.data() + buffer.size()});
-
-            Multicast message;
-            StrPtr    str = "Hey it's me, the server.";
-            message.str   = {(u8*)str.data(), (u32)str.size()};
-            message.getHeader().serialize(serializer);
-            message.serialize(serializer);
+            SerializeDiscovery(serializer);
 
             SendPacketMulticast(server, serializer);
+            if (listen_to_serial_ports)
+            {
+                // Clients plugged with USB answer to it on their serial port
+                SendSerialPacketToAll(serializer);
+            }
         }
 
         glClearColor(0.2f, 0.2f, 0.2f, 1.f);
@@ -509,41 +569,17 @@ main(int argc, char* argv[])
         glfwPollEvents();
         ImguiStartFrame();
 
+        UpdateSoundBanks();
+
         DrawConsole();
         DrawTimer(timer);
 
-        if (crossfade.duration != Seconds(0))
-        {
-            using MillisecondsFloat = std::chrono::duration<f32, std::milli>;
-            f32 elapsed = std::chrono::duration_cast<MillisecondsFloat>(
-                              Clock::now() - crossfade.start)
-                              .count();
-            f32 duration = std::chrono::duration_cast<MillisecondsFloat>(
-                               crossfade.duration)
-                               .count();
-            f32 t = Clamp(elapsed / duration, 0.f, 1.f);
-            SetGain(crossfade.fade_in, t * gain_music / 100.f);
-            SetGain(crossfade.fade_out, (1.f - t) * gain_music / 100.f);
-            if (t == 1.f)
-            {
-                crossfade.duration = Seconds(0);
-                StopAudio(crossfade.fade_out);
-                Print("Crossfade ended\n");
-            }
-        }
-
+        UpdatePlaylist(playlist, timer.time);
         UpdateAudio();
 
         if (listen_to_serial_ports)
         {
-            static Timepoint next_serial_scan = Clock::now();
-            bool             do_scan          = false;
-            if (Clock::now() >= next_serial_scan)
-            {
-                next_serial_scan = Clock::now() + serial_scan_period;
-                do_scan          = true;
-            }
-            UpdateSerial(do_scan);
+            UpdateSerial();
         }
 
         static bool show_demo = false;
@@ -553,69 +589,24 @@ main(int argc, char* argv[])
         if (ImGui::IsKeyPressed(ImGuiKey_F1))
             show_demo = true;
 
-        if (ImGui::Begin("Audio"))
-        {
-            if (ImGui::SliderInt(utf8("Volume musique"), &gain_music, 0, 100))
-            {
-                if (crossfade.duration == Seconds(0))
-                {
-                    // Only set the music gain when we are not crossfading
-                    SetGain(music_playing, gain_music / 100.f);
-                }
-            }
-
-            for (auto& music : musics)
-            {
-                if (ImGui::Button(
-                        (const char*)music.path.filename().u8string().c_str()))
-                {
-                    f32 gain = gain_music / 100.f;
-                    if (IsPlaying(music_playing))
-                    {
-                        if (crossfade.duration != Seconds(0))
-                        {
-                            // We were already crossfading
-                            StopAudio(crossfade.fade_out);
-                            Print("Crossfade stopped\n");
-                        }
-                        crossfade.start    = Clock::now();
-                        crossfade.duration = Seconds(1);
-                        crossfade.fade_out = music_playing;
-                        gain               = 0.f;
-                        Print("Crossfade start\n");
-                    }
-                    else
-                    {
-                        crossfade.duration = Seconds(0);
-                    }
-                    music_playing     = PlayAudio(music, Gain(gain));
-                    crossfade.fade_in = music_playing;
-                }
-            }
-            if (IsPlaying(music_playing))
-            {
-                if (ImGui::Button(utf8("Arrêter la musique")))
-                {
-                    StopAudio(music_playing);
-                    StopAudio(crossfade.fade_out);
-                }
-            }
-        }
-        ImGui::End();
+        DrawPlaylist(playlist);
+        DrawTelemetry(client_names);
 
         if (targets.command.send_sensor_data)
         {
             if (ImGui::Begin("Targets graph"))
             {
                 ImPlot::BeginPlot("Targets plot", {-1, -1});
-                for (u32 i = 0; i < target_count; i++)
+                for (u32 i = 0; i < max_target_count; i++)
                 {
-                    if (target_graphs[i].size())
+                    auto& graph = target_graphs[i];
+                    if (graph.times.size())
                     {
                         auto name = fmt::format("Target {}", i + 1);
 
-                        ImPlot::PlotLine(name.c_str(), target_graphs[i].data(),
-                                         target_graphs[i].size());
+                        ImPlot::PlotLine(name.c_str(), graph.times.data(),
+                                         graph.values.data(),
+                                         (int)graph.times.size());
 
                         // ImPlot::TagY(targets.command.thresholds[i],
                         //              ImPlot::GetLastItemColor(), "%d", i
@@ -637,6 +628,10 @@ main(int argc, char* argv[])
         while (true)
         {
             auto message = ReceiveMessage(server);
+            if (message.header.client_id == ClientId::Invalid)
+            {
+                message = ReceiveSerialMessage();
+            }
 
             if (message.header.client_id != ClientId::Invalid)
             {
@@ -648,11 +643,18 @@ main(int argc, char* argv[])
                     PrintSuccess("{} [{}] (new):\n",
                                  DurationToString(Clock::now() - time_start),
                                  client_name);
-                    Print("{} port {}\n",
-                          message.from.endpoint.address().to_string(),
-                          message.from.endpoint.port());
+                    if (message.from.serial_port.size())
+                    {
+                        Print("Serial port {}\n", message.from.serial_port);
+                    }
+                    else
+                    {
+                        Print("{} port {}\n",
+                              message.from.endpoint.address().to_string(),
+                              message.from.endpoint.port());
+                    }
 
-                    if (server.sockets.size() > 1)
+                    if (server.sockets.size() > 1 && message.from.socket)
                     {
                         // We found the right socket, we keep it and close
                         // the other ones.
@@ -661,12 +663,14 @@ main(int argc, char* argv[])
                     }
                 }
                 else if (show_messages_received
-                         || message.header.type == MessageType::Log)
+                         || message.header.type == MessageType::Log
+                         || message.header.type == MessageType::Hello)
                 {
                     Print("{} [{}]:\n",
                           DurationToString(Clock::now() - time_start),
                           client_name);
-                    if (client.connection.endpoint != message.from.endpoint)
+                    if (message.from.socket
+                        && client.connection.endpoint != message.from.endpoint)
                     {
                         PrintWarning(
                             "Client endpoint changed from {} port{},"
@@ -679,8 +683,17 @@ main(int argc, char* argv[])
                 }
 
                 client.connected                  = true;
-                client.connection                 = message.from;
+                client.expected                   = true;
                 client.time_last_message_received = Clock::now();
+                if (message.from.serial_port.size())
+                {
+                    client.serial_connection        = message.from;
+                    client.time_last_serial_message = Clock::now();
+                }
+                else
+                {
+                    client.connection = message.from;
+                }
 
                 switch (message.header.type)
                 {
@@ -696,6 +709,23 @@ main(int argc, char* argv[])
                     msg.serialize(message.deserializer);
                 }
                 break;
+                case MessageType::Hello: {
+                    Hello msg;
+                    msg.serialize(message.deserializer);
+                    Print("Hello\n");
+                    if (message.from.socket)
+                    {
+                        // A device said hello to the last server it knew, it
+                        // waits for an answer before the next discovery.
+                        std::vector<u8> buffer(udp_packet_size);
+                        Serializer      serializer(
+                            SerializerMode::Serialize,
+                            {buffer.data(), (u32)buffer.size()});
+                        SerializeDiscovery(serializer);
+                        SendPacket(message.from, serializer);
+                    }
+                }
+                break;
                 case MessageType::Log: {
                     LogMessage msg;
                     msg.serialize(message.deserializer);
@@ -711,6 +741,29 @@ main(int argc, char* argv[])
                 }
                 break;
 
+                case MessageType::ClockSync: {
+                    // Answered right away, the time this message waits is
+                    // counted in the round trip measured by the device.
+                    ClockSync msg;
+                    msg.serialize(message.deserializer);
+                    msg.server_time = ServerMicros();
+
+                    u8         buffer[32];
+                    Serializer serializer(SerializerMode::Serialize,
+                                          {buffer, (u32)sizeof(buffer)});
+                    msg.getHeader().serialize(serializer);
+                    msg.serialize(serializer);
+                    SendPacket(message.from, serializer);
+                }
+                break;
+                case MessageType::Telemetry: {
+                    Telemetry msg;
+                    msg.serialize(message.deserializer);
+                    ReceiveTelemetry(message.header.client_id, client_name,
+                                     msg);
+                }
+                break;
+
                 case MessageType::DoorLockCommand: {
                     PrintWarning("Server received a LockDoorCommand message\n");
                     DoorLockCommand msg;
@@ -733,19 +786,36 @@ main(int argc, char* argv[])
                 }
                 break;
                 case MessageType::TargetsStatus: {
-                    TargetsStatus msg;
-                    msg.serialize(message.deserializer);
-                    targets.receiveMessage(client, msg, show_messages_received);
+                    targets.receiveStatus(client, message,
+                                          show_messages_received);
                 }
                 break;
                 case MessageType::TargetsGraph: {
                     TargetsGraph msg;
                     msg.serialize(message.deserializer);
-                    for (u32 i = 0; i < target_count; i++)
+                    if (msg.server_time != target_graph_server_time)
                     {
-                        target_graphs[i].insert_range(
-                            target_graphs[i].end(),
-                            std::span(msg.buffer[i], msg.buffer_count[i]));
+                        // The device synced its clock, the times changed
+                        clear_target_graphs();
+                        target_graph_server_time = msg.server_time;
+                    }
+                    for (u32 i = 0; i < msg.count; i++)
+                    {
+                        u16 count = msg.buffer_count[i];
+                        if (!count)
+                            continue;
+                        if (!target_graph_origin)
+                            target_graph_origin = msg.start_time[i];
+
+                        auto& graph = target_graphs[i];
+                        s64   start =
+                            (s64)(msg.start_time[i] - target_graph_origin);
+                        for (u16 j = 0; j < count; j++)
+                        {
+                            s64 t = start + (s64)j * msg.sample_period[i];
+                            graph.times.push_back((f64)t / 1000000.0);
+                            graph.values.push_back(msg.buffer[i][j]);
+                        }
                     }
                 }
                 break;
@@ -813,10 +883,27 @@ main(int argc, char* argv[])
             {
                 PrintWarning("[{}] timed out\n", client_name);
                 client.connected = false;
+                StartDiscoveryBurst(server);
                 continue;
             }
             clients_connected_count++;
         }
+
+        // No client is expected the first time, the discovery doesn't slow
+        // down until one has connected.
+        u32 expected_count     = 0;
+        u32 expected_connected = 0;
+        for (auto& client : clients)
+        {
+            if (client.expected)
+            {
+                expected_count++;
+                if (client.connected)
+                    expected_connected++;
+            }
+        }
+        all_clients_connected =
+            expected_count && expected_connected == expected_count;
         if (clients_connected_count == 0)
         {
             ImGui::Begin(utf8("Initialisation"));
@@ -0,0 +1,396 @@
+#include "music.hpp"
+#include "print.hpp"
+#include "random.hpp"
+#include "settings.hpp"
+
+#include <imgui.h>
+
+bool SelectableButton(const char* name, bool selected);
+
+const char* playlist_mode_names[] = {
+    utf8("Un morceau"),         utf8("À la suite"), utf8("En boucle"),
+    utf8("Répéter le morceau"), utf8("Aléatoire"),
+};
+static_assert(StaticArraySize(playlist_mode_names)
+              == (u32)PlaylistMode::Count);
+
+inline f32
+Clamp(f32 x, f32 min, f32 max)
+{
+    if (x > max)
+        return max;
+    if (x < min)
+        return min;
+    return x;
+}
+
+Str
+TrackName(Playlist& playlist, s32 track)
+{
+    if (track < 0 || track >= (s32)playlist.musics->entries.size())
+        return {};
+    auto& path = playlist.musics->entries[track].buffer.path;
+    return (const char*)path.filename().u8string().c_str();
+}
+
+Playlist::Playlist()
+{
+    musics = &GetSoundBank("musics");
+
+    u32 mode_u32 = 0;
+    if (LoadSettingValue("music.mode", mode_u32)
+        && mode_u32 < (u32)PlaylistMode::Count)
+    {
+        mode = (PlaylistMode)mode_u32;
+    }
+    LoadSettingValue("music.gain_music", gain);
+
+    u32 cue_count = 0;
+    LoadSettingValue("music.cue_count", cue_count);
+    for (u32 i = 0; i < cue_count; i++)
+    {
+        MusicCue cue;
+        u32      seconds = 0;
+        if (LoadSettingValue(fmt::format("music.cue_{}_time", i), seconds)
+            && LoadSettingValue(fmt::format("music.cue_{}_track", i),
+                                cue.track))
+        {
+            cue.time = Seconds(seconds);
+            cues.push_back(cue);
+        }
+    }
+}
+
+Playlist::~Playlist()
+{
+    SaveSettingValue("music.mode", (u32)mode);
+    SaveSettingValue("music.gain_music", gain);
+    SaveSettingValue("music.cue_count", (u32)cues.size());
+    for (u32 i = 0; i < cues.size(); i++)
+    {
+        auto seconds = std::chrono::duration_cast<std::chrono::seconds>(
+            cues[i].time);
+        SaveSettingValue(fmt::format("music.cue_{}_time", i),
+                         (u32)seconds.count());
+        SaveSettingValue(fmt::format("music.cue_{}_track", i), cues[i].track);
+    }
+}
+
+void
+RetireStream(Playlist& playlist, PreparedStream& stream)
+{
+    if (stream.decoder && !IsStreamReady(stream))
+        playlist.retired.push_back(std::move(stream));
+    stream = {};
+}
+
+// The track played after track in the mode of the playlist, or -1
+s32
+TrackAfter(Playlist& playlist, s32 track)
+{
+    s32 count = (s32)playlist.musics->entries.size();
+    switch (playlist.mode)
+    {
+    case PlaylistMode::Once: return -1;
+    case PlaylistMode::Sequence: return (track + 1 < count) ? track + 1 : -1;
+    case PlaylistMode::Loop: return (track + 1) % count;
+    case PlaylistMode::RepeatTrack: return track;
+    case PlaylistMode::Shuffle:
+    {
+        // Never the same track twice in a row
+        if (count == 1)
+            return 0;
+        s32 next = Random(count - 2);
+        if (next >= track)
+            next++;
+        return next;
+    }
+    default: return -1;
+    }
+}
+
+void
+PrepareNextTrack(Playlist& playlist)
+{
+    s32 next_track = -1;
+    s32 count      = (s32)playlist.musics->entries.size();
+    if (playlist.track >= 0 && count > 0)
+    {
+        // The tracks that couldn't be opened are skipped
+        next_track = TrackAfter(playlist, playlist.track);
+        for (s32 i = 0; i < count && next_track >= 0
+                        && playlist.musics->entries[next_track].failed;
+             i++)
+        {
+            next_track = TrackAfter(playlist, next_track);
+        }
+        if (next_track >= 0 && playlist.musics->entries[next_track].failed)
+            next_track = -1;
+    }
+
+    // The stream being opened is kept when the track doesn't change
+    if (next_track != playlist.next_track || !playlist.next.decoder
+        || IsStreamStarted(playlist.next))
+    {
+        RetireStream(playlist, playlist.next);
+        playlist.next_track = next_track;
+        if (next_track >= 0)
+        {
+            auto& entry   = playlist.musics->entries[next_track];
+            playlist.next = PrepareStream(entry.buffer.path);
+        }
+    }
+    // Replaces the track that was queued before, if any
+    QueueStream(playlist.playing, playlist.next);
+}
+
+void
+PlayMusic(Playlist& playlist, u32 track)
+{
+    if (track >= playlist.musics->entries.size())
+        return;
+
+    // The track starts in UpdatePlaylist when the file is ready
+    auto& path = playlist.musics->entries[track].buffer.path;
+    RetireStream(playlist, playlist.starting);
+    playlist.starting_track = track;
+    playlist.starting       = PrepareStream(path);
+}
+
+void
+StopMusic(Playlist& playlist)
+{
+    StopAudio(playlist.playing);
+    StopAudio(playlist.crossfade.fade_out);
+    playlist.crossfade.duration = Seconds(0);
+    playlist.track              = -1;
+    playlist.starting_track     = -1;
+    playlist.next_track         = -1;
+    RetireStream(playlist, playlist.starting);
+    RetireStream(playlist, playlist.next);
+}
+
+void
+UpdatePlaylist(Playlist& playlist, Duration timer_time)
+{
+    auto& crossfade = playlist.crossfade;
+    if (crossfade.duration != Seconds(0))
+    {
+        using MillisecondsFloat = std::chrono::duration<f32, std::milli>;
+        f32 elapsed = std::chrono::duration_cast<MillisecondsFloat>(
+                          Clock::now() - crossfade.start)
+                          .count();
+        f32 duration =
+            std::chrono::duration_cast<MillisecondsFloat>(crossfade.duration)
+                .count();
+        f32 t = Clamp(elapsed / duration, 0.f, 1.f);
+        SetGain(crossfade.fade_in, t * playlist.gain / 100.f);
+        SetGain(crossfade.fade_out, (1.f - t) * playlist.gain / 100.f);
+        if (t == 1.f)
+        {
+            crossfade.duration = Seconds(0);
+            StopAudio(crossfade.fade_out);
+            Print("Crossfade ended\n");
+        }
+    }
+
+    for (auto& cue : playlist.cues)
+    {
+        if (playlist.last_timer_time < cue.time && timer_time >= cue.time)
+        {
+            Print("Music cue at {}: {}\n", DurationToString(cue.time),
+                  TrackName(playlist, cue.track));
+            PlayMusic(playlist, cue.track);
+        }
+    }
+    playlist.last_timer_time = timer_time;
+
+    std::erase_if(playlist.retired,
+                  [](PreparedStream& stream) { return IsStreamReady(stream); });
+
+    // A track that can't be opened isn't tried again
+    if (IsStreamFailed(playlist.starting))
+    {
+        playlist.musics->entries[playlist.starting_track].failed = true;
+        playlist.starting_track = -1;
+        playlist.starting       = {};
+    }
+    if (IsStreamFailed(playlist.next))
+    {
+        playlist.musics->entries[playlist.next_track].failed = true;
+        PrepareNextTrack(playlist);
+    }
+
+    if (playlist.starting.decoder && IsStreamReady(playlist.starting))
+    {
+        f32 gain = playlist.gain / 100.f;
+        if (IsPlaying(playlist.playing))
+        {
+            if (crossfade.duration != Seconds(0))
+            {
+                // We were already crossfading
+                StopAudio(crossfade.fade_out);
+                Print("Crossfade stopped\n");
+            }
+            crossfade.start    = Clock::now();
+            crossfade.duration = Seconds(1);
+            crossfade.fade_out = playlist.playing;
+            gain               = 0.f;
+            // The track fading out must not go on with its queued track
+            QueueStream(crossfade.fade_out, {});
+            Print("Crossfade start\n");
+        }
+        else
+        {
+            crossfade.duration = Seconds(0);
+        }
+        playlist.playing        = PlayStream(playlist.starting, Gain(gain));
+        crossfade.fade_in       = playlist.playing;
+        playlist.track          = playlist.starting_track;
+        playlist.starting_track = -1;
+        playlist.starting       = {};
+        // It was asked for again and it could be opened this time
+        playlist.musics->entries[playlist.track].failed = false;
+        PrepareNextTrack(playlist);
+    }
+
+    if (playlist.next.decoder)
+    {
+        if (IsStreamStarted(playlist.next))
+        {
+            // The source switched to the next track. The previous track is
+            // still heard for the length of the buffers already queued.
+            playlist.track = playlist.next_track;
+            PrepareNextTrack(playlist);
+        }
+        else if (!IsPlaying(playlist.playing)
+                 && IsStreamReady(playlist.next))
+        {
+            // The next track couldn't be queued (different format), it starts
+            // in its own source.
+            playlist.playing =
+                PlayStream(playlist.next, Gain(playlist.gain / 100.f));
+            playlist.track = playlist.next_track;
+            PrepareNextTrack(playlist);
+        }
+    }
+    else if (playlist.track >= 0 && !IsPlaying(playlist.playing))
+    {
+        playlist.track = -1;
+    }
+}
+
+void
+DrawPlaylist(Playlist& playlist)
+{
+    if (ImGui::Begin("Audio"))
+    {
+        if (ImGui::SliderInt(utf8("Volume musique"), &playlist.gain, 0, 100))
+        {
+            if (playlist.crossfade.duration == Seconds(0))
+            {
+                // Only set the music gain when we are not crossfading
+                SetGain(playlist.playing, playlist.gain / 100.f);
+            }
+        }
+
+        if (ImGui::BeginCombo(utf8("Mode"),
+                              playlist_mode_names[(u32)playlist.mode]))
+        {
+            for (u32 i = 0; i < (u32)PlaylistMode::Count; i++)
+            {
+                const bool is_selected = (i == (u32)playlist.mode);
+                if (ImGui::Selectable(playlist_mode_names[i], is_selected)
+                    && !is_selected)
+                {
+                    playlist.mode = (PlaylistMode)i;
+                    PrepareNextTrack(playlist);
+                }
+                if (is_selected)
+                    ImGui::SetItemDefaultFocus();
+            }
+            ImGui::EndCombo();
+        }
+
+        for (u32 i = 0; i < playlist.musics->entries.size(); i++)
+        {
+            ImGui::PushID(i);
+            if (SelectableButton(TrackName(playlist, i).c_str(),
+                                 playlist.track == (s32)i
+                                     || playlist.starting_track == (s32)i))
+            {
+                PlayMusic(playlist, i);
+            }
+            ImGui::PopID();
+        }
+        if (IsPlaying(playlist.playing))
+        {
+            if (playlist.next_track >= 0)
+            {
+                auto next = TrackName(playlist, playlist.next_track);
+                ImGui::Text(utf8("Ensuite: %s"), next.c_str());
+            }
+            if (ImGui::Button(utf8("Arrêter la musique")))
+            {
+                StopMusic(playlist);
+            }
+        }
+
+        if (ImGui::CollapsingHeader(utf8("Musiques au chrono")))
+        {
+            u32 to_remove = U32_MAX;
+            for (u32 i = 0; i < playlist.cues.size(); i++)
+            {
+                auto& cue = playlist.cues[i];
+                auto  minutes =
+                    std::chrono::duration_cast<std::chrono::minutes>(cue.time);
+                ImGui::PushID(i);
+                ImGui::Text(utf8("%lld min: %s"), (s64)minutes.count(),
+                            TrackName(playlist, cue.track).c_str());
+                ImGui::SameLine();
+                if (ImGui::SmallButton(utf8("Supprimer")))
+                {
+                    to_remove = i;
+                }
+                ImGui::PopID();
+            }
+            if (to_remove < playlist.cues.size())
+            {
+                playlist.cues.erase(playlist.cues.begin() + to_remove);
+            }
+
+            static s32 cue_minutes = 0;
+            static u32 cue_track   = 0;
+            ImGui::SetNextItemWidth(100);
+            ImGui::InputInt(utf8("minutes"), &cue_minutes);
+            cue_minutes = std::max(cue_minutes, 0);
+            ImGui::SameLine();
+            ImGui::SetNextItemWidth(200);
+            if (ImGui::BeginCombo(utf8("##Musique au chrono"),
+                                  TrackName(playlist, cue_track).c_str()))
+            {
+                for (u32 i = 0; i < playlist.musics->entries.size(); i++)
+                {
+                    const bool is_selected = (i == cue_track);
+                    if (ImGui::Selectable(TrackName(playlist, i).c_str(),
+                                          is_selected))
+                    {
+                        cue_track = i;
+                    }
+                    if (is_selected)
+                        ImGui::SetItemDefaultFocus();
+                }
+                ImGui::EndCombo();
+            }
+            ImGui::SameLine();
+            if (ImGui::Button(utf8("Ajouter")))
+            {
+                MusicCue cue;
+                cue.time  = Minutes(cue_minutes);
+                cue.track = cue_track;
+                playlist.cues.push_back(cue);
+            }
+        }
+    }
+    ImGui::End();
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include "alias.hpp"
+#include "time.hpp"
+#include "audio.hpp"
+#include "sound_bank.hpp"
+
+enum class PlaylistMode : u32
+{
+    Once,        // Play the track and stop
+    Sequence,    // Play the next tracks until the last one
+    Loop,        // Play all the tracks in a loop
+    RepeatTrack, // Play the same track in a loop
+    Shuffle,     // Play a random track after each one
+    Count
+};
+
+struct Crossfade
+{
+    Crossfade() {}
+    AudioPlaying fade_out;
+    AudioPlaying fade_in;
+
+    Timepoint start;
+    Duration  duration = Seconds(0);
+};
+
+/*
+   A MusicCue starts a track when the game timer reaches its time.
+*/
+struct MusicCue
+{
+    MusicCue() {}
+    Duration time  = Minutes(0);
+    u32      track = 0;
+};
+
+/*
+   The Playlist plays the tracks of the "musics" sound bank. The files are
+   opened in another thread: a track starts a few frames after it is asked
+   for, and the next track is queued in the same source as soon as the
+   current one starts so they play without a gap.
+*/
+struct Playlist
+{
+    Playlist();
+    ~Playlist();
+
+    SoundBank*   musics = nullptr;
+    PlaylistMode mode   = PlaylistMode::Once;
+    s32          gain   = 50;
+
+    s32          track = -1; // Track being played
+    AudioPlaying playing;
+    Crossfade    crossfade;
+
+    // Track waiting for its file to be opened to start
+    s32            starting_track = -1;
+    PreparedStream starting;
+
+    // Track queued after the one being played
+    s32            next_track = -1;
+    PreparedStream next;
+
+    // Streams replaced while their file was being opened. They are kept until
+    // it is, their destructor would wait for it.
+    std::vector<PreparedStream> retired;
+
+    std::vector<MusicCue> cues;
+    Duration              last_timer_time = Minutes(0);
+};
+
+void PlayMusic(Playlist& playlist, u32 track);
+void StopMusic(Playlist& playlist);
+void UpdatePlaylist(Playlist& playlist, Duration timer_time);
+void DrawPlaylist(Playlist& playlist);
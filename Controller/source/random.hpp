@@ -26,3 +26,13 @@ Random(T max)
 {
     return Random((T)0, max);
 }
+
+// Time until the next event of a Poisson process, mean is the average time
+// between two events.
+template<typename T>
+T
+RandomExponential(T mean)
+{
+    std::exponential_distribution<T> distribution(1 / mean);
+    return distribution(global_mt19937);
+}
@@ -67,7 +67,7 @@ RingDispenser::receiveMessage(Client& client, const RingDispenserStatus& msg,
         command.getHeader().serialize(serializer);
         command.serialize(serializer);
 
-        SendPacket(client.connection, serializer);
+        SendPacket(client.link(), serializer);
     }
 }
 
@@ -194,7 +194,7 @@ RingDispenser::update(Client& client)
         need_update = true;
     }
 
-    if (client.connection.socket)
+    if (client.canSend())
     {
         if (need_update || client.heartbeatTimeout())
         {
@@ -210,7 +210,7 @@ RingDispenser::update(Client& client)
                 command.getHeader().serialize(serializer);
                 command.serialize(serializer);
 
-                SendPacket(client.connection, serializer);
+                SendPacket(client.link(), serializer);
             }
         }
     }
@@ -2,12 +2,23 @@
 #include "serial_port.hpp"
 #include "print.hpp"
 #include "scope_exit.hpp"
+#include "time.hpp"
+#include "serial_in/frame.hpp"
 
 #include <fmt/format.h>
 #include <imgui.h>
 
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <thread>
+
+#if defined(_WIN32)
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#include <Dbt.h>
 
 #define NO_CENUMERATESERIAL_USING_CREATEFILE
 // #define NO_CENUMERATESERIAL_USING_QUERYDOSDEVICE
@@ -20,53 +31,166 @@
 #define NO_CENUMERATESERIAL_USING_REGISTRY
 #define NO_CENUMERATESERIAL_USING_GETCOMMPORTS
 #include "CEnumerateSerial/enumser.h"
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#endif
+
+/*
+   SerialHistory keeps the last lines received by a port, up to byte_budget
+   bytes. The oldest lines are dropped first. Lines are numbered from the
+   first line received, line_offset is the number of the first line kept.
+*/
+struct SerialHistory
+{
+    std::deque<Str> lines;
+    Str             partial_line; // Last line, not finished yet
+    u64             bytes       = 0;
+    u64             line_offset = 0;
+
+    sconst u64 byte_budget = 4 * 1024 * 1024;
+};
+
+/*
+   The search index is the list of the lines containing the searched text. It
+   is updated with the new lines at each frame, and a search doesn't look at
+   more than max_lines_per_frame lines in one frame.
+*/
+struct SerialSearch
+{
+    Str              input_buffer = Str(128, '\0');
+    Str              text;
+    std::vector<u64> matches;   // Line numbers
+    u64              next_line = 0; // Next line number to search
+
+    sconst u64 max_lines_per_frame = 20'000;
+};
 
+/*
+   Each SerialPort has a thread that reads the port in chunks, takes out the
+   message frames (see serial_in/frame.hpp) and splits the text in lines. The
+   UI thread only takes the lines and messages that are ready and queues what
+   it wants to write.
+*/
 struct SerialPort
 {
-    SerialPort()
-    {
-        history.emplace_back();
-    }
-    // Str   name;
-    u32   name   = 0;
-    void* handle = nullptr;
+    SerialPort() {}
+    Str name;
+#if defined(_WIN32)
+    HANDLE handle = nullptr;
+#else
+    s32 fd      = -1;
+    s32 wake_fd = -1; // eventfd that wakes the thread up to write
+#endif
+
+    std::thread       thread;
+    std::atomic<bool> running       = false;
+    std::atomic<bool> failed        = false;
+    std::atomic<bool> write_pending = false;
 
-    std::vector<Str> history;
-    Str              input_buffer = Str(256, '\0');
+    // Shared with the thread:
+    std::mutex                   mutex;
+    std::vector<Str>             lines_received;
+    Str                          partial_line; // Last line, not finished yet
+    Str                          to_write;
+    std::deque<std::vector<u8>>  messages_received;
+
+    SerialHistory history;
+    SerialSearch  search;
+    Str           input_buffer = Str(256, '\0');
+};
+
+enum class SerialPortEventType
+{
+    Added,
+    Removed,
 };
 
+struct SerialPortEvent
+{
+    SerialPortEventType type;
+    Str                 name;
+};
+
+/*
+   The hotplug thread waits for the OS to tell that a device was added or
+   removed, then lists the serial ports and sends the differences to the UI
+   thread as events. Nothing is listed while nothing changes.
+*/
 struct SerialPortManager
 {
-    std::vector<SerialPort> ports;
+    // std::list because a SerialPort can't move while its thread runs
+    std::list<SerialPort> ports;
+
+    std::thread       hotplug_thread;
+    std::atomic<bool> hotplug_running = false;
+    // When the notifications are not available, the UI thread lists the ports
+    // every second instead.
+    std::atomic<bool> hotplug_failed = false;
+    Timepoint         next_scan;
+
+    // Protects events, errors and known_ports
+    std::mutex                   events_mutex;
+    std::vector<SerialPortEvent> events;
+    // The errors of the hotplug thread, printed by the UI thread
+    std::vector<Str>             errors;
+    std::vector<Str>             known_ports;
+
+    // The message returned by ReceiveSerialMessage
+    std::vector<u8> message_buffer;
+#if defined(_WIN32)
+    std::atomic<HWND> hotplug_window = nullptr;
+#endif
 };
 
 SerialPortManager serial_manager;
 
+constexpr u64 serial_read_chunk_size = 4096;
+// The thread waits at most this long for data, it checks if it should stop
+// in between.
+constexpr u32 serial_read_timeout_ms = 50;
+
+// The hotplug thread can't print, the UI thread prints the errors
+template<typename... Args>
 void
-ListSerialPorts()
+PostSerialError(const fmt::string_view str, Args&&... args)
+{
+    auto formated = fmt::vformat(str, fmt::make_format_args(args...));
+    std::lock_guard<std::mutex> lock(serial_manager.events_mutex);
+    serial_manager.errors.push_back(std::move(formated));
+}
+
+#if defined(_WIN32)
+
+std::vector<Str>
+EnumerateSerialPorts()
 {
+    std::vector<Str>              names;
     CEnumerateSerial::CPortsArray ports;
     if (CEnumerateSerial::UsingQueryDosDevice(ports))
     {
-        PrintSuccess("Serial ports:\n");
         for (const auto& p : ports)
         {
-            Print("  >COM{}\n", p);
+            names.push_back(fmt::format("COM{}", p));
         }
     }
     else
     {
-        PrintError("CEnumerateSerial::UsingRegistry failed\n");
+        PostSerialError("CEnumerateSerial::UsingQueryDosDevice failed\n");
     }
+    return names;
 }
 
-SerialPort
-OpenSerialPort(u32 com, u32 baud_rate)
+bool
+OpenSerialDevice(SerialPort& serial, u32 baud_rate)
 {
-    SerialPort serial = {};
-
-    serial.name    = com;
-    auto full_name = fmt::format("\\\\.\\COM{}\\", com);
+    auto full_name = fmt::format("\\\\.\\{}\\", serial.name);
     serial.handle = CreateFileA(full_name.c_str(), GENERIC_READ | GENERIC_WRITE,
                                 0, NULL, OPEN_EXISTING, 0, NULL);
     if (serial.handle == INVALID_HANDLE_VALUE)
@@ -82,7 +206,7 @@ OpenSerialPort(u32 com, u32 baud_rate)
             Print("Error code : {}\n", err);
         }
         serial.handle = nullptr;
-        return serial;
+        return false;
     }
 
     DCB dcb;
@@ -95,11 +219,7 @@ OpenSerialPort(u32 com, u32 baud_rate)
         dcb.fBinary  = TRUE;
         dcb.fParity  = TRUE;
 
-        if (SetCommState(serial.handle, &dcb))
-        {
-            // Print("Serial port settings modified!\n");
-        }
-        else
+        if (!SetCommState(serial.handle, &dcb))
         {
             Print("Cannot set port settings\n");
         }
@@ -112,110 +232,766 @@ OpenSerialPort(u32 com, u32 baud_rate)
     COMMTIMEOUTS timeout;
     if (GetCommTimeouts(serial.handle, &timeout))
     {
-        timeout.ReadIntervalTimeout        = MAXDWORD;
-        timeout.ReadTotalTimeoutConstant   = 0;
-        timeout.ReadTotalTimeoutMultiplier = 0;
-        // timeout.WriteTotalTimeoutConstant   = 1;
-        // timeout.WriteTotalTimeoutMultiplier = 1;
+        // ReadFile returns as soon as there is at least one byte, with
+        // everything available up to the size asked, or after the constant
+        // timeout.
+        timeout.ReadIntervalTimeout         = MAXDWORD;
+        timeout.ReadTotalTimeoutMultiplier  = MAXDWORD;
+        timeout.ReadTotalTimeoutConstant    = serial_read_timeout_ms;
+        timeout.WriteTotalTimeoutConstant   = 0;
+        timeout.WriteTotalTimeoutMultiplier = 0;
 
-        if (SetCommTimeouts(serial.handle, &timeout))
+        if (!SetCommTimeouts(serial.handle, &timeout))
         {
-            // Print("Timeout settings modified\n");
+            Print("Cannot set timeout settings\n");
+        }
+    }
+    else
+    {
+        Print("Cannot get timeout settings\n");
+    }
+    return true;
+}
+
+void
+CloseSerialDevice(SerialPort& serial)
+{
+    if (serial.handle)
+    {
+        CloseHandle(serial.handle);
+        serial.handle = nullptr;
+    }
+}
+
+// Returns the number of bytes read, 0 on timeout, -1 on error
+s64
+ReadSerialDevice(SerialPort& serial, u8* data, u64 size)
+{
+    DWORD read = 0;
+    if (!ReadFile(serial.handle, data, (DWORD)size, &read, NULL))
+    {
+        // Cancelled by WakeSerialDevice
+        return (GetLastError() == ERROR_OPERATION_ABORTED) ? 0 : -1;
+    }
+    return read;
+}
+
+s64
+WriteSerialDevice(SerialPort& serial, const u8* data, u64 size)
+{
+    DWORD written = 0;
+    if (!WriteFile(serial.handle, data, (DWORD)size, &written, NULL))
+    {
+        return (GetLastError() == ERROR_OPERATION_ABORTED) ? written : -1;
+    }
+    return written;
+}
+
+// Stops the read the thread is waiting on so it writes right away
+void
+WakeSerialDevice(SerialPort& serial)
+{
+    CancelSynchronousIo((HANDLE)serial.thread.native_handle());
+}
+
+#else
+
+std::vector<Str>
+EnumerateSerialPorts()
+{
+    std::vector<Str> names;
+    std::error_code  error;
+    for (auto const& dir_entry :
+         std::filesystem::directory_iterator{"/dev", error})
+    {
+        auto filename = dir_entry.path().filename().string();
+        if (filename.starts_with("ttyUSB") || filename.starts_with("ttyACM"))
+        {
+            names.push_back(dir_entry.path().string());
+        }
+    }
+    if (error)
+    {
+        PostSerialError("Can't list /dev: {}\n", error.message());
+    }
+    return names;
+}
+
+speed_t
+BaudRateToSpeed(u32 baud_rate)
+{
+    switch (baud_rate)
+    {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+    default: return B0;
+    }
+}
+
+bool
+OpenSerialDevice(SerialPort& serial, u32 baud_rate)
+{
+    serial.fd = open(serial.name.c_str(), O_RDWR | O_NOCTTY);
+    if (serial.fd < 0)
+    {
+        Print("Cannot open port: {}\n", strerror(errno));
+        return false;
+    }
+    serial.wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (serial.wake_fd < 0)
+    {
+        Print("Cannot create eventfd: {}\n", strerror(errno));
+        close(serial.fd);
+        serial.fd = -1;
+        return false;
+    }
+
+    termios tty;
+    if (tcgetattr(serial.fd, &tty) == 0)
+    {
+        cfmakeraw(&tty);
+        tty.c_cflag |= CLOCAL | CREAD;
+        tty.c_cflag &= ~CRTSCTS;
+        // read() never blocks, we wait with poll()
+        tty.c_cc[VMIN]  = 0;
+        tty.c_cc[VTIME] = 0;
+
+        speed_t speed = BaudRateToSpeed(baud_rate);
+        if (speed == B0)
+        {
+            Print("Unsupported baud rate {}\n", baud_rate);
         }
         else
         {
-            Print("Cannot set timeout settings\n");
+            cfsetispeed(&tty, speed);
+            cfsetospeed(&tty, speed);
+        }
+
+        if (tcsetattr(serial.fd, TCSANOW, &tty) != 0)
+        {
+            Print("Cannot set port settings\n");
         }
     }
     else
     {
-        Print("Cannot get timeout settings\n");
+        Print("Cannot get port settings\n");
+    }
+    return true;
+}
+
+void
+CloseSerialDevice(SerialPort& serial)
+{
+    if (serial.fd >= 0)
+    {
+        close(serial.fd);
+        serial.fd = -1;
+    }
+    if (serial.wake_fd >= 0)
+    {
+        close(serial.wake_fd);
+        serial.wake_fd = -1;
+    }
+}
+
+// Returns the number of bytes read, 0 on timeout, -1 on error
+s64
+ReadSerialDevice(SerialPort& serial, u8* data, u64 size)
+{
+    pollfd poll_fds[2] = {};
+    poll_fds[0].fd     = serial.fd;
+    poll_fds[0].events = POLLIN;
+    poll_fds[1].fd     = serial.wake_fd;
+    poll_fds[1].events = POLLIN;
+    s32 poll_result    = poll(poll_fds, 2, serial_read_timeout_ms);
+    if (poll_result < 0)
+    {
+        return (errno == EINTR) ? 0 : -1;
+    }
+    if (poll_fds[1].revents & POLLIN)
+    {
+        u64 wake_count = 0;
+        (void)read(serial.wake_fd, &wake_count, sizeof(wake_count));
+    }
+    if (poll_fds[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+    {
+        // The device was unplugged
+        return -1;
+    }
+    if (!(poll_fds[0].revents & POLLIN))
+    {
+        return 0;
+    }
+
+    ssize_t read_size = read(serial.fd, data, size);
+    if (read_size < 0)
+    {
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+    return read_size;
+}
+
+s64
+WriteSerialDevice(SerialPort& serial, const u8* data, u64 size)
+{
+    ssize_t written = write(serial.fd, data, size);
+    if (written < 0)
+    {
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
     }
-    return serial;
+    return written;
 }
 
+// Stops the poll the thread is waiting on so it writes right away
 void
-CloseSerialPort(SerialPort& h)
+WakeSerialDevice(SerialPort& serial)
 {
-    if (h.handle)
+    u64 one = 1;
+    (void)write(serial.wake_fd, &one, sizeof(one));
+}
+
+#endif
+
+void
+ScanSerialPorts()
+{
+    auto names = EnumerateSerialPorts();
+    std::sort(names.begin(), names.end());
+
+    auto& known = serial_manager.known_ports;
+    std::lock_guard<std::mutex> lock(serial_manager.events_mutex);
+    for (auto& name : names)
     {
-        CloseHandle(h.handle);
-        h.handle = nullptr;
+        if (!std::binary_search(known.begin(), known.end(), name))
+        {
+            serial_manager.events.push_back({SerialPortEventType::Added, name});
+        }
+    }
+    for (auto& name : known)
+    {
+        if (!std::binary_search(names.begin(), names.end(), name))
+        {
+            serial_manager.events.push_back(
+                {SerialPortEventType::Removed, name});
+        }
     }
+    known = std::move(names);
 }
 
-Str
-ReadSerial(SerialPort& h)
+// The port is closed, it is added again when a scan finds it
+void
+ForgetSerialPort(StrPtr name)
+{
+    std::lock_guard<std::mutex> lock(serial_manager.events_mutex);
+    std::erase(serial_manager.known_ports, name);
+}
+
+#if defined(_WIN32)
+
+LRESULT CALLBACK
+HotplugWindowProc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam)
 {
-    Str   message;
-    char  c = 0;
-    DWORD read;
-    do
+    if (msg == WM_DEVICECHANGE)
     {
-        if (ReadFile(h.handle, &c, 1, &read, NULL))
+        if (wparam == DBT_DEVICEARRIVAL || wparam == DBT_DEVICEREMOVECOMPLETE)
         {
-            if (read)
+            ScanSerialPorts();
+        }
+        return TRUE;
+    }
+    if (msg == WM_CLOSE)
+    {
+        DestroyWindow(hwnd);
+        PostQuitMessage(0);
+        return 0;
+    }
+    return DefWindowProcA(hwnd, msg, wparam, lparam);
+}
+
+void
+HotplugThread()
+{
+    ScanSerialPorts();
+
+    WNDCLASSEXA window_class   = {};
+    window_class.cbSize        = sizeof(window_class);
+    window_class.lpfnWndProc   = HotplugWindowProc;
+    window_class.hInstance     = GetModuleHandleA(NULL);
+    window_class.lpszClassName = "EscapeSerialHotplug";
+    RegisterClassExA(&window_class);
+
+    // A message-only window doesn't get the broadcasts, but it gets the
+    // device interface notifications it registers for.
+    HWND hwnd = CreateWindowExA(0, window_class.lpszClassName, "", 0, 0, 0, 0,
+                                0, HWND_MESSAGE, NULL, window_class.hInstance,
+                                NULL);
+    if (!hwnd)
+    {
+        serial_manager.hotplug_failed = true;
+        return;
+    }
+
+    DEV_BROADCAST_DEVICEINTERFACE_A filter = {};
+    filter.dbcc_size       = sizeof(filter);
+    filter.dbcc_devicetype = DBT_DEVTYP_DEVICEINTERFACE;
+    HDEVNOTIFY notify      = RegisterDeviceNotificationA(
+        hwnd, &filter,
+        DEVICE_NOTIFY_WINDOW_HANDLE | DEVICE_NOTIFY_ALL_INTERFACE_CLASSES);
+    if (!notify)
+    {
+        serial_manager.hotplug_failed = true;
+        DestroyWindow(hwnd);
+        return;
+    }
+    serial_manager.hotplug_window = hwnd;
+    if (!serial_manager.hotplug_running
+        && serial_manager.hotplug_window.exchange(nullptr))
+    {
+        // StopHotplugThread was called before it could see the window
+        PostMessageA(hwnd, WM_CLOSE, 0, 0);
+    }
+
+    MSG msg;
+    while (GetMessageA(&msg, NULL, 0, 0) > 0)
+    {
+        DispatchMessageA(&msg);
+    }
+
+    UnregisterDeviceNotification(notify);
+    UnregisterClassA(window_class.lpszClassName, window_class.hInstance);
+}
+
+void
+StopHotplugThread()
+{
+    serial_manager.hotplug_running = false;
+    if (HWND hwnd = serial_manager.hotplug_window.exchange(nullptr))
+    {
+        PostMessageA(hwnd, WM_CLOSE, 0, 0);
+    }
+    if (serial_manager.hotplug_thread.joinable())
+    {
+        serial_manager.hotplug_thread.join();
+    }
+}
+
+#else
+
+void
+HotplugThread()
+{
+    ScanSerialPorts();
+
+    // The kernel sends a uevent on this socket for each device added or
+    // removed.
+    s32 fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+                    NETLINK_KOBJECT_UEVENT);
+    if (fd < 0)
+    {
+        serial_manager.hotplug_failed = true;
+        return;
+    }
+    SCOPE_EXIT({ close(fd); });
+
+    sockaddr_nl address = {};
+    address.nl_family   = AF_NETLINK;
+    address.nl_pid      = 0;
+    address.nl_groups   = 1; // Kernel events
+    if (bind(fd, (sockaddr*)&address, sizeof(address)) < 0)
+    {
+        serial_manager.hotplug_failed = true;
+        return;
+    }
+
+    char buffer[4096];
+    while (serial_manager.hotplug_running)
+    {
+        pollfd poll_fd = {};
+        poll_fd.fd     = fd;
+        poll_fd.events = POLLIN;
+        if (poll(&poll_fd, 1, serial_read_timeout_ms) <= 0)
+        {
+            continue;
+        }
+
+        ssize_t size = recv(fd, buffer, sizeof(buffer), 0);
+        if (size <= 0)
+        {
+            continue;
+        }
+
+        // The message is a list of null terminated strings like
+        // "ACTION=add" and "SUBSYSTEM=tty".
+        bool is_tty = false;
+        for (StrPtr str(buffer, size); str.size();)
+        {
+            StrPtr field = str.substr(0, str.find('\0'));
+            if (field == "SUBSYSTEM=tty")
             {
-                message += c;
+                is_tty = true;
+                break;
             }
+            str.remove_prefix(std::min(field.size() + 1, str.size()));
         }
-        else
+        if (is_tty)
         {
-            Print("ReadFile failed 0x{:X}\n", GetLastError());
-            CloseSerialPort(h);
+            ScanSerialPorts();
         }
-    } while (read > 0);
+    }
+}
 
-    return message;
+void
+StopHotplugThread()
+{
+    serial_manager.hotplug_running = false;
+    if (serial_manager.hotplug_thread.joinable())
+    {
+        serial_manager.hotplug_thread.join();
+    }
 }
 
+#endif
+
+struct FrameSplitter
+{
+    bool            in_frame = false;
+    std::vector<u8> frame;
+};
+
+/*
+   Separates the frames from the text. A 0 starts or ends a frame, when the
+   bytes between two 0 are not a valid frame they were text and the second 0
+   starts a frame.
+*/
 void
-WriteSerial(SerialPort& h, StrPtr message)
+SplitFrames(FrameSplitter& splitter, const u8* data, u64 size, Str& text,
+            std::vector<std::vector<u8>>& messages)
 {
-    while (message.size())
+    for (u64 i = 0; i < size; i++)
     {
-        DWORD written = 0;
-        if (WriteFile(h.handle, &message[0], (DWORD)message.size(), &written,
-                      NULL))
+        u8 c = data[i];
+        if (!splitter.in_frame)
+        {
+            if (c == 0)
+                splitter.in_frame = true;
+            else
+                text.push_back((char)c);
+            continue;
+        }
+
+        if (c != 0)
+        {
+            splitter.frame.push_back(c);
+            if (splitter.frame.size() > FrameSize(frame_max_message_size))
+            {
+                text.append(splitter.frame.begin(), splitter.frame.end());
+                splitter.frame.clear();
+                splitter.in_frame = false;
+            }
+            continue;
+        }
+        if (splitter.frame.empty())
+            continue;
+
+        u32 message_size =
+            DecodeFrame(splitter.frame.data(), (u32)splitter.frame.size());
+        if (message_size)
         {
-            message.remove_prefix(written);
+            splitter.frame.resize(message_size);
+            messages.push_back(std::move(splitter.frame));
+            splitter.in_frame = false;
         }
         else
         {
-            Print("WriteFile failed\n");
-            CloseSerialPort(h);
+            text.append(splitter.frame.begin(), splitter.frame.end());
         }
+        splitter.frame.clear();
     }
 }
 
+void
+SerialThread(SerialPort& serial)
+{
+    u8                           chunk[serial_read_chunk_size];
+    FrameSplitter                splitter;
+    Str                          text;
+    std::vector<std::vector<u8>> messages;
+    Str                          line;
+    Str                          to_write;
+    while (serial.running)
+    {
+        // On Windows, a write queued just before ReadFile starts still waits
+        // for the read timeout.
+        s64 read = 0;
+        if (!serial.write_pending)
+        {
+            read = ReadSerialDevice(serial, chunk, sizeof(chunk));
+        }
+        if (read < 0)
+        {
+            serial.failed = true;
+            break;
+        }
+
+        text.clear();
+        messages.clear();
+        SplitFrames(splitter, chunk, read, text, messages);
+
+        {
+            std::lock_guard<std::mutex> lock(serial.mutex);
+            for (auto& message : messages)
+            {
+                serial.messages_received.push_back(std::move(message));
+            }
+
+            StrPtr str = text;
+            while (str.size())
+            {
+                u64 new_line = str.find_first_of('\n');
+                if (new_line == StrPtr::npos)
+                {
+                    line.append(str);
+                    break;
+                }
+                line.append(str.substr(0, new_line + 1));
+                serial.lines_received.push_back(std::move(line));
+                line.clear();
+                str.remove_prefix(new_line + 1);
+            }
+            serial.partial_line = line;
+
+            to_write.append(serial.to_write);
+            serial.to_write.clear();
+            serial.write_pending = false;
+        }
+
+        while (to_write.size())
+        {
+            s64 written = WriteSerialDevice(serial, (u8*)to_write.data(),
+                                            to_write.size());
+            if (written < 0)
+            {
+                serial.failed = true;
+                break;
+            }
+            to_write.erase(0, written);
+        }
+    }
+}
+
+bool
+StartSerialPort(SerialPort& serial, u32 baud_rate)
+{
+    if (!OpenSerialDevice(serial, baud_rate))
+    {
+        return false;
+    }
+    serial.running = true;
+    serial.thread  = std::thread(SerialThread, std::ref(serial));
+    return true;
+}
+
+void
+StopSerialPort(SerialPort& serial)
+{
+    serial.running = false;
+    if (serial.thread.joinable())
+    {
+        serial.thread.join();
+    }
+    CloseSerialDevice(serial);
+}
+
+void
+ListSerialPorts()
+{
+    auto names = EnumerateSerialPorts();
+    PrintSuccess("Serial ports:\n");
+    for (const auto& name : names)
+    {
+        Print("  >{}\n", name);
+    }
+}
+
+void
+WriteSerial(SerialPort& serial, StrPtr message)
+{
+    // Sent by the thread
+    {
+        std::lock_guard<std::mutex> lock(serial.mutex);
+        serial.to_write.append(message);
+        serial.write_pending = true;
+    }
+    WakeSerialDevice(serial);
+}
+
 void
 InitSerial()
-{}
+{
+    if (serial_manager.hotplug_running)
+        return;
+
+    serial_manager.hotplug_running = true;
+    serial_manager.hotplug_failed  = false;
+    serial_manager.hotplug_thread  = std::thread(HotplugThread);
+}
 
 void
 TerminateSerial()
 {
+    StopHotplugThread();
     for (auto& port : serial_manager.ports)
     {
-        CloseSerialPort(port);
+        StopSerialPort(port);
+    }
+    serial_manager.ports.clear();
+    serial_manager.events.clear();
+    serial_manager.errors.clear();
+    serial_manager.known_ports.clear();
+}
+
+void
+AddHistoryLine(SerialHistory& history, Str&& line)
+{
+    history.bytes += line.size();
+    history.lines.push_back(std::move(line));
+    while (history.bytes > history.byte_budget && history.lines.size() > 1)
+    {
+        history.bytes -= history.lines.front().size();
+        history.lines.pop_front();
+        history.line_offset++;
+    }
+}
+
+void
+UpdateSearch(SerialHistory& history, SerialSearch& search)
+{
+    if (search.text.empty())
+        return;
+
+    // Forget the lines that were dropped from the history
+    auto first_kept = std::lower_bound(
+        search.matches.begin(), search.matches.end(), history.line_offset);
+    search.matches.erase(search.matches.begin(), first_kept);
+
+    u64 line_end  = history.line_offset + history.lines.size();
+    u64 line      = std::max(search.next_line, history.line_offset);
+    u64 stop_line = std::min(line_end, line + search.max_lines_per_frame);
+    for (; line < stop_line; line++)
+    {
+        auto& str = history.lines[line - history.line_offset];
+        if (str.find(search.text) != Str::npos)
+        {
+            search.matches.push_back(line);
+        }
+    }
+    search.next_line = line;
+}
+
+void
+SaveSerialHistory(SerialPort& port)
+{
+    Str name = port.name;
+    for (auto& c : name)
+    {
+        if (!isalnum((u8)c))
+            c = '_';
+    }
+    auto now        = std::chrono::system_clock::now();
+    auto now_time_t = std::chrono::system_clock::to_time_t(now);
+    Path path       = fmt::format("data/serial_{}_{:%Y%m%d_%H%M%S}.txt", name,
+                                  *std::localtime(&now_time_t));
+
+    // Written line by line, the history isn't copied
+    std::ofstream file(path, std::ios::binary);
+    for (auto& line : port.history.lines)
+    {
+        file.write(line.data(), line.size());
+    }
+    file.write(port.history.partial_line.data(),
+               port.history.partial_line.size());
+
+    if (file)
+    {
+        PrintSuccess("Saved {} lines to {}\n", port.history.lines.size(),
+                     path.string());
+    }
+    else
+    {
+        PrintError("Can't write {}\n", path.string());
     }
-    serial_manager = {};
 }
 
 void
 DrawSerial(SerialPort& port)
 {
-    if (!ImGui::BeginTabItem(fmt::format("COM{}", port.name).c_str()))
+    if (!ImGui::BeginTabItem(port.name.c_str()))
         return;
+
+    auto& history = port.history;
+    auto& search  = port.search;
+
+    ImGui::SetNextItemWidth(300);
+    if (ImGui::InputTextWithHint("##SerialSearch", utf8("Rechercher"),
+                                 search.input_buffer.data(),
+                                 search.input_buffer.size()))
+    {
+        search.text = search.input_buffer.data();
+        search.matches.clear();
+        search.next_line = 0;
+    }
+    UpdateSearch(history, search);
+    ImGui::SameLine();
+    if (search.text.size())
+    {
+        ImGui::Text(utf8("%zu lignes"), search.matches.size());
+        ImGui::SameLine();
+    }
+    if (ImGui::Button(utf8("Enregistrer")))
+    {
+        SaveSerialHistory(port);
+    }
+
     // Reserve enough left-over height for 1 separator + 1 input text
     const float footer_height_to_reserve = ImGui::GetFrameHeightWithSpacing();
     ImGui::BeginChild("ScrollingRegion", ImVec2(0, -footer_height_to_reserve));
     ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing,
                         ImVec2(4, 1)); // Tighten spacing
 
-    for (const auto& str : port.history)
+    // Only the visible lines are drawn
+    ImGuiListClipper clipper;
+    if (search.text.size())
+    {
+        clipper.Begin((s32)search.matches.size());
+        while (clipper.Step())
+        {
+            for (s32 i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
+            {
+                auto line = search.matches[i] - history.line_offset;
+                ImGui::TextUnformatted(history.lines[line].data());
+            }
+        }
+    }
+    else
     {
-        ImGui::TextUnformatted(str.data());
+        // The partial line is drawn after the others
+        clipper.Begin((s32)history.lines.size() + 1);
+        while (clipper.Step())
+        {
+            for (s32 i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
+            {
+                if ((u64)i < history.lines.size())
+                    ImGui::TextUnformatted(history.lines[i].data());
+                else
+                    ImGui::TextUnformatted(history.partial_line.data());
+            }
+        }
     }
 
     if (ImGui::GetScrollY() >= ImGui::GetScrollMaxY())
@@ -247,39 +1023,129 @@ DrawSerial(SerialPort& port)
     ImGui::EndTabItem();
 }
 
+SerialPort*
+FindSerialPort(StrPtr name)
+{
+    for (auto& port : serial_manager.ports)
+    {
+        if (port.name == name)
+            return &port;
+    }
+    return nullptr;
+}
+
+bool
+SendSerialPacket(StrPtr port_name, Serializer& s)
+{
+    auto* port = FindSerialPort(port_name);
+    if (!port)
+        return false;
+
+    BufferPtr       buffer = {s.full_buffer.start, s.buffer.start};
+    std::vector<u8> frame(FrameSize(buffer.size()));
+    u32 size = EncodeFrame(buffer.start, buffer.size(), frame.data(),
+                           (u32)frame.size());
+    WriteSerial(*port, StrPtr((char*)frame.data(), size));
+    return true;
+}
+
 void
-UpdateSerial(bool scan_ports)
+SendSerialPacketToAll(Serializer& s)
 {
-    std::erase_if(serial_manager.ports,
-                  [](SerialPort& port) { return port.handle == nullptr; });
+    for (auto& port : serial_manager.ports)
+    {
+        SendSerialPacket(port.name, s);
+    }
+}
 
-    if (scan_ports)
+Message
+ReceiveSerialMessage()
+{
+    Message msg;
+    for (auto& port : serial_manager.ports)
     {
-        CEnumerateSerial::CPortsArray new_ports;
-        if (CEnumerateSerial::UsingQueryDosDevice(new_ports))
         {
-            for (const auto& new_port_name : new_ports)
+            std::lock_guard<std::mutex> lock(port.mutex);
+            if (port.messages_received.empty())
+                continue;
+            serial_manager.message_buffer =
+                std::move(port.messages_received.front());
+            port.messages_received.pop_front();
+        }
+
+        auto&     data   = serial_manager.message_buffer;
+        BufferPtr buffer = {data.data(), (u32)data.size()};
+        msg.deserializer = Serializer(SerializerMode::Deserialize, buffer);
+        msg.header.serialize(msg.deserializer);
+        msg.from.serial_port = port.name;
+        break;
+    }
+    return msg;
+}
+
+void
+UpdateSerial()
+{
+    if (!serial_manager.hotplug_running)
+        return;
+
+    std::erase_if(serial_manager.ports, [](SerialPort& port) {
+        if (port.failed)
+        {
+            PrintWarning("Serial port {} closed\n", port.name);
+            StopSerialPort(port);
+            ForgetSerialPort(port.name);
+            return true;
+        }
+        return false;
+    });
+
+    if (serial_manager.hotplug_failed)
+    {
+        if (serial_manager.hotplug_thread.joinable())
+        {
+            serial_manager.hotplug_thread.join();
+            PrintWarning("No serial hotplug notifications, the ports are "
+                         "listed every second\n");
+        }
+        if (Clock::now() >= serial_manager.next_scan)
+        {
+            serial_manager.next_scan = Clock::now() + Seconds(1);
+            ScanSerialPorts();
+        }
+    }
+
+    std::vector<SerialPortEvent> events;
+    std::vector<Str>             errors;
+    {
+        std::lock_guard<std::mutex> lock(serial_manager.events_mutex);
+        std::swap(events, serial_manager.events);
+        std::swap(errors, serial_manager.errors);
+    }
+    for (auto& error : errors)
+    {
+        PrintError("{}", error);
+    }
+    for (auto& event : events)
+    {
+        auto* port = FindSerialPort(event.name);
+        if (event.type == SerialPortEventType::Added && !port)
+        {
+            PrintSuccess("New serial port {}\n", event.name);
+            auto& new_port = serial_manager.ports.emplace_back();
+            new_port.name  = event.name;
+            if (!StartSerialPort(new_port, 115200))
             {
-                bool found = false;
-                for (auto& old_port : serial_manager.ports)
-                {
-                    if (old_port.name == new_port_name)
-                    {
-                        found = true;
-                        break;
-                    }
-                }
-                if (!found)
-                {
-                    PrintSuccess("New serial port COM{}\n", new_port_name);
-                    serial_manager.ports.push_back(
-                        OpenSerialPort(new_port_name, 115200));
-                }
+                serial_manager.ports.pop_back();
+                ForgetSerialPort(event.name);
             }
         }
-        else
+        else if (event.type == SerialPortEventType::Removed && port)
         {
-            PrintError("CEnumerateSerial::UsingRegistry failed\n");
+            PrintWarning("Serial port {} removed\n", event.name);
+            StopSerialPort(*port);
+            serial_manager.ports.remove_if(
+                [&](SerialPort& p) { return &p == port; });
         }
     }
 
@@ -288,25 +1154,14 @@ UpdateSerial(bool scan_ports)
     {
         for (auto& port : serial_manager.ports)
         {
-            Str read = ReadSerial(port);
-            if (read.size())
             {
-                u64 start    = 0;
-                u64 new_line = std::string::npos;
-                while (true)
+                std::lock_guard<std::mutex> lock(port.mutex);
+                for (auto& line : port.lines_received)
                 {
-                    new_line = read.find_first_of('\n', start);
-                    if (new_line == std::string::npos)
-                    {
-                        port.history.back().append(StrPtr(read).substr(start));
-                        break;
-                    }
-
-                    port.history.back().append(
-                        StrPtr(read).substr(start, new_line - start + 1));
-                    start = new_line + 1;
-                    port.history.emplace_back();
+                    AddHistoryLine(port.history, std::move(line));
                 }
+                port.lines_received.clear();
+                port.history.partial_line = port.partial_line;
             }
 
             DrawSerial(port);
@@ -315,4 +1170,4 @@ UpdateSerial(bool scan_ports)
     }
 
     ImGui::End();
-}
\ No newline at end of file
+}
@@ -1,7 +1,11 @@
 #pragma once
 #include "alias.hpp"
+#include "msg/message_format.hpp"
 
-void ListSerialPorts();
-void InitSerial();
-void TerminateSerial();
-void UpdateSerial(bool scan_ports);
\ No newline at end of file
+void    ListSerialPorts();
+void    InitSerial();
+void    TerminateSerial();
+void    UpdateSerial();
+bool    SendSerialPacket(StrPtr port_name, Serializer& s);
+void    SendSerialPacketToAll(Serializer& s);
+Message ReceiveSerialMessage();
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "server.hpp"
 #include "print.hpp"
 #include "file_io.hpp"
+#include "serial_port.hpp"
 
 #include <Windows.h>
 #include <iphlpapi.h>
@@ -163,6 +164,14 @@ SendPacketMulticast(Server& server, Serializer& s)
 void
 SendPacket(Connection& connection, Serializer& s)
 {
+    if (connection.serial_port.size())
+    {
+        SendSerialPacket(connection.serial_port, s);
+        return;
+    }
+    if (!connection.socket)
+        return;
+
     asio::error_code error;
     BufferPtr        buffer = {s.full_buffer.start, s.buffer.start};
     connection.socket->send_to(
@@ -175,6 +184,59 @@ SendPacket(Connection& connection, Serializer& s)
     }
 }
 
+u64
+ServerMicros()
+{
+    auto now = Clock::now().time_since_epoch();
+    return std::chrono::duration_cast<Duration>(now).count();
+}
+
+Timepoint
+ServerMicrosToTimepoint(u64 server_time)
+{
+    return Timepoint(std::chrono::duration_cast<Clock::duration>(
+        Microseconds((s64)server_time)));
+}
+
+void
+SerializeDiscovery(Serializer& s)
+{
+    Multicast message;
+    StrPtr    str = "Hey it's me, the server.";
+    message.str   = {(u8*)str.data(), (u32)str.size()};
+    message.getHeader().serialize(s);
+    message.serialize(s);
+}
+
+/*
+   The discovery message is sent quickly for some time after a client is lost,
+   a device that reboots is found as soon as it joins the network. It slows
+   down when the burst ends, and more when all the clients are connected.
+*/
+void
+StartDiscoveryBurst(Server& server)
+{
+    server.discovery_burst_end = Clock::now() + discovery_burst_duration;
+    server.next_discovery      = Clock::now();
+}
+
+bool
+IsDiscoveryDue(Server& server, bool all_clients_connected)
+{
+    auto now = Clock::now();
+    if (now < server.next_discovery)
+        return false;
+
+    Duration period = discovery_slow_period;
+    if (!all_clients_connected)
+    {
+        period = (now < server.discovery_burst_end) ? discovery_burst_period :
+                                                      discovery_missing_period;
+    }
+    server.next_discovery = now + period;
+    return true;
+}
+
 Message
 ReceiveMessage(Server& server)
 {
@@ -1,5 +1,6 @@
 #pragma once
 #include "alias.hpp"
+#include "time.hpp"
 #include "msg/message_format.hpp"
 
 #include <asio.hpp>
@@ -7,16 +8,34 @@
 
 constexpr u32 udp_packet_size = 1024;
 
+// Period of the discovery message: during a burst, while a client is missing,
+// and when they are all connected.
+constexpr Duration discovery_burst_period   = Milliseconds(50);
+constexpr Duration discovery_missing_period = Milliseconds(250);
+constexpr Duration discovery_slow_period    = Seconds(2);
+constexpr Duration discovery_burst_duration = Seconds(5);
+
 struct Server
 {
     asio::io_context       io_context;
     std::vector<SocketPtr> sockets;
 
     std::vector<u8> buffer;
+
+    Timepoint next_discovery;
+    Timepoint discovery_burst_end;
 };
 
 bool    InitServer(Server& server);
 void    TerminateServer(Server& server);
 void    SendPacketMulticast(Server& server, Serializer& s);
 void    SendPacket(Connection& connection, Serializer& s);
-Message ReceiveMessage(Server& server);
\ No newline at end of file
+Message ReceiveMessage(Server& server);
+
+// The clock the devices sync to (see msg/clock_sync.hpp), in microseconds
+u64       ServerMicros();
+Timepoint ServerMicrosToTimepoint(u64 server_time);
+
+void SerializeDiscovery(Serializer& s);
+void StartDiscoveryBurst(Server& server);
+bool IsDiscoveryDue(Server& server, bool all_clients_connected);
\ No newline at end of file
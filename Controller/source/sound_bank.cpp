@@ -0,0 +1,418 @@
+#include "sound_bank.hpp"
+#include "file_io.hpp"
+#include "print.hpp"
+#include "random.hpp"
+#include "settings.hpp"
+
+SoundBanks sound_banks;
+
+void
+ListSoundFiles(SoundBank& bank)
+{
+    std::error_code error;
+    for (auto const& dir_entry :
+         std::filesystem::directory_iterator{bank.directory, error})
+    {
+        if (dir_entry.is_regular_file()
+            && dir_entry.path().extension() != ".txt")
+        {
+            SoundBankEntry entry;
+            entry.buffer.path      = dir_entry.path();
+            entry.buffer.streaming = (bank.policy == SoundBankPolicy::Stream);
+            bank.entries.push_back(entry);
+        }
+    }
+    if (error)
+    {
+        PrintError("Can't list sound bank {} ({}): {}\n", bank.name,
+                   bank.directory.string(), error.message());
+    }
+}
+
+/*
+   When the sound is loaded for a play, the bank has to be prefetched again.
+   A prefetch doesn't clear it, or the next prefetch would load what it just
+   unloaded.
+*/
+void
+EvictSounds(SoundBank& bank, const SoundBankEntry* keep, bool prefetch)
+{
+    while (bank.budget && bank.resident_size > bank.budget)
+    {
+        SoundBankEntry* oldest = nullptr;
+        for (auto& entry : bank.entries)
+        {
+            if (!entry.loaded || &entry == keep)
+                continue;
+            if (oldest && oldest->last_used <= entry.last_used)
+                continue;
+            // A buffer can't be deleted while a source plays it.
+            if (IsBufferPlaying(entry.buffer))
+                continue;
+            oldest = &entry;
+        }
+        if (!oldest)
+        {
+            // Everything left is playing, we go over budget for now.
+            break;
+        }
+
+        Print("Unloading {}\n", oldest->buffer.path.string());
+        bank.resident_size -= oldest->buffer.size;
+        DestroyAudioBuffer(oldest->buffer);
+        oldest->buffer.size = 0;
+        oldest->loaded      = false;
+        if (!prefetch)
+            bank.prefetched = false;
+    }
+}
+
+bool
+LoadSoundEntry(SoundBank& bank, SoundBankEntry& entry, bool prefetch = false)
+{
+    if (entry.loaded)
+        return true;
+    if (entry.failed)
+        return false;
+
+    if (bank.policy == SoundBankPolicy::Stream)
+    {
+        // The file is opened when it is played
+        entry.loaded = true;
+        return true;
+    }
+
+    Print("Loading {}\n", entry.buffer.path.string());
+    auto buffer = LoadAudioFile(entry.buffer.path);
+    if (buffer.al_buffer == 0)
+    {
+        entry.failed = true;
+        return false;
+    }
+    entry.buffer = buffer;
+    entry.loaded = true;
+    bank.resident_size += buffer.size;
+
+    EvictSounds(bank, &entry, prefetch);
+    return true;
+}
+
+bool
+LoadSoundBankManifest(const Path& path)
+{
+    Str file = ReadBinaryFile(path);
+    if (file.empty())
+    {
+        PrintError("Can't read sound bank manifest {}\n", path.string());
+        return false;
+    }
+
+    StrPtr str   = file;
+    u64    str_i = 0;
+    while (str_i < str.size())
+    {
+        auto line = ReadLine(str, str_i);
+        u64  i    = 0;
+
+        ReadAllSpaces(line, i);
+        if (i >= line.size() || line[i] == '#')
+            continue;
+
+        StrPtr name;
+        StrPtr directory;
+        StrPtr policy;
+        u64    budget_kb = 0;
+        if (!TryReadWord(line, i, name) || !ReadAllSpaces(line, i)
+            || !TryReadWord(line, i, directory) || !ReadAllSpaces(line, i)
+            || !TryReadWord(line, i, policy))
+        {
+            PrintError("Invalid sound bank: \"{}\"\n", line);
+            continue;
+        }
+        ReadAllSpaces(line, i);
+        TryRead(line, i, budget_kb);
+
+        SoundBank bank;
+        bank.name      = name;
+        bank.directory = directory;
+        bank.budget    = budget_kb * 1024;
+        if (policy == "preload")
+        {
+            bank.policy = SoundBankPolicy::Preload;
+        }
+        else if (policy == "lazy")
+        {
+            bank.policy = SoundBankPolicy::Lazy;
+        }
+        else if (policy == "stream")
+        {
+            bank.policy = SoundBankPolicy::Stream;
+        }
+        else
+        {
+            PrintError("Unknown sound bank policy \"{}\" for {}\n", policy,
+                       name);
+            continue;
+        }
+
+        auto& new_bank = sound_banks.banks.emplace_back(std::move(bank));
+        ListSoundFiles(new_bank);
+        Print("Sound bank {}: {} files\n", new_bank.name,
+              new_bank.entries.size());
+
+        if (new_bank.policy == SoundBankPolicy::Preload)
+        {
+            for (auto& entry : new_bank.entries)
+            {
+                LoadSoundEntry(new_bank, entry);
+            }
+            new_bank.prefetched = true;
+        }
+    }
+    return true;
+}
+
+void
+TerminateSoundBanks()
+{
+    for (auto& bank : sound_banks.banks)
+    {
+        for (auto& entry : bank.entries)
+        {
+            DestroyAudioBuffer(entry.buffer);
+        }
+    }
+    sound_banks = {};
+}
+
+SoundBank&
+GetSoundBank(StrPtr name)
+{
+    for (auto& bank : sound_banks.banks)
+    {
+        if (bank.name == name)
+            return bank;
+    }
+
+    PrintWarning("Sound bank {} is not in the manifest\n", name);
+    auto& bank     = sound_banks.banks.emplace_back();
+    bank.name      = name;
+    bank.directory = Path("data") / name;
+    bank.policy    = SoundBankPolicy::Lazy;
+    ListSoundFiles(bank);
+    return bank;
+}
+
+void
+QueueSoundEntry(SoundBank& bank, u32 index, bool requested)
+{
+    auto& queue = sound_banks.load_queue;
+    auto& entry = bank.entries[index];
+    if (entry.queued)
+    {
+        if (!requested)
+            return;
+        for (u64 i = 0; i < queue.size(); i++)
+        {
+            if (queue[i].bank == &bank && queue[i].index == index)
+            {
+                queue.erase(queue.begin() + i);
+                break;
+            }
+        }
+    }
+    entry.queued = true;
+
+    SoundLoad load;
+    load.bank      = &bank;
+    load.index     = index;
+    load.requested = requested;
+    if (requested)
+    {
+        // Before the prefetches
+        queue.insert(queue.begin(), load);
+    }
+    else
+    {
+        queue.push_back(load);
+    }
+}
+
+void
+PrefetchSoundBank(SoundBank& bank)
+{
+    if (bank.prefetched)
+        return;
+    bank.prefetched = true;
+
+    for (u32 i = 0; i < bank.entries.size(); i++)
+    {
+        auto& entry = bank.entries[i];
+        if (!entry.loaded && !entry.failed)
+            QueueSoundEntry(bank, i, false);
+    }
+}
+
+void
+PrefetchSoundEntry(SoundBank& bank, u32 index)
+{
+    if (index >= bank.entries.size())
+        return;
+    auto& entry = bank.entries[index];
+    // The most recently used, it isn't unloaded before it is played
+    entry.last_used = ++sound_banks.use_counter;
+    if (!entry.loaded && !entry.failed)
+        QueueSoundEntry(bank, index, true);
+}
+
+void
+PlayPendingSounds(SoundBank& bank, u32 index)
+{
+    auto& pending = sound_banks.pending_plays;
+    auto  now     = Clock::now();
+    for (u64 i = 0; i < pending.size();)
+    {
+        auto& play = *pending[i];
+        if (play.bank != &bank || play.index != index)
+        {
+            i++;
+            continue;
+        }
+        auto& entry = bank.entries[index];
+        if (!play.cancelled && entry.loaded
+            && now - play.time_requested <= max_pending_sound_delay)
+        {
+            play.playing = PlayAudio(entry.buffer, play.settings);
+        }
+        play.started = true;
+        pending.erase(pending.begin() + i);
+    }
+}
+
+void
+UpdateSoundBanks()
+{
+    // We only load one file per frame so prefetching doesn't freeze the UI.
+    auto& queue = sound_banks.load_queue;
+    while (queue.size())
+    {
+        auto load = queue.front();
+        queue.erase(queue.begin());
+
+        auto& bank   = *load.bank;
+        auto& entry  = bank.entries[load.index];
+        entry.queued = false;
+        if (entry.loaded || entry.failed)
+        {
+            PlayPendingSounds(bank, load.index);
+            continue;
+        }
+        // A prefetch would only unload another sound of the bank, and the
+        // next prefetch would load it again.
+        if (!load.requested && bank.budget
+            && bank.resident_size >= bank.budget)
+        {
+            continue;
+        }
+
+        // Prefetched sounds are the oldest ones, they are unloaded first if
+        // they are never played.
+        LoadSoundEntry(bank, entry, !load.requested);
+        PlayPendingSounds(bank, load.index);
+        break;
+    }
+}
+
+const AudioBuffer*
+GetBankSound(SoundBank& bank, u32 index)
+{
+    if (index >= bank.entries.size())
+        return nullptr;
+
+    auto& entry     = bank.entries[index];
+    entry.last_used = ++sound_banks.use_counter;
+    if (!LoadSoundEntry(bank, entry))
+        return nullptr;
+
+    return &entry.buffer;
+}
+
+AudioPlaying
+PlayBankSound(SoundBank& bank, u32 index, AudioSettings s)
+{
+    auto* buffer = GetBankSound(bank, index);
+    if (!buffer)
+        return {};
+    return PlayAudio(*buffer, s);
+}
+
+BankSoundPlaying
+PlayRandomBankSound(SoundBank& bank, AudioSettings s)
+{
+    BankSoundPlaying result;
+    if (bank.entries.empty())
+        return result;
+    u32   rand_index = Random((u32)bank.entries.size() - 1);
+    auto& entry      = bank.entries[rand_index];
+    if (entry.loaded || entry.failed)
+    {
+        result.playing = PlayBankSound(bank, rand_index, s);
+        return result;
+    }
+
+    // Loading the file now would stall the frame. It is loaded in the
+    // background and we play one of the loaded sounds instead.
+    QueueSoundEntry(bank, rand_index, true);
+    u32 loaded_count = 0;
+    for (auto& e : bank.entries)
+    {
+        if (e.loaded)
+            loaded_count++;
+    }
+    if (!loaded_count)
+    {
+        auto pending            = std::make_shared<PendingSoundPlay>();
+        pending->bank           = &bank;
+        pending->index          = rand_index;
+        pending->settings       = s;
+        pending->time_requested = Clock::now();
+        sound_banks.pending_plays.push_back(pending);
+        entry.last_used = ++sound_banks.use_counter;
+        result.pending  = pending;
+        return result;
+    }
+    u32 loaded_index = Random(loaded_count - 1);
+    for (u32 i = 0; i < bank.entries.size(); i++)
+    {
+        if (bank.entries[i].loaded && loaded_index-- == 0)
+        {
+            result.playing = PlayBankSound(bank, i, s);
+            break;
+        }
+    }
+    return result;
+}
+
+void
+StopAudio(BankSoundPlaying& playing)
+{
+    StopAudio(playing.playing);
+    if (playing.pending)
+    {
+        // Removed from the pending plays when its file is loaded
+        playing.pending->cancelled = true;
+        StopAudio(playing.pending->playing);
+        playing.pending = nullptr;
+    }
+}
+
+bool
+IsPlaying(const BankSoundPlaying& playing)
+{
+    if (playing.pending)
+    {
+        return !playing.pending->started
+               || IsPlaying(playing.pending->playing);
+    }
+    return IsPlaying(playing.playing);
+}
\ No newline at end of file
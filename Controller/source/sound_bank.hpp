@@ -0,0 +1,126 @@
+#pragma once
+#include "alias.hpp"
+#include "audio.hpp"
+#include "time.hpp"
+
+#include <deque>
+#include <memory>
+
+/*
+   A SoundBank is a directory of sound files declared in the sound bank
+   manifest (data/sound_banks.txt). Each line of the manifest is:
+     name directory policy budget_kb
+   Lines starting with # are ignored.
+
+   The files of a bank are listed when the manifest is read but they are only
+   decoded when they are first played or when the bank is prefetched. When a
+   bank has a budget, the least recently used buffers are unloaded to stay
+   under it.
+*/
+enum class SoundBankPolicy
+{
+    Preload, // Decoded when the manifest is read
+    Lazy,    // Decoded on first use or when prefetched
+    Stream,  // Never decoded in memory, streamed from the disk when played
+};
+
+struct SoundBankEntry
+{
+    SoundBankEntry() {}
+    AudioBuffer buffer;
+
+    bool loaded    = false;
+    bool failed    = false; // Don't try to load a broken file again
+    bool queued    = false; // Waiting in the prefetch queue
+    u64  last_used = 0;
+};
+
+struct SoundBank
+{
+    SoundBank() {}
+    Str             name;
+    Path            directory;
+    SoundBankPolicy policy = SoundBankPolicy::Lazy;
+    u64             budget = 0; // In bytes, 0 means no limit
+
+    u64 resident_size = 0;
+    // Cleared when a sound is unloaded to play another one, the next
+    // prefetch loads it again
+    bool prefetched = false;
+
+    std::vector<SoundBankEntry> entries;
+};
+
+struct SoundLoad
+{
+    SoundBank* bank  = nullptr;
+    u32        index = 0;
+    // Asked for by a play, loaded first and even when the bank is full
+    bool requested = false;
+};
+
+// A sound played before it was loaded, it starts once it is
+struct PendingSoundPlay
+{
+    PendingSoundPlay() {}
+    SoundBank*    bank  = nullptr;
+    u32           index = 0;
+    AudioSettings settings;
+    Timepoint     time_requested;
+
+    bool         started   = false;
+    bool         cancelled = false;
+    AudioPlaying playing; // Once started
+};
+
+// Later than this the sound isn't relevant anymore, it isn't played
+constexpr Duration max_pending_sound_delay = Milliseconds(500);
+
+/*
+   BankSoundPlaying is a handle to a sound of a bank. When the sound has to
+   wait for its file, pending is filled in when it starts, and the sound can
+   be stopped before.
+*/
+struct BankSoundPlaying
+{
+    BankSoundPlaying() {}
+    AudioPlaying                      playing;
+    std::shared_ptr<PendingSoundPlay> pending;
+};
+
+struct SoundBanks
+{
+    // std::deque doesn't move the banks when adding new ones, so we can keep
+    // references to them.
+    std::deque<SoundBank> banks;
+
+    std::vector<SoundLoad>                         load_queue;
+    std::vector<std::shared_ptr<PendingSoundPlay>> pending_plays;
+    u64                                            use_counter = 0;
+};
+
+extern SoundBanks sound_banks;
+
+bool LoadSoundBankManifest(const Path& path);
+void TerminateSoundBanks();
+
+// Returns the bank with this name. If the manifest doesn't have it, a lazy bank
+// using the directory data/<name>/ is created.
+SoundBank& GetSoundBank(StrPtr name);
+
+// Loads the whole bank in the background, one file per UpdateSoundBanks(),
+// until the bank is at its budget.
+void PrefetchSoundBank(SoundBank& bank);
+// Loads this sound in the background, before the other prefetches
+void PrefetchSoundEntry(SoundBank& bank, u32 index);
+void UpdateSoundBanks();
+
+const AudioBuffer* GetBankSound(SoundBank& bank, u32 index);
+AudioPlaying       PlayBankSound(SoundBank& bank, u32 index,
+                                 AudioSettings s = {});
+// Never loads a file: when the sound isn't loaded, another loaded sound of the
+// bank is played, or it is played by UpdateSoundBanks() once it is loaded.
+BankSoundPlaying PlayRandomBankSound(SoundBank& bank, AudioSettings s = {});
+// A sound waiting for its file is playing, and stopping it cancels it
+void             StopAudio(BankSoundPlaying& playing);
+bool             IsPlaying(const BankSoundPlaying& playing);
\ No newline at end of file
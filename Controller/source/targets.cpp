@@ -3,160 +3,20 @@
 #include "scope_exit.hpp"
 #include "random.hpp"
 #include "server.hpp"
-#include "settings.hpp"
 
 #include <imgui.h>
 
 bool SelectableButton(const char* name, bool selected);
 
-Targets::Targets()
+Duration
+AmbientSoundDelay(s32 sound_probability)
 {
-    // Loading all sound files
-    for (auto const& dir_entry :
-         std::filesystem::directory_iterator{"data/orc/"})
-    {
-        if (dir_entry.is_regular_file()
-            && dir_entry.path().extension() != ".txt")
-        {
-            Print("Loading {}\n", dir_entry.path().string());
-            auto audio_buff = LoadAudioFile(dir_entry.path());
-            if (audio_buff.al_buffer != 0)
-                orcs.push_back(audio_buff);
-        }
-    }
-
-    for (auto const& dir_entry :
-         std::filesystem::directory_iterator{"data/orc_death/"})
-    {
-        if (dir_entry.is_regular_file()
-            && dir_entry.path().extension() != ".txt")
-        {
-            Print("Loading {}\n", dir_entry.path().string());
-            auto audio_buff = LoadAudioFile(dir_entry.path());
-            if (audio_buff.al_buffer != 0)
-                orc_deaths.push_back(audio_buff);
-        }
-    }
-
-    for (auto const& dir_entry :
-         std::filesystem::directory_iterator{"data/orc_hurt/"})
-    {
-        if (dir_entry.is_regular_file()
-            && dir_entry.path().extension() != ".txt")
-        {
-            Print("Loading {}\n", dir_entry.path().string());
-            auto audio_buff = LoadAudioFile(dir_entry.path());
-            if (audio_buff.al_buffer != 0)
-                orc_hurts.push_back(audio_buff);
-        }
-    }
-
-    for (auto const& dir_entry :
-         std::filesystem::directory_iterator{"data/orc_mad/"})
-    {
-        if (dir_entry.is_regular_file()
-            && dir_entry.path().extension() != ".txt")
-        {
-            Print("Loading {}\n", dir_entry.path().string());
-            auto audio_buff = LoadAudioFile(dir_entry.path());
-            if (audio_buff.al_buffer != 0)
-                orc_mads.push_back(audio_buff);
-        }
-    }
-
-    LoadSettingValue("targets.gain_global", gain_global);
-    LoadSettingValue("targets.gain_orcs", gain_orcs);
-    LoadSettingValue("targets.gain_orcs_hurt", gain_orcs_hurt);
-    LoadSettingValue("targets.min_time_between_sounds",
-                     min_time_between_sounds);
-    LoadSettingValue("targets.sound_probability", sound_probability);
-}
-
-Targets::~Targets()
-{
-    SaveSettingValue("targets.gain_global", gain_global);
-    SaveSettingValue("targets.gain_orcs", gain_orcs);
-    SaveSettingValue("targets.gain_orcs_hurt", gain_orcs_hurt);
-    SaveSettingValue("targets.min_time_between_sounds",
-                     min_time_between_sounds);
-    SaveSettingValue("targets.sound_probability", sound_probability);
-
-    for (auto& sound : orcs)
-        DestroyAudioBuffer(sound);
-    for (auto& sound : orc_deaths)
-        DestroyAudioBuffer(sound);
-    for (auto& sound : orc_hurts)
-        DestroyAudioBuffer(sound);
-    for (auto& sound : orc_mads)
-        DestroyAudioBuffer(sound);
-}
-
-void
-Targets::receiveMessage(Client& client, const TargetsStatus& msg, bool print)
-{
-    if (print)
-    {
-        Print("   TargetsStatus:\n");
-        Print("   Enabled {}\n", msg.enabled);
-        u32 i = 0;
-        for (auto& h : msg.hitpoints)
-        {
-            Print("   - Target {} ({}): {} hp\n", i,
-                  (msg.enabled & (1 << i)) ? "Enabled" : "Disabled", h);
-            i++;
-        }
-    }
-    last_status = msg;
-
-    for (u32 i = 0; i < target_count; i++)
-    {
-        if (command.hitpoints[i] > last_status.hitpoints[i]
-            && command.hitpoints[i] > 0 && gain_global > 0)
-        {
-            if (last_status.hitpoints[i] <= 0)
-            {
-                StopAudio(sound_playing[i]);
-                u32 rand_index   = Random(orc_deaths.size() - 1);
-                sound_playing[i] = PlayAudio(
-                    orc_deaths[rand_index],
-                    Gain(gain_orcs_hurt / 100.f * gain_global / 100.f)
-                        * Pitch(Random(orc_pitch_min, orc_pitch_max)));
-            }
-            else
-            {
-                StopAudio(sound_playing[i]);
-                u32 rand_index   = Random(orc_hurts.size() - 1);
-                sound_playing[i] = PlayAudio(
-                    orc_hurts[rand_index],
-                    Gain(gain_orcs_hurt / 100.f * gain_global / 100.f)
-                        * Pitch(Random(orc_pitch_min, orc_pitch_max)));
-            }
-        }
-
-        command.hitpoints[i] = last_status.hitpoints[i];
-
-        if (command.set_hitpoints[i] == last_status.hitpoints[i])
-        {
-            // We set the command to -1 only when we received a status
-            // with the right hitpoint value.
-            command.set_hitpoints[i] = -1;
-        }
-    }
-
-    if (msg.ask_for_ack)
-    {
-        command.ask_for_ack      = false;
-        client.time_command_sent = Clock::now();
-
-        std::vector<u8> buffer(udp_packet_size);
-        Serializer      serializer(SerializerMode::Serialize,
-                                   {buffer.data(), (u32)buffer.size()});
-
-        command.getHeader().serialize(serializer);
-        command.serialize(serializer);
-
-        SendPacket(client.connection, serializer);
-    }
+    // sound_probability used to be the chance to play a sound at each frame,
+    // at 60 fps. The delays are drawn so that the average stays the same
+    // whatever the frame rate.
+    constexpr f32 reference_frame_rate = 60.f;
+    f32 seconds = RandomExponential(sound_probability / reference_frame_rate);
+    return Microseconds((s64)(seconds * 1'000'000.f));
 }
 
 s8
@@ -211,15 +71,15 @@ Targets::update(Client& client)
         if (ImGui::Checkbox(utf8("Activer la detection"), &enable))
         {
             if (enable)
-                command.enable = U8_MAX;
+                command.enable = all_targets;
             else
                 command.enable = 0;
         }
 
-        for (u32 i = 0; i < target_count; i++)
+        for (u32 i = 0; i < last_status.count; i++)
         {
             ImGui::Separator();
-            bool enabled = command.enable & (1 << i);
+            bool enabled = command.enable & ((TargetMask)1 << i);
             auto hp      = DrawOrc(i, enabled, command.set_hitpoints[i],
                                    last_status.hitpoints[i]);
             if (hp >= 0)
@@ -280,8 +140,14 @@ Targets::update(Client& client)
         ImGui::Separator();
         ImGui::SliderInt(utf8("Temps mini entre cris (ms)"),
                          &min_time_between_sounds, 0, 1000);
-        ImGui::SliderInt(utf8("Proba. cris (1/valeur)"), &sound_probability, 1,
-                         1000);
+        if (ImGui::SliderInt(utf8("Proba. cris (1/valeur)"),
+                             &sound_probability, 1, 1000))
+        {
+            for (auto& next : next_ambient_sound)
+            {
+                next = {};
+            }
+        }
 
         if (ImGui::CollapsingHeader(utf8("Boutons de sons")))
         {
@@ -312,9 +178,8 @@ Targets::update(Client& client)
             ImGui::BeginDisabled(gain_orcs == 0 || gain_global == 0);
             if (ImGui::Button(utf8("Orque!")))
             {
-                u32  rand_index = Random(orcs.size() - 1);
-                auto player     = PlayAudio(
-                    orcs[rand_index],
+                PlayRandomBankSound(
+                    *orcs,
                     Gain(gain_orcs / 100.f * gain_global / 100.f)
                         * Pitch(Random(orc_pitch_min, orc_pitch_max)));
             }
@@ -323,9 +188,8 @@ Targets::update(Client& client)
             ImGui::BeginDisabled(gain_orcs_hurt == 0 || gain_global == 0);
             if (ImGui::Button(utf8("Orque blessé!")))
             {
-                u32  rand_index = Random(orc_hurts.size() - 1);
-                auto player     = PlayAudio(
-                    orc_hurts[rand_index],
+                PlayRandomBankSound(
+                    *orc_hurts,
                     Gain(gain_orcs_hurt / 100.f * gain_global / 100.f)
                         * Pitch(Random(orc_pitch_min, orc_pitch_max)));
             }
@@ -334,9 +198,8 @@ Targets::update(Client& client)
             ImGui::BeginDisabled(gain_orcs == 0 || gain_global == 0);
             if (ImGui::Button(utf8("Orque enervé!")))
             {
-                u32  rand_index = Random(orc_mads.size() - 1);
-                auto player     = PlayAudio(
-                    orc_mads[rand_index],
+                PlayRandomBankSound(
+                    *orc_mads,
                     Gain(gain_orcs / 100.f * gain_global / 100.f)
                         * Pitch(Random(orc_pitch_min, orc_pitch_max)));
             }
@@ -345,9 +208,8 @@ Targets::update(Client& client)
             ImGui::BeginDisabled(gain_orcs_hurt == 0 || gain_global == 0);
             if (ImGui::Button(utf8("Orque mort!")))
             {
-                u32  rand_index = Random(orc_deaths.size() - 1);
-                auto player     = PlayAudio(
-                    orc_deaths[rand_index],
+                PlayRandomBankSound(
+                    *orc_deaths,
                     Gain(gain_orcs_hurt / 100.f * gain_global / 100.f)
                         * Pitch(Random(orc_pitch_min, orc_pitch_max)));
             }
@@ -355,29 +217,57 @@ Targets::update(Client& client)
         }
     }
     ImGui::End();
-    if (Clock::now() > time_last_sound + Milliseconds(min_time_between_sounds))
+
+    // Prefetch hints: the sounds we are about to need are loaded before they
+    // are played.
+    if (command.enable && gain_global > 0)
     {
-        for (u32 i = 0; i < target_count; i++)
+        PrefetchSoundBank(*orcs);
+        PrefetchSoundBank(*orc_hurts);
+        for (u32 i = 0; i < last_status.count; i++)
         {
-            bool enabled = command.enable & (1 << i);
-            if (command.hitpoints[i] > 0 && enabled && gain_global > 0)
+            if (command.hitpoints[i] > 0 && command.hitpoints[i] <= 2)
             {
-                if (!IsPlaying(sound_playing[i]))
-                {
-                    if (Random(1.f) < 1.f / sound_probability)
-                    {
-                        time_last_sound  = Clock::now();
-                        u32 rand_index   = Random(orcs.size() - 1);
-                        sound_playing[i] = PlayAudio(
-                            orcs[rand_index],
-                            Gain(gain_orcs / 100.f * gain_global / 100.f)
-                                * Pitch(Random(orc_pitch_min, orc_pitch_max)));
-                    }
-                }
+                PrefetchSoundBank(*orc_deaths);
+                break;
             }
         }
     }
 
+    // Each orc has the time of its next sound, drawn when the previous one is
+    // due. Nothing is drawn between two sounds.
+    auto now = Clock::now();
+    for (u32 i = 0; i < last_status.count; i++)
+    {
+        auto& next    = next_ambient_sound[i];
+        bool  enabled = command.enable & ((TargetMask)1 << i);
+        if (command.hitpoints[i] <= 0 || !enabled || gain_global <= 0)
+        {
+            next = {};
+            continue;
+        }
+        if (next == Timepoint{})
+        {
+            next = now + AmbientSoundDelay(sound_probability);
+            continue;
+        }
+        if (now < next)
+        {
+            continue;
+        }
+
+        next = now + AmbientSoundDelay(sound_probability);
+        if (now > time_last_sound + Milliseconds(min_time_between_sounds)
+            && !IsPlaying(sound_playing[i]))
+        {
+            time_last_sound  = now;
+            sound_playing[i] = PlayRandomBankSound(
+                *orcs,
+                Gain(gain_orcs / 100.f * gain_global / 100.f)
+                    * Pitch(Random(orc_pitch_min, orc_pitch_max)));
+        }
+    }
+
     bool need_update = false;
     if (command.enable != last_status.enabled)
     {
@@ -391,7 +281,7 @@ Targets::update(Client& client)
     {
         need_update = true;
     }
-    for (u32 i = 0; i < target_count; i++)
+    for (u32 i = 0; i < last_status.count; i++)
     {
         if (command.set_hitpoints[i] >= 0
             && command.set_hitpoints[i] != last_status.hitpoints[i])
@@ -400,7 +290,7 @@ Targets::update(Client& client)
         }
     }
 
-    if (client.connection.socket)
+    if (client.canSend())
     {
         if (need_update || client.heartbeatTimeout())
         {
@@ -416,7 +306,7 @@ Targets::update(Client& client)
                 command.getHeader().serialize(serializer);
                 command.serialize(serializer);
 
-                SendPacket(client.connection, serializer);
+                SendPacket(client.link(), serializer);
             }
         }
     }
@@ -1,8 +1,10 @@
 #pragma once
 #include "alias.hpp"
 #include "client.hpp"
+#include "server.hpp"
 #include "msg/message_targets.hpp"
 #include "audio.hpp"
+#include "sound_bank.hpp"
 
 constexpr f32 orc_pitch_min = 0.7f;
 constexpr f32 orc_pitch_max = 1.2f;
@@ -12,23 +14,27 @@ struct Targets
     Targets();
     ~Targets();
     void receiveMessage(Client& client, const TargetsStatus& msg, bool print);
+    // Deserializes a TargetsStatus received by the server
+    void receiveStatus(Client& client, Message& message, bool print);
     void update(Client& client);
 
     TargetsCommand command;
     TargetsStatus  last_status;
 
-    AudioPlaying sound_playing[target_count];
-    Timepoint    time_last_sound;
+    BankSoundPlaying sound_playing[max_target_count];
+    Timepoint        time_last_sound;
+    Timepoint        next_ambient_sound[max_target_count] = {};
 
-    std::vector<AudioBuffer> orcs;
-    std::vector<AudioBuffer> orc_deaths;
-    std::vector<AudioBuffer> orc_hurts;
-    std::vector<AudioBuffer> orc_mads;
+    SoundBank* orcs       = nullptr;
+    SoundBank* orc_deaths = nullptr;
+    SoundBank* orc_hurts  = nullptr;
+    SoundBank* orc_mads   = nullptr;
 
     s32 gain_global    = 0;
     s32 gain_orcs      = 70;
     s32 gain_orcs_hurt = 100; // For hurt and death sounds
 
     s32 min_time_between_sounds = 700;
-    s32 sound_probability       = 200;
+    // An orc makes a sound every sound_probability/60 seconds on average
+    s32 sound_probability = 200;
 };
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include "targets.hpp"
+#include "latency.hpp"
+#include "print.hpp"
+#include "random.hpp"
+#include "server.hpp"
+#include "settings.hpp"
+
+/*
+   The part of Targets that turns a status received from the board into the
+   sounds of the orcs, without the UI. latency_test links it with the sound
+   banks and the server only, see CMakeLists.txt.
+*/
+
+Targets::Targets()
+{
+    // The sound files are loaded by the sound banks
+    orcs       = &GetSoundBank("orc");
+    orc_deaths = &GetSoundBank("orc_death");
+    orc_hurts  = &GetSoundBank("orc_hurt");
+    orc_mads   = &GetSoundBank("orc_mad");
+
+    LoadSettingValue("targets.gain_global", gain_global);
+    LoadSettingValue("targets.gain_orcs", gain_orcs);
+    LoadSettingValue("targets.gain_orcs_hurt", gain_orcs_hurt);
+    LoadSettingValue("targets.min_time_between_sounds",
+                     min_time_between_sounds);
+    LoadSettingValue("targets.sound_probability", sound_probability);
+}
+
+Targets::~Targets()
+{
+    SaveSettingValue("targets.gain_global", gain_global);
+    SaveSettingValue("targets.gain_orcs", gain_orcs);
+    SaveSettingValue("targets.gain_orcs_hurt", gain_orcs_hurt);
+    SaveSettingValue("targets.min_time_between_sounds",
+                     min_time_between_sounds);
+    SaveSettingValue("targets.sound_probability", sound_probability);
+}
+
+void
+Targets::receiveMessage(Client& client, const TargetsStatus& msg, bool print)
+{
+    MarkLatency(LatencyStage::Dispatched);
+
+    if (print)
+    {
+        Print("   TargetsStatus:\n");
+        Print("   Enabled {}\n", msg.enabled);
+        for (u32 i = 0; i < msg.count; i++)
+        {
+            Print("   - Target {} ({}): {} hp\n", i,
+                  (msg.enabled & ((TargetMask)1 << i)) ? "Enabled" : "Disabled",
+                  msg.hitpoints[i]);
+        }
+    }
+    last_status = msg;
+    // The commands only carry the targets of the board
+    command.count = msg.count;
+
+    for (u32 i = 0; i < last_status.count; i++)
+    {
+        if (command.hitpoints[i] > last_status.hitpoints[i]
+            && command.hitpoints[i] > 0 && gain_global > 0)
+        {
+            if (last_status.hitpoints[i] <= 0)
+            {
+                StopAudio(sound_playing[i]);
+                sound_playing[i] = PlayRandomBankSound(
+                    *orc_deaths,
+                    Gain(gain_orcs_hurt / 100.f * gain_global / 100.f)
+                        * Pitch(Random(orc_pitch_min, orc_pitch_max)));
+            }
+            else
+            {
+                StopAudio(sound_playing[i]);
+                sound_playing[i] = PlayRandomBankSound(
+                    *orc_hurts,
+                    Gain(gain_orcs_hurt / 100.f * gain_global / 100.f)
+                        * Pitch(Random(orc_pitch_min, orc_pitch_max)));
+            }
+            // Not when the sound waits for its file, or no source was free
+            if (IsPlaying(sound_playing[i].playing))
+                MarkLatency(LatencyStage::Played);
+        }
+
+        command.hitpoints[i] = last_status.hitpoints[i];
+
+        if (command.set_hitpoints[i] == last_status.hitpoints[i])
+        {
+            // We set the command to -1 only when we received a status
+            // with the right hitpoint value.
+            command.set_hitpoints[i] = -1;
+        }
+    }
+
+    if (msg.ask_for_ack)
+    {
+        command.ask_for_ack      = false;
+        client.time_command_sent = Clock::now();
+
+        std::vector<u8> buffer(udp_packet_size);
+        Serializer      serializer(SerializerMode::Serialize,
+                                   {buffer.data(), (u32)buffer.size()});
+
+        command.getHeader().serialize(serializer);
+        command.serialize(serializer);
+
+        SendPacket(client.link(), serializer);
+    }
+}
+
+void
+Targets::receiveStatus(Client& client, Message& message, bool print)
+{
+    TargetsStatus msg;
+    msg.serialize(message.deserializer);
+
+    Timepoint hit;
+    if (msg.hit_time && msg.hit_time != last_status.hit_time)
+    {
+        // Sent by a target that has synced its clock
+        hit = ServerMicrosToTimepoint(msg.hit_time);
+    }
+    BeginLatencyTrace(hit);
+    receiveMessage(client, msg, print);
+}
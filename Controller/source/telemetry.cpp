@@ -0,0 +1,140 @@
+#include "telemetry.hpp"
+#include "print.hpp"
+
+#include <imgui.h>
+#include <implot.h>
+
+DeviceTelemetry device_telemetry[(u64)ClientId::IdMax];
+Timepoint       telemetry_start = Clock::now();
+
+// esp_reset_reason_t
+const char* reset_reason_names[] = {
+    "Unknown", "PowerOn", "External",  "Software", "Panic", "IntWdt",
+    "TaskWdt", "Wdt",     "DeepSleep", "Brownout", "Sdio",
+};
+
+const char*
+ResetReasonName(u8 reset_reason)
+{
+    if (reset_reason >= StaticArraySize(reset_reason_names))
+        return "?";
+    return reset_reason_names[reset_reason];
+}
+
+void
+ReceiveTelemetry(ClientId client_id, const char* client_name,
+                 const Telemetry& telemetry)
+{
+    if ((u64)client_id >= (u64)ClientId::IdMax)
+        return;
+    auto& device = device_telemetry[(u64)client_id];
+
+    if (device.sample_count && telemetry.uptime < device.last.uptime)
+    {
+        PrintWarning("{} restarted, reset reason: {}\n", client_name,
+                     ResetReasonName(telemetry.reset_reason));
+    }
+    else if (device.sample_count
+             && telemetry.samples_dropped > device.last.samples_dropped)
+    {
+        PrintWarning("{} dropped {} sensor samples\n", client_name,
+                     telemetry.samples_dropped - device.last.samples_dropped);
+    }
+    device.last               = telemetry;
+    device.time_last_received = Clock::now();
+
+    u32 i = (device.sample_offset + device.sample_count)
+            % device.max_sample_count;
+    if (device.sample_count < device.max_sample_count)
+        device.sample_count++;
+    else
+        device.sample_offset = (device.sample_offset + 1)
+                               % device.max_sample_count;
+
+    using SecondsFloat = std::chrono::duration<f32>;
+    auto elapsed       = Clock::now() - telemetry_start;
+    device.times[i] = std::chrono::duration_cast<SecondsFloat>(elapsed).count();
+    device.loop_time_min[i]      = telemetry.loop_time_min / 1000.f;
+    device.loop_time_avg[i]      = telemetry.loop_time_avg / 1000.f;
+    device.loop_time_max[i]      = telemetry.loop_time_max / 1000.f;
+    device.free_heap[i]          = telemetry.free_heap / 1024.f;
+    device.largest_free_block[i] = telemetry.largest_free_block / 1024.f;
+    device.rssi[i]               = telemetry.rssi;
+}
+
+void
+PlotRing(const char* name, DeviceTelemetry& device, const f32* values)
+{
+    ImPlot::PlotLine(name, device.times, values, device.sample_count, 0,
+                     device.sample_offset);
+}
+
+void
+DrawTelemetry(const char** client_names)
+{
+    if (ImGui::Begin(utf8("Télémétrie")))
+    {
+        for (u32 i = 0; i < (u32)ClientId::IdMax; i++)
+        {
+            auto& device = device_telemetry[i];
+            if (!device.sample_count)
+                continue;
+
+            ImGui::PushID(i);
+            if (ImGui::CollapsingHeader(client_names[i]))
+            {
+                auto& last = device.last;
+                ImGui::Text(utf8("Allumé depuis %u s, redémarrage: %s"),
+                            last.uptime / 1000,
+                            ResetReasonName(last.reset_reason));
+                ImGui::Text(utf8("Paquets envoyés: %u, reçus: %u"),
+                            last.packets_sent, last.packets_received);
+                ImGui::Text(utf8("Paquets trop grands ignorés: %u"),
+                            last.packets_dropped);
+                ImGui::Text(utf8("Échantillons de capteurs perdus: %u"),
+                            last.samples_dropped);
+                if (last.clock_round_trip)
+                {
+                    ImGui::Text(utf8("Horloge synchronisée à %.1f ms près"),
+                                last.clock_round_trip / 2000.f);
+                }
+                else
+                {
+                    ImGui::Text(utf8("Horloge non synchronisée"));
+                }
+
+                if (ImPlot::BeginPlot(utf8("Boucle (ms)"), {-1, 200}))
+                {
+                    ImPlot::SetupAxes(nullptr, nullptr,
+                                      ImPlotAxisFlags_AutoFit,
+                                      ImPlotAxisFlags_AutoFit);
+                    PlotRing("min", device, device.loop_time_min);
+                    PlotRing("moyenne", device, device.loop_time_avg);
+                    PlotRing("max", device, device.loop_time_max);
+                    ImPlot::EndPlot();
+                }
+                if (ImPlot::BeginPlot(utf8("Mémoire (ko)"), {-1, 200}))
+                {
+                    ImPlot::SetupAxes(nullptr, nullptr,
+                                      ImPlotAxisFlags_AutoFit,
+                                      ImPlotAxisFlags_AutoFit);
+                    PlotRing("libre", device, device.free_heap);
+                    PlotRing("plus grand bloc", device,
+                             device.largest_free_block);
+                    ImPlot::EndPlot();
+                }
+                if (last.rssi
+                    && ImPlot::BeginPlot(utf8("RSSI (dBm)"), {-1, 200}))
+                {
+                    ImPlot::SetupAxes(nullptr, nullptr,
+                                      ImPlotAxisFlags_AutoFit,
+                                      ImPlotAxisFlags_AutoFit);
+                    PlotRing("RSSI", device, device.rssi);
+                    ImPlot::EndPlot();
+                }
+            }
+            ImGui::PopID();
+        }
+    }
+    ImGui::End();
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "alias.hpp"
+#include "time.hpp"
+#include "msg/message_telemetry.hpp"
+
+/*
+   The telemetry of each device is kept in ring buffers so the dashboard can
+   plot the last minutes without reallocating. When the buffers are full, a
+   new sample replaces the oldest one at sample_offset.
+*/
+struct DeviceTelemetry
+{
+    DeviceTelemetry() {}
+
+    sconst u32 max_sample_count = 600; // 20 minutes at one sample every 2s
+
+    Telemetry last;
+    Timepoint time_last_received = {};
+    u32       sample_count       = 0;
+    u32       sample_offset      = 0;
+
+    f32 times[max_sample_count]              = {}; // Seconds since startup
+    f32 loop_time_min[max_sample_count]      = {}; // Milliseconds
+    f32 loop_time_avg[max_sample_count]      = {};
+    f32 loop_time_max[max_sample_count]      = {};
+    f32 free_heap[max_sample_count]          = {}; // Kilobytes
+    f32 largest_free_block[max_sample_count] = {};
+    f32 rssi[max_sample_count]               = {}; // dBm
+};
+
+void ReceiveTelemetry(ClientId client_id, const char* client_name,
+                      const Telemetry& telemetry);
+void DrawTelemetry(const char** client_names);
@@ -39,16 +39,7 @@ Timer::Timer()
     last_measure = Clock::now();
     paused       = true;
 
-    for (auto const& dir_entry :
-         std::filesystem::directory_iterator{"data/timer/"})
-    {
-        if (dir_entry.is_regular_file()
-            && dir_entry.path().extension() != ".txt")
-        {
-            Print("Loading {}\n", dir_entry.path().string());
-            sounds.push_back(LoadAudioFile(dir_entry.path()));
-        }
-    }
+    sounds = &GetSoundBank("timer");
 
     u32 reminder_period_min = 0;
     if (LoadSettingValue("timer.reminder_period", reminder_period_min))
@@ -57,14 +48,12 @@ Timer::Timer()
     }
     LoadSettingValue("timer.play_sound_auto", play_sound_auto);
     LoadSettingValue("timer.sound_selected", sound_selected);
-    if (sound_selected >= sounds.size())
+    if (sound_selected >= sounds->entries.size())
         sound_selected = 0;
     LoadSettingValue("timer.sound_gain", sound_gain);
 }
 Timer::~Timer()
 {
-    for (auto& sound : sounds)
-        DestroyAudioBuffer(sound);
     SaveSettingValue("timer.reminder_period",
                      (u32)(reminder_period.count() / 1'000'000 / 60));
     SaveSettingValue("timer.play_sound_auto", play_sound_auto);
@@ -157,8 +146,8 @@ DrawTimer(Timer& timer)
         if (ImGui::Button(utf8("Jouer manuellement")))
         {
             StopAudio(timer.playing);
-            timer.playing = PlayAudio(timer.sounds[timer.sound_selected],
-                                      Gain(timer.sound_gain / 100.f));
+            timer.playing = PlayBankSound(*timer.sounds, timer.sound_selected,
+                                          Gain(timer.sound_gain / 100.f));
         }
         if (IsPlaying(timer.playing))
         {
@@ -168,17 +157,25 @@ DrawTimer(Timer& timer)
             }
         }
 
-        auto& sound_selected = timer.sounds[timer.sound_selected];
-        if (ImGui::BeginCombo(
-                utf8("Son"),
-                (const char*)sound_selected.path.filename().u8string().c_str()))
+        auto& entries = timer.sounds->entries;
+        Str   preview;
+        if (timer.sound_selected < entries.size())
+        {
+            preview = (const char*)entries[timer.sound_selected]
+                          .buffer.path.filename()
+                          .u8string()
+                          .c_str();
+        }
+        if (ImGui::BeginCombo(utf8("Son"), preview.c_str()))
         {
             u32 i = 0;
-            for (auto& sound : timer.sounds)
+            for (auto& entry : entries)
             {
                 const bool is_selected = (i == timer.sound_selected);
                 if (ImGui::Selectable(
-                        (const char*)sound.path.filename().u8string().c_str(),
+                        (const char*)entry.buffer.path.filename()
+                            .u8string()
+                            .c_str(),
                         is_selected))
                 {
                     timer.sound_selected = i;
@@ -206,17 +203,25 @@ DrawTimer(Timer& timer)
         auto prev = timer.time;
         timer.time += elapsed;
 
+        auto sound_count = (u32)timer.sounds->entries.size();
         if (timer.play_sound_auto && timer.reminder_period != Minutes(0)
-            && timer.sounds.size())
+            && sound_count)
         {
             if (prev / timer.reminder_period
                 < timer.time / timer.reminder_period)
             {
                 StopAudio(timer.playing);
-                u32 to_play =
-                    (prev / timer.reminder_period) % timer.sounds.size();
-                timer.playing = PlayAudio(timer.sounds[to_play],
-                                          Gain(timer.sound_gain / 100.f));
+                u32 to_play = (prev / timer.reminder_period) % sound_count;
+                timer.playing =
+                    PlayBankSound(*timer.sounds, to_play,
+                                  Gain(timer.sound_gain / 100.f));
+            }
+            else if ((timer.time + Minutes(1)) / timer.reminder_period
+                     > timer.time / timer.reminder_period)
+            {
+                // The next reminder is less than a minute away
+                u32 next = (timer.time / timer.reminder_period) % sound_count;
+                PrefetchSoundEntry(*timer.sounds, next);
             }
         }
     }
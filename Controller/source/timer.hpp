@@ -2,6 +2,7 @@
 #include "alias.hpp"
 #include "time.hpp"
 #include "audio.hpp"
+#include "sound_bank.hpp"
 
 // struct Timer
 //{
@@ -148,11 +149,11 @@ struct Timer
 
     bool paused = false;
 
-    s32                      sound_gain      = 70;
-    bool                     play_sound_auto = true;
-    u32                      sound_selected  = 0;
-    std::vector<AudioBuffer> sounds;
-    AudioPlaying             playing;
+    s32          sound_gain      = 70;
+    bool         play_sound_auto = true;
+    u32          sound_selected  = 0;
+    SoundBank*   sounds          = nullptr;
+    AudioPlaying playing;
 };
 
 void DrawTimer(Timer& timer);
\ No newline at end of file
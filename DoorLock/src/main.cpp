@@ -49,6 +49,9 @@ UpdateSerial()
     }
 }
 
+void ReceiveDoorLockCommand(Message& message);
+void ReceiveReset(Message& message);
+
 void
 setup()
 {
@@ -74,6 +77,9 @@ setup()
         ledcWrite(i, soft_lock_dutycycle);
     }
 
+    SetMessageHandler(MessageType::DoorLockCommand, ReceiveDoorLockCommand);
+    SetMessageHandler(MessageType::Reset, ReceiveReset);
+
     Serial.println("Start wifi");
     StartWifi();
 }
@@ -136,6 +142,36 @@ SetCommand(DoorLockCommand cmd)
     }
 }
 
+void
+ReceiveDoorLockCommand(Message& message)
+{
+    DoorLockCommand cmd;
+    cmd.serialize(message.deserializer);
+
+    Serial.println(F("DoorLockCommand"));
+
+    SetCommand(cmd);
+
+    auto ser = Serializer(SerializerMode::Serialize,
+                          {packet_buffer, udp_packet_size});
+
+    status.getHeader().serialize(ser);
+
+    status.serialize(ser);
+
+    SendToServer(ser);
+}
+
+void
+ReceiveReset(Message& message)
+{
+    digitalWrite(MAGLOCK_DOOR, 0);
+    digitalWrite(MAGLOCK_MORDOR, 0);
+    digitalWrite(LATCHLOCK_OUT, 0);
+    delay(1000);
+    ESP.restart();
+}
+
 void
 loop()
 {
@@ -155,39 +191,5 @@ loop()
         }
     }
 
-    Message message = ReceiveMessage();
-    switch (message.header.type)
-    {
-    case MessageType::DoorLockCommand:
-    {
-        DoorLockCommand cmd;
-        cmd.serialize(message.deserializer);
-
-        Serial.println(F("DoorLockCommand"));
-
-        SetCommand(cmd);
-
-        auto ser = Serializer(SerializerMode::Serialize,
-                              {packet_buffer, udp_packet_size});
-
-        status.getHeader().serialize(ser);
-
-        status.serialize(ser);
-
-        udp.beginPacket(server_connection.address, server_connection.port);
-        BufferPtr buffer = {ser.full_buffer.start, ser.buffer.start};
-        udp.write(buffer.start, buffer.end - buffer.start);
-        udp.endPacket();
-    }
-    break;
-    case MessageType::Reset:
-    {
-        digitalWrite(MAGLOCK_DOOR, 0);
-        digitalWrite(MAGLOCK_MORDOR, 0);
-        digitalWrite(LATCHLOCK_OUT, 0);
-        delay(1000);
-        ESP.restart();
-    }
-    break;
-    }
+    DispatchMessages();
 }
\ No newline at end of file
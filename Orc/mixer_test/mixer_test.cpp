@@ -0,0 +1,182 @@
+/*
+   Checks the fixed point kernels of mixer.hpp against values computed by
+   hand: the gains and fades of MixFrames, the saturation of ClipFrames,
+   StepToward and the linear interpolation of Resample.
+
+   Exit code 1 when a check fails.
+*/
+#include "mixer.hpp"
+#include <stdio.h>
+#include <string.h>
+
+u32 failures = 0;
+
+#define CHECK(condition)                                                      \
+   do                                                                         \
+   {                                                                          \
+      if (!(condition))                                                       \
+      {                                                                       \
+         printf("%s:%d: %s\n", __FILE__, __LINE__, #condition);              \
+         failures++;                                                          \
+      }                                                                       \
+   } while (0)
+
+void
+TestFrames()
+{
+   u32 frame = MakeFrame(-1234, 32767);
+   CHECK(LeftSample(frame) == -1234);
+   CHECK(RightSample(frame) == 32767);
+   CHECK(MakeFrame(1, -1) == 0xFFFF0001);
+}
+
+void
+TestMixFrames()
+{
+   u32 frames[4];
+   for (auto& frame : frames)
+   {
+      frame = MakeFrame(1000, -1000);
+   }
+
+   // A gain of 1, then 0.5 added to it
+   s32 accumulator[8] = {};
+   MixFrames(accumulator, frames, 4, unit_gain, unit_gain);
+   CHECK(accumulator[0] == 1000 && accumulator[1] == -1000);
+   CHECK(accumulator[6] == 1000 && accumulator[7] == -1000);
+   MixFrames(accumulator, frames, 4, unit_gain / 2, unit_gain / 2);
+   CHECK(accumulator[0] == 1500 && accumulator[1] == -1500);
+   CHECK(accumulator[6] == 1500 && accumulator[7] == -1500);
+
+   // A fade in from 0 to 1 steps by a quarter per frame
+   s32 fade[8] = {};
+   MixFrames(fade, frames, 4, 0, unit_gain);
+   s32 expected[8] = {0, 0, 250, -250, 500, -500, 750, -750};
+   CHECK(memcmp(fade, expected, sizeof(fade)) == 0);
+
+   // A fade out from 1 to 0
+   s32 fade_out[8] = {};
+   MixFrames(fade_out, frames, 4, unit_gain, 0);
+   s32 expected_out[8] = {1000, -1000, 750, -750, 500, -500, 250, -250};
+   CHECK(memcmp(fade_out, expected_out, sizeof(fade_out)) == 0);
+
+   // The loudest samples at a gain of 2 don't overflow
+   s32 loud[2] = {};
+   u32 extremes = MakeFrame(S16_MIN, S16_MAX);
+   MixFrames(loud, &extremes, 1, 2 * unit_gain, 2 * unit_gain);
+   CHECK(loud[0] == 2 * S16_MIN && loud[1] == 2 * S16_MAX);
+
+   // Nothing mixed
+   s32 untouched[2] = {7, 7};
+   MixFrames(untouched, frames, 0, unit_gain, unit_gain);
+   CHECK(untouched[0] == 7 && untouched[1] == 7);
+}
+
+void
+TestClipFrames()
+{
+   s32 accumulator[6] = {100000, -100000, 1234, -1234, 32768, -32769};
+   u32 out[3];
+   ClipFrames(out, accumulator, 3);
+   CHECK(LeftSample(out[0]) == S16_MAX && RightSample(out[0]) == S16_MIN);
+   CHECK(LeftSample(out[1]) == 1234 && RightSample(out[1]) == -1234);
+   CHECK(LeftSample(out[2]) == S16_MAX && RightSample(out[2]) == S16_MIN);
+}
+
+void
+TestStepToward()
+{
+   CHECK(StepToward(0, 100, 30) == 30);
+   CHECK(StepToward(100, 0, 30) == 70);
+   CHECK(StepToward(90, 100, 30) == 100);
+   CHECK(StepToward(-50, -60, 30) == -60);
+   CHECK(StepToward(42, 42, 30) == 42);
+   CHECK(StepToward(0, unit_gain, unit_gain / 4) == unit_gain / 4);
+}
+
+void
+TestResample()
+{
+   CHECK(Lerp16(-100, 100, 1 << 15) == 0);
+   CHECK(Lerp16(0, 1000, 1 << 14) == 250);
+
+   u32 in[100];
+   for (u32 i = 0; i < 100; i++)
+   {
+      in[i] = MakeFrame((s16)(i * 100), (s16)(-(s32)i * 100));
+   }
+   u32 out[300];
+
+   // Same rate: the input one frame late
+   Resampler same;
+   StartResampler(same, 44100, 44100);
+   CHECK(same.step == unit_gain);
+   u32 used    = 0;
+   u32 written = Resample(same, out, 300, in, 100, used);
+   CHECK(used == 100 && written == 99);
+   CHECK(memcmp(out, in, 99 * sizeof(u32)) == 0);
+
+   // Twice the rate: a frame between each pair of input frames
+   Resampler twice;
+   StartResampler(twice, 22050, 44100);
+   CHECK(twice.step == unit_gain / 2);
+   written = Resample(twice, out, 300, in, 100, used);
+   CHECK(used == 100 && written == 198);
+   bool ramp = true;
+   for (u32 i = 0; i < written; i++)
+   {
+      ramp &= LeftSample(out[i]) == (s16)(i * 50);
+      ramp &= RightSample(out[i]) == (s16)(-(s32)i * 50);
+   }
+   CHECK(ramp);
+
+   // The input given in pieces and the output asked in pieces give the
+   // same frames
+   Resampler pieces;
+   StartResampler(pieces, 22050, 44100);
+   u32 out_pieces[300];
+   u32 total = 0;
+   for (u32 first = 0; first < 100;)
+   {
+      u32 count = (100 - first < 7) ? 100 - first : 7;
+      total += Resample(pieces, out_pieces + total, 5, in + first, count,
+                        used);
+      first += used;
+   }
+   CHECK(total == 198);
+   CHECK(memcmp(out, out_pieces, 198 * sizeof(u32)) == 0);
+
+   // It stops when out is full and keeps the input it didn't use
+   Resampler full;
+   StartResampler(full, 22050, 44100);
+   written = Resample(full, out, 10, in, 100, used);
+   CHECK(written == 10 && used == 6);
+
+   // 48 kHz to 44.1 kHz drops about 1 frame in 12
+   Resampler down;
+   StartResampler(down, 48000, 44100);
+   CHECK(down.step == 71331);
+   written = Resample(down, out, 300, in, 100, used);
+   CHECK(used == 100 && written == 91);
+   CHECK(LeftSample(out[0]) == 0);
+   // 1.088 frames after the first one
+   CHECK(LeftSample(out[1]) == 108);
+}
+
+int
+main()
+{
+   TestFrames();
+   TestMixFrames();
+   TestClipFrames();
+   TestStepToward();
+   TestResample();
+
+   if (failures)
+   {
+      printf("%u checks failed\n", failures);
+      return 1;
+   }
+   printf("Passed\n");
+   return 0;
+}
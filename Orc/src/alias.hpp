@@ -12,6 +12,7 @@ using u64 = uint64_t;
 using s8  = int8_t;
 using s16 = int16_t;
 using s32 = int32_t;
+using s64 = int64_t;
 
 using f32 = float;
 
@@ -1,4 +1,5 @@
 #include "alias.hpp"
+#include "mixer.hpp"
 
 #include <Arduino.h>
 #include <Wire.h>
@@ -6,6 +7,7 @@
 #define FS_NO_GLOBALS
 #include <LittleFS.h>
 #include <vector>
+#include <atomic>
 
 #include <FastLED.h>
 #include <SdFat.h>
@@ -117,40 +119,13 @@ EndsWithWav(char* str, size_t size)
    return true;
 }
 
-std::vector<String>
-ListAllWaveFiles(File32 dir)
-{
-   std::vector<String> vec;
-   while (true)
-   {
-      auto file = dir.openNextFile();
-      if (!file)
-      {
-         break;
-      }
-      if (!file.isDirectory())
-      {
-         char   filename[64];
-         size_t size = file.getName(filename, sizeof(filename));
-
-         // Serial.print(F("File: "));
-         // file.printName(&Serial);
-         // Serial.print(F("\n"));
-         if (EndsWithWav(filename, size))
-         {
-            vec.push_back(String(filename, size));
-         }
-      }
-   }
-   vec.shrink_to_fit();
-   return std::move(vec);
-}
-
 struct WaveFile
 {
    File32 handle;
 
-   static constexpr u32 buffer_size = 256;
+   // Whole SD sectors: SdFat reads them straight into the buffer
+   static constexpr u32 sector_size = 512;
+   static constexpr u32 buffer_size = 8 * sector_size;
    u8*                  buffer      = nullptr;
 
    u8* read_ptr       = 0;
@@ -179,8 +154,12 @@ LoadFileIntoBuffer(WaveFile& file)
       dest += old_data;
    }
    u32 size_to_read = file.buffer + file.buffer_size - dest;
-   size_to_read     = min(size_to_read, file.data_left_size);
-   u32 loaded       = file.handle.read(dest, size_to_read);
+   // The read ends on a sector boundary so that the next one starts on one
+   u32 end_position = file.handle.curPosition() + size_to_read;
+   if (size_to_read > file.sector_size)
+      size_to_read -= end_position % file.sector_size;
+   size_to_read = min(size_to_read, file.data_left_size);
+   u32 loaded   = file.handle.read(dest, size_to_read);
    file.data_left_size -= loaded;
 
    // Serial.println("\nnew data:");
@@ -218,12 +197,29 @@ ReadFile(WaveFile& file, T& value)
    return false;
 }
 
+// Skips what is left in the buffer, then seeks over the rest
+bool
+SkipFileBytes(WaveFile& file, u32 count)
+{
+   u32 available = file.end - file.read_ptr;
+   if (count <= available)
+   {
+      file.read_ptr += count;
+      return true;
+   }
+   count -= available;
+   file.read_ptr = file.buffer;
+   file.end      = file.buffer;
+   return file.handle.seekCur(count);
+}
+
 struct WaveHeader
 {
    u16 channel_count   = 0;
    u32 sample_rate     = 0;
    u16 bits_per_sample = 0;
-   // u32 data_size       = 0;
+   u32 data_offset     = 0; // In the file
+   u32 data_size       = 0;
 };
 
 constexpr u32
@@ -300,8 +296,9 @@ DecodeWaveHeader(WaveHeader& header, WaveFile& file)
 
       if (data_str == StringToU32("data"))
       {
-         // header.data_size = section_size;
          u32 already_loaded  = file.end - file.read_ptr;
+         header.data_offset  = file.handle.curPosition() - already_loaded;
+         header.data_size    = section_size;
          file.data_left_size = section_size - already_loaded;
          break;
       }
@@ -362,24 +359,16 @@ DecodeWaveHeader(WaveHeader& header, WaveFile& file)
          }
          else
          {
-            // Skip
-            for (u32 i = 0; i < section_size; i++)
-            {
-               u8 discard = 0;
-               if (!ReadFile(file, discard))
-                  return false;
-            }
+            // The type id is part of the chunk
+            if (!SkipFileBytes(file, section_size - index + (section_size & 1)))
+               return false;
          }
       }
       else
       {
-         // Skip
-         for (u32 i = 0; i < section_size; i++)
-         {
-            u8 discard = 0;
-            if (!ReadFile(file, discard))
-               return false;
-         }
+         // The chunks are padded to an even size
+         if (!SkipFileBytes(file, section_size + (section_size & 1)))
+            return false;
       }
    }
 
@@ -424,119 +413,537 @@ struct Wave
 {
    WaveFile   file;
    WaveHeader header;
-   s32        last_sample = S32_MIN;
 };
 
-bool
-LoadWaveFile(Wave& wave, const File32& file32)
+/*
+   The headers of all the sounds are decoded once at boot. A sound is opened
+   with the index of its entry in the directory, without looking up a path,
+   and starts playing from the offset of its data.
+*/
+struct SoundInfo
+{
+   File32*    dir       = nullptr;
+   u16        dir_index = 0;
+   WaveHeader header;
+};
+
+File32 awake_dir;
+File32 moved_dir;
+File32 sleep_dir;
+
+std::vector<SoundInfo> awake_sounds;
+std::vector<SoundInfo> moved_sounds;
+std::vector<SoundInfo> sleep_sounds;
+
+void
+IndexSounds(const char* path, File32& dir, std::vector<SoundInfo>& sounds)
 {
-   wave             = Wave();
-   wave.file.handle = file32;
-   wave.file.buffer = (u8*)malloc(wave.file.buffer_size);
+   dir = SD.open(path);
+   if (!dir)
+      return;
 
-   if (!wave.file.buffer)
+   WaveFile wave_file;
+   wave_file.buffer = (u8*)malloc(wave_file.buffer_size);
+   if (!wave_file.buffer)
    {
       Serial.println(F("malloc failed"));
-      return false;
+      return;
    }
 
-   if (!DecodeWaveHeader(wave.header, wave.file))
+   Serial.printf("Sounds in %s:\n", path);
+   while (true)
    {
-      Serial.println(F("DecodeWaveHeader failed"));
-      return false;
+      File32 file = dir.openNextFile();
+      if (!file)
+      {
+         break;
+      }
+      char   filename[64];
+      size_t size = file.getName(filename, sizeof(filename));
+      if (file.isDirectory() || !EndsWithWav(filename, size))
+      {
+         file.close();
+         continue;
+      }
+      Serial.println(filename);
+
+      SoundInfo sound;
+      sound.dir                = &dir;
+      sound.dir_index          = file.dirIndex();
+      wave_file.handle         = file;
+      wave_file.read_ptr       = wave_file.buffer;
+      wave_file.end            = wave_file.buffer;
+      wave_file.data_left_size = U32_MAX;
+      if (!DecodeWaveHeader(sound.header, wave_file))
+      {
+         Serial.println(F("DecodeWaveHeader failed"));
+      }
+      else if (sound.header.bits_per_sample != 16
+               || !sound.header.channel_count)
+      {
+         Serial.println(F("Not a 16 bit file"));
+      }
+      else
+      {
+         sounds.push_back(sound);
+      }
+      file.close();
    }
+   free(wave_file.buffer);
+   sounds.shrink_to_fit();
+   Serial.println();
+}
 
-   i2s_set_sample_rates(I2S_NUM_0, wave.header.sample_rate);
+// Frames of the I2S DMA buffers, a frame is a left and a right s16
+constexpr u32 i2s_buffer_frames = 256;
+constexpr u32 i2s_buffer_count  = 4;
 
-   return true;
-}
+// Mixed frames waiting for the DMA, written with one i2s_write
+struct AudioBlock
+{
+   u32 frames[i2s_buffer_frames];
+   u32 bytes = 0;
+   u32 sent  = 0;
+};
 
-void
-DestroyWaveFile(Wave& wave)
+/*
+   Converts and interleaves up to max_frames frames from the file buffer,
+   refilling it with whole sectors when it's empty. Returns the number of
+   frames written to out, 0 at the end of the file.
+*/
+u32
+DecodeFrames(Wave& wave, u32* out, u32 max_frames)
 {
-   if (wave.file.buffer)
-      free(wave.file.buffer);
+   auto&     file        = wave.file;
+   const u32 channels    = wave.header.channel_count;
+   const u32 frame_bytes = channels * sizeof(s16);
+   u32       frames      = 0;
+   while (frames < max_frames)
+   {
+      u32 available = (file.end - file.read_ptr) / frame_bytes;
+      if (!available)
+      {
+         if (!file.data_left_size)
+            break;
+         LoadFileIntoBuffer(file);
+         available = (file.end - file.read_ptr) / frame_bytes;
+         if (!available)
+            break;
+      }
+
+      u32 count = min(available, max_frames - frames);
+      // The buffer isn't always aligned after the header
+      const u8* in  = file.read_ptr;
+      u32*      dst = out + frames;
+      if (channels == 1)
+      {
+         for (u32 i = 0; i < count; i++)
+         {
+            s16 sample;
+            memcpy(&sample, in + i * 2, sizeof(sample));
+            dst[i] = MakeFrame(sample, sample);
+         }
+      }
+      else
+      {
+         memcpy(dst, in, count * sizeof(u32));
+      }
+      file.read_ptr += count * frame_bytes;
+      frames += count;
+   }
+   return frames;
 }
 
-struct WavePlayer
+/*
+   The sounds are mixed by voices, so that the orc can grunt over its snore.
+   The kind of a sound is its priority: while a voice plays, the voices of a
+   lower priority are ducked. A voice fades in when it starts and fades out
+   when it's stopped.
+*/
+enum class SoundKind : u8
 {
-   bool playing = false;
-   u16  volume  = FloatTo88(0.1f);
+   Sleep,
+   Awake,
+   Moved,
+   Count
+};
+
+constexpr u32 voice_count       = 4;
+constexpr u32 mixer_sample_rate = 44100;
+constexpr u32 fade_duration_ms  = 30;
+constexpr s32 duck_gain         = unit_gain / 4;
+// Gain change per block, a fade from 0 to 1 takes fade_duration_ms
+constexpr s32 fade_step = (s64)unit_gain * i2s_buffer_frames * 1000
+                          / (mixer_sample_rate * fade_duration_ms);
+
+struct Voice
+{
+   bool      playing  = false;
+   bool      stopping = false; // Fading out
+   SoundKind kind     = SoundKind::Sleep;
+   s32       volume   = 0; // Q8.16
+   s32       gain     = 0; // Q8.16, where the fade is
+
+   Wave      wave;
+   u8        buffer[WaveFile::buffer_size];
+   Resampler resampler;
+
+   // Decoded at the rate of the file, waiting for the resampler
+   u32 input[i2s_buffer_frames];
+   u32 input_count = 0;
+   u32 input_used  = 0;
+
+   u32 frames[i2s_buffer_frames];
+
+   // The voice was stolen for this sound, it starts when the voice has
+   // faded out
+   const SoundInfo* next_sound  = nullptr;
+   SoundKind        next_kind   = SoundKind::Sleep;
+   u16              next_volume = 0;
+};
 
-   Wave wave;
+struct Mixer
+{
+   Voice voices[voice_count];
+   s32   accumulator[2 * i2s_buffer_frames];
+
+   // The next block is mixed while the DMA plays the current one
+   AudioBlock blocks[2];
+   u8         current = 0;
+};
+
+Mixer mixer;
+
+/*
+   The audio runs in its own task on core 0, loop (core 1) does the sensors
+   and the LEDs. Slow I2C reads can't starve the DMA anymore. After setup the
+   task is the only one to use the SD card: loop sends the sounds to play or
+   to stop through audio_requests.
+*/
+struct PlayRequest
+{
+   const SoundInfo* sound; // nullptr to stop the sounds of this kind
+   SoundKind        kind;
+   u16              volume;
 };
 
-WavePlayer player = {};
+QueueHandle_t         audio_requests      = nullptr;
+QueueHandle_t         i2s_events          = nullptr;
+constexpr UBaseType_t audio_task_priority = 5;
+constexpr BaseType_t  audio_task_core     = 0;
+constexpr u32         audio_request_count = 4;
+
+// Requested and not ended yet, by kind
+std::atomic<u32> sounds_playing[(u8)SoundKind::Count];
+std::atomic<u32> time_sound_ended[(u8)SoundKind::Count];
+// DMA buffers sent empty while a sound was playing
+std::atomic<u32> audio_underruns{0};
 
 bool
-LoadSamples(WavePlayer& p)
+SoundPlaying(SoundKind kind)
 {
-   if (!p.playing)
-      return false;
+   return sounds_playing[(u8)kind] != 0;
+}
 
-   while (true)
+bool
+AnySoundPlaying()
+{
+   for (auto& count : sounds_playing)
    {
-      if (p.wave.last_sample != S32_MIN)
+      if (count)
+         return true;
+   }
+   return false;
+}
+
+u32
+TimeSoundEnded()
+{
+   u32 time = 0;
+   for (auto& ended : time_sound_ended)
+   {
+      time = max(time, (u32)ended);
+   }
+   return time;
+}
+
+void
+PlaySound(const SoundInfo& sound, SoundKind kind, u16 volume)
+{
+   PlayRequest request;
+   request.sound  = &sound;
+   request.kind   = kind;
+   request.volume = volume;
+   sounds_playing[(u8)kind]++;
+   if (xQueueSend(audio_requests, &request, 0) != pdTRUE)
+      sounds_playing[(u8)kind]--;
+}
+
+void
+StopSounds(SoundKind kind)
+{
+   PlayRequest request;
+   request.sound  = nullptr;
+   request.kind   = kind;
+   request.volume = 0;
+   xQueueSend(audio_requests, &request, 0);
+}
+
+void
+EndVoice(Voice& voice)
+{
+   voice.playing = false;
+   voice.wave.file.handle.close();
+   time_sound_ended[(u8)voice.kind] = millis();
+   sounds_playing[(u8)voice.kind]--;
+}
+
+/*
+   A free voice, or the one of the lowest priority if it's not above kind. A
+   voice already stolen for another sound can't be stolen again.
+*/
+Voice*
+FindVoice(SoundKind kind)
+{
+   Voice* lowest = nullptr;
+   for (auto& voice : mixer.voices)
+   {
+      if (!voice.playing)
+         return &voice;
+      if (voice.next_sound)
+         continue;
+      if (!lowest || voice.kind < lowest->kind
+          || (voice.kind == lowest->kind && voice.stopping))
       {
-         u32 sample = p.wave.last_sample;
+         lowest = &voice;
+      }
+   }
+   if (!lowest || lowest->kind > kind)
+      return nullptr;
+   return lowest;
+}
+
+void
+StartVoice(Voice* voice, const SoundInfo& sound, SoundKind kind, u16 volume)
+{
+   auto& file = voice->wave.file;
+   if (!file.handle.open(sound.dir, sound.dir_index, O_RDONLY)
+       || !file.handle.seekSet(sound.header.data_offset))
+   {
+      Serial.println(F("Can't open the sound"));
+      file.handle.close();
+      sounds_playing[(u8)kind]--;
+      return;
+   }
+   Serial.print("StartSound: ");
+   file.handle.printName(&Serial);
+   Serial.println();
 
-         size_t bytes_written;
-         i2s_write(I2S_NUM_0, &sample, sizeof(s16) * 2, &bytes_written, 0);
+   voice->wave.header  = sound.header;
+   file.buffer         = voice->buffer;
+   file.read_ptr       = file.buffer;
+   file.end            = file.buffer;
+   file.data_left_size = sound.header.data_size;
+   StartResampler(voice->resampler, sound.header.sample_rate,
+                  mixer_sample_rate);
+   voice->input_count = 0;
+   voice->input_used  = 0;
+
+   voice->kind     = kind;
+   voice->volume   = (s32)volume << 8;
+   voice->gain     = 0;
+   voice->stopping = false;
+   voice->playing  = true;
+}
 
-         if (bytes_written == 0)
+void
+StartSound(const SoundInfo& sound, SoundKind kind, u16 volume)
+{
+   Voice* voice = FindVoice(kind);
+   if (!voice)
+   {
+      sounds_playing[(u8)kind]--;
+      return;
+   }
+   if (voice->playing)
+   {
+      // Stopped abruptly the voice would click, it fades out over the next
+      // block and MixBlock starts the sound after it
+      voice->stopping    = true;
+      voice->next_sound  = &sound;
+      voice->next_kind   = kind;
+      voice->next_volume = volume;
+      return;
+   }
+   StartVoice(voice, sound, kind, volume);
+}
+
+// Frames of the voice at the rate of the mixer, fewer at the end of the file
+u32
+ReadVoice(Voice& voice, u32 count)
+{
+   if (voice.wave.header.sample_rate == mixer_sample_rate)
+      return DecodeFrames(voice.wave, voice.frames, count);
+
+   u32 written = 0;
+   while (written < count)
+   {
+      if (voice.input_used == voice.input_count)
+      {
+         voice.input_count = DecodeFrames(voice.wave, voice.input,
+                                          i2s_buffer_frames);
+         voice.input_used  = 0;
+         if (!voice.input_count)
             break;
       }
+      u32 used = 0;
+      written += Resample(voice.resampler, voice.frames + written,
+                          count - written, voice.input + voice.input_used,
+                          voice.input_count - voice.input_used, used);
+      voice.input_used += used;
+   }
+   return written;
+}
 
-      s16 left  = 0;
-      s16 right = 0;
-      if (p.wave.header.channel_count == 1)
-      {
-         s16 sample = 0;
-         if (!ReadFile(p.wave.file, sample))
-         {
-            p.playing = false;
-            return false;
-         }
+// Returns false when no voice is playing
+bool
+MixBlock(Mixer& m, AudioBlock& block)
+{
+   // The voices below the highest kind that isn't stopping are ducked
+   bool      playing = false;
+   SoundKind highest = SoundKind::Sleep;
+   for (auto& voice : m.voices)
+   {
+      playing |= voice.playing;
+      if (voice.playing && !voice.stopping && voice.kind > highest)
+         highest = voice.kind;
+   }
+   if (!playing)
+      return false;
 
-         left  = sample;
-         right = sample;
-      }
-      else if (p.wave.header.channel_count == 2)
+   memset(m.accumulator, 0, sizeof(m.accumulator));
+   u32 frames = 0;
+   for (auto& voice : m.voices)
+   {
+      if (!voice.playing)
+         continue;
+
+      s32 target = voice.stopping ? 0 : voice.volume;
+      if (voice.kind < highest)
+         target = (s32)(((s64)target * duck_gain) >> 16);
+      s32 gain_end = StepToward(voice.gain, target, fade_step);
+      // A stolen voice fades out in a single block
+      if (voice.next_sound)
+         gain_end = 0;
+
+      u32 count = ReadVoice(voice, i2s_buffer_frames);
+      MixFrames(m.accumulator, voice.frames, count, voice.gain, gain_end);
+      voice.gain = gain_end;
+      frames     = max(frames, count);
+
+      if (count < i2s_buffer_frames || (voice.stopping && voice.gain == 0))
       {
-         if (!ReadFile(p.wave.file, left))
+         EndVoice(voice);
+         if (voice.next_sound)
          {
-            p.playing = false;
-            return false;
-         }
-
-         if (!ReadFile(p.wave.file, right))
-         {
-            p.playing = false;
-            return false;
+            const SoundInfo* sound = voice.next_sound;
+            voice.next_sound       = nullptr;
+            StartVoice(&voice, *sound, voice.next_kind, voice.next_volume);
+            // It plays from the next block, this one isn't the last
+            if (voice.playing)
+               frames = i2s_buffer_frames;
          }
       }
+   }
+
+   // The voices that ended in the block leave silence after them
+   if (frames)
+      frames = i2s_buffer_frames;
+   ClipFrames(block.frames, m.accumulator, frames);
+   block.bytes = frames * sizeof(u32);
+   block.sent  = 0;
+   return frames != 0;
+}
 
-      p.wave.last_sample = (ScaleBy88(left, p.volume) & 0xFFFF)
-                           | (ScaleBy88(right, p.volume) << 16);
+// Longest wait for the DMA, the audio task checks its requests in between
+constexpr TickType_t audio_write_timeout = pdMS_TO_TICKS(20);
+
+// Returns false when there is nothing left to play
+bool
+WriteSamples(Mixer& m)
+{
+   auto& current = m.blocks[m.current];
+   auto& next    = m.blocks[m.current ^ 1];
+   if (!current.bytes && !MixBlock(m, current))
+      return false;
+   if (!next.bytes)
+      MixBlock(m, next);
+
+   // Blocks until the DMA has room
+   size_t bytes_written = 0;
+   i2s_write(I2S_NUM_0, (u8*)current.frames + current.sent,
+             current.bytes - current.sent, &bytes_written,
+             audio_write_timeout);
+   current.sent += bytes_written;
+   if (current.sent == current.bytes)
+   {
+      current.bytes = 0;
+      m.current ^= 1;
    }
    return true;
 }
 
-void
-StartWaveFile(File32 file, u16 volume)
+// When all the DMA buffers are empty the driver sends I2S_EVENT_TX_Q_OVF
+u32
+CountUnderruns()
 {
-   if (!file)
+   u32         count = 0;
+   i2s_event_t event;
+   while (xQueueReceive(i2s_events, &event, 0) == pdTRUE)
    {
-      return;
+      if (event.type == I2S_EVENT_TX_Q_OVF)
+         count++;
    }
-   Serial.print("StartWaveFile: ");
-   file.printName(&Serial);
-   Serial.println();
+   return count;
+}
+
+void
+AudioTask(void*)
+{
+   bool playing = false;
+   while (true)
+   {
+      PlayRequest request;
+      TickType_t  wait = playing ? 0 : portMAX_DELAY;
+      while (xQueueReceive(audio_requests, &request, wait) == pdTRUE)
+      {
+         wait = 0;
+         if (request.sound)
+         {
+            StartSound(*request.sound, request.kind, request.volume);
+            continue;
+         }
+         for (auto& voice : mixer.voices)
+         {
+            if (voice.playing && voice.kind == request.kind)
+               voice.stopping = true;
+            if (voice.next_sound && voice.next_kind == request.kind)
+            {
+               voice.next_sound = nullptr;
+               sounds_playing[(u8)request.kind]--;
+            }
+         }
+      }
+      if (!playing)
+      {
+         // The buffers were empty while nothing was playing
+         CountUnderruns();
+      }
 
-   DestroyWaveFile(player.wave);
-   LoadWaveFile(player.wave, file);
-   player.volume  = volume;
-   player.playing = true;
+      playing = WriteSamples(mixer);
+      if (playing)
+         audio_underruns += CountUnderruns();
+   }
 }
 
 struct Vec3
@@ -931,17 +1338,12 @@ StringMatch(const char* str1, const char* end1, const char* str2)
    return false;
 }
 
-u32 time_sound_ended = 0;
-
 struct SoundCooldownRange
 {
    u32 min;
    u32 max;
 };
 
-std::vector<String> awake_sounds;
-std::vector<String> moved_sounds;
-
 constexpr SoundCooldownRange moved_sound_cooldown_range = {200, 1000};
 constexpr SoundCooldownRange awake_sound_cooldown_range = {1000, 5000};
 
@@ -981,28 +1383,9 @@ setup()
       auto dir = SD.open("/");
       PrintDirectory(dir);
 
-      dir = SD.open("/awake");
-      if (dir)
-      {
-         awake_sounds = ListAllWaveFiles(dir);
-         Serial.println(F("Awake sounds:"));
-         for (auto& s : awake_sounds)
-         {
-            Serial.println(s);
-         }
-         Serial.println();
-      }
-      dir = SD.open("/moved");
-      if (dir)
-      {
-         moved_sounds = ListAllWaveFiles(dir);
-         Serial.println(F("Moved sounds:"));
-         for (auto& s : moved_sounds)
-         {
-            Serial.println(s);
-         }
-         Serial.println();
-      }
+      IndexSounds("/awake", awake_dir, awake_sounds);
+      IndexSounds("/moved", moved_dir, moved_sounds);
+      IndexSounds("/sleep", sleep_dir, sleep_sounds);
 
       Serial.println(F("Loading volume file"));
       auto file = SD.open("/volume.txt");
@@ -1049,18 +1432,18 @@ setup()
 
    i2s_config_t i2s_config = {
        .mode                 = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX),
-       .sample_rate          = 44100,
+       .sample_rate          = mixer_sample_rate,
        .bits_per_sample      = I2S_BITS_PER_SAMPLE_16BIT,
        .channel_format       = I2S_CHANNEL_FMT_RIGHT_LEFT, // Stereo
        .communication_format = I2S_COMM_FORMAT_STAND_I2S,
        .intr_alloc_flags     = 0, // Default interrupt priority
-       .dma_buf_count        = 8,
-       .dma_buf_len          = 64, // TODO: pick buffer length, default 64
+       .dma_buf_count        = i2s_buffer_count,
+       .dma_buf_len          = i2s_buffer_frames,
        .use_apll             = false,
        .tx_desc_auto_clear   = true, // Auto clear tx descriptor on underflow
        .fixed_mclk           = 0};
 
-   i2s_driver_install(I2S_NUM_0, &i2s_config, 0, NULL);
+   i2s_driver_install(I2S_NUM_0, &i2s_config, 8, &i2s_events);
 
    i2s_pin_config_t pin_config = {.bck_io_num   = I2S_BCK,
                                   .ws_io_num    = I2S_LCK,
@@ -1068,6 +1451,10 @@ setup()
                                   .data_in_num  = I2S_PIN_NO_CHANGE};
    i2s_set_pin(I2S_NUM_0, &pin_config);
 
+   audio_requests = xQueueCreate(audio_request_count, sizeof(PlayRequest));
+   xTaskCreatePinnedToCore(AudioTask, "audio", 8192, nullptr,
+                           audio_task_priority, nullptr, audio_task_core);
+
    Wire.begin(I2C_SDA, I2C_SCL);
 
    for (u8 addr = 0; addr < 2; addr++)
@@ -1125,39 +1512,42 @@ loop()
       fall_asleep_time = 0;
    }
    bool is_asleep = (millis() > fall_asleep_time);
-   // if (player.state != Wave_Stop)
-   if (player.playing)
+   if (is_asleep)
    {
-      if (!LoadSamples(player))
+      // Asleep
+      if (!SoundPlaying(SoundKind::Sleep) && !sleep_sounds.empty())
       {
-         time_sound_ended = millis();
+         u32 index = esp_random() % sleep_sounds.size();
+         PlaySound(sleep_sounds[index], SoundKind::Sleep, volume_sleep);
       }
    }
-   else
+   else if (!AnySoundPlaying()
+            && millis() > TimeSoundEnded() + awake_sound_cooldown
+            && !awake_sounds.empty())
    {
-      if (is_asleep)
-      {
-         // Asleep
-         StartWaveFile(SD.open("/sleep/sleep.wav"), volume_sleep);
-      }
-      else if (millis() > time_sound_ended + awake_sound_cooldown)
-      {
-         // Grunting while awake
-         u32    rand  = esp_random();
-         u32    index = rand % awake_sounds.size();
-         String path  = "/awake/" + awake_sounds[index];
-
-         StartWaveFile(SD.open(path), volume_awake);
-
-         rand                 = esp_random();
-         auto& range          = awake_sound_cooldown_range;
-         awake_sound_cooldown = rand % (range.max - range.min) + range.min;
-         Serial.printf("Awake sound cooldown = %d\n", awake_sound_cooldown);
-      }
+      // Grunting while awake
+      u32 rand  = esp_random();
+      u32 index = rand % awake_sounds.size();
+      PlaySound(awake_sounds[index], SoundKind::Awake, volume_awake);
+
+      rand                 = esp_random();
+      auto& range          = awake_sound_cooldown_range;
+      awake_sound_cooldown = rand % (range.max - range.min) + range.min;
+      Serial.printf("Awake sound cooldown = %d\n", awake_sound_cooldown);
    }
 
    UpdateLeds(!is_asleep);
 
+   // At most once per second
+   static u32 underruns_printed   = 0;
+   static u32 next_underrun_print = 0;
+   if (audio_underruns != underruns_printed && millis() >= next_underrun_print)
+   {
+      underruns_printed   = audio_underruns;
+      next_underrun_print = millis() + 1000;
+      Serial.printf("Audio underruns: %u\n", underruns_printed);
+   }
+
    for (u8 addr = 0; addr < 2; addr++)
    {
       auto& mpu   = mpu6050[addr];
@@ -1194,19 +1584,24 @@ loop()
       {
          mpu.dir_ref = vec;
 
-         u32 time = millis();
+         u32  time        = millis();
+         bool was_asleep  = time > fall_asleep_time;
+         u32  moved_ended = time_sound_ended[(u8)SoundKind::Moved];
 
-         // If asleep or moved_sound_cooldown ended
-         if (time > fall_asleep_time
-             || (time > time_sound_ended + moved_sound_cooldown
-                 && !player.playing))
+         // If asleep or moved_sound_cooldown ended, the other sounds are
+         // ducked while the orc grunts
+         if ((was_asleep
+              || (time > moved_ended + moved_sound_cooldown
+                  && !SoundPlaying(SoundKind::Moved)))
+             && !moved_sounds.empty())
          {
-            // Grunting when moved
-            u32    rand  = esp_random();
-            u32    index = rand % moved_sounds.size();
-            String path  = "/moved/" + moved_sounds[index];
+            if (was_asleep)
+               StopSounds(SoundKind::Sleep);
 
-            StartWaveFile(SD.open(path), volume_moved);
+            // Grunting when moved
+            u32 rand  = esp_random();
+            u32 index = rand % moved_sounds.size();
+            PlaySound(moved_sounds[index], SoundKind::Moved, volume_moved);
 
             rand                 = esp_random();
             auto& range          = moved_sound_cooldown_range;
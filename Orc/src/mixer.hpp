@@ -0,0 +1,136 @@
+#pragma once
+#include "alias.hpp"
+
+/*
+   Fixed point kernels of the sound mixer. They don't depend on Arduino so
+   that they can be checked on a computer.
+   A frame is a left and a right s16 in a u32, like the I2S driver wants them.
+   The gains are Q8.16: 1 << 16 is a gain of 1.
+*/
+
+constexpr s32 unit_gain = 1 << 16;
+
+inline s16
+Saturate16(s32 value)
+{
+   if (value < S16_MIN)
+      return S16_MIN;
+   if (value > S16_MAX)
+      return S16_MAX;
+   return value;
+}
+
+inline s16
+LeftSample(u32 frame)
+{
+   return (s16)(frame & 0xFFFF);
+}
+
+inline s16
+RightSample(u32 frame)
+{
+   return (s16)(frame >> 16);
+}
+
+inline u32
+MakeFrame(s16 left, s16 right)
+{
+   return (u32)(u16)left | ((u32)(u16)right << 16);
+}
+
+/*
+   Adds count frames to the accumulator, 2 s32 per frame. The gain goes
+   linearly from gain to gain_end over the block so that a fade has no steps.
+*/
+inline void
+MixFrames(s32* accumulator, const u32* frames, u32 count, s32 gain,
+          s32 gain_end)
+{
+   if (!count)
+      return;
+   s32 step = (gain_end - gain) / (s32)count;
+   for (u32 i = 0; i < count; i++)
+   {
+      // Q8.8 so that the product fits in a s32
+      s32 g = gain >> 8;
+      accumulator[2 * i] += (LeftSample(frames[i]) * g) >> 8;
+      accumulator[2 * i + 1] += (RightSample(frames[i]) * g) >> 8;
+      gain += step;
+   }
+}
+
+// Saturates the accumulator back to frames
+inline void
+ClipFrames(u32* out, const s32* accumulator, u32 count)
+{
+   for (u32 i = 0; i < count; i++)
+   {
+      out[i] = MakeFrame(Saturate16(accumulator[2 * i]),
+                         Saturate16(accumulator[2 * i + 1]));
+   }
+}
+
+// Moves value toward target by at most max_step
+inline s32
+StepToward(s32 value, s32 target, s32 max_step)
+{
+   if (value < target)
+      return (target - value > max_step) ? value + max_step : target;
+   return (value - target > max_step) ? value - max_step : target;
+}
+
+/*
+   Linear interpolation from the rate of a sound to the rate of the mixer.
+   phase is the position between previous and next, Q16. It starts at 2 so
+   that the first two input frames are loaded before the first output.
+*/
+struct Resampler
+{
+   u32 step     = 1 << 16; // Input frames per output frame, Q16
+   u32 phase    = 2 << 16;
+   u32 previous = 0;
+   u32 next     = 0;
+};
+
+inline void
+StartResampler(Resampler& resampler, u32 input_rate, u32 output_rate)
+{
+   resampler      = Resampler();
+   resampler.step = (u32)(((u64)input_rate << 16) / output_rate);
+}
+
+inline s16
+Lerp16(s16 a, s16 b, u32 phase)
+{
+   // Q15 so that the product fits in a s32
+   return (s16)(a + ((((s32)b - a) * (s32)(phase >> 1)) >> 15));
+}
+
+/*
+   Writes up to count frames to out from the in_count input frames. Returns
+   the number of frames written, in_used is the number of input frames
+   consumed. It stops when it needs more input.
+*/
+inline u32
+Resample(Resampler& r, u32* out, u32 count, const u32* in, u32 in_count,
+         u32& in_used)
+{
+   u32 written = 0;
+   in_used     = 0;
+   while (written < count)
+   {
+      while (r.phase >= (1u << 16))
+      {
+         if (in_used == in_count)
+            return written;
+         r.previous = r.next;
+         r.next     = in[in_used++];
+         r.phase -= 1u << 16;
+      }
+      out[written++] = MakeFrame(
+          Lerp16(LeftSample(r.previous), LeftSample(r.next), r.phase),
+          Lerp16(RightSample(r.previous), RightSample(r.next), r.phase));
+      r.phase += r.step;
+   }
+   return written;
+}
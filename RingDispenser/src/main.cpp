@@ -93,6 +93,9 @@ UpdateSerial()
     }
 }
 
+void ReceiveRingDispenserCommand(Message& message);
+void ReceiveReset(Message& message);
+
 void
 setup()
 {
@@ -130,6 +133,10 @@ setup()
         pinMode(row, INPUT_PULLDOWN);
     }
 
+    SetMessageHandler(MessageType::RingDispenserCommand,
+                      ReceiveRingDispenserCommand);
+    SetMessageHandler(MessageType::Reset, ReceiveReset);
+
     StartWifi();
 }
 
@@ -221,54 +228,50 @@ MakePulsePattern(u8 ring_detected_count)
 }
 
 void
-loop()
+ReceiveRingDispenserCommand(Message& message)
 {
-    Message message = ReceiveMessage();
-    switch (message.header.type)
+    RingDispenserCommand cmd;
+    cmd.serialize(message.deserializer);
+
+    Serial.println(F("RingDispenserCommand"));
+
+    if (cmd.state == RingDispenserState::ForceActivate)
     {
-    case MessageType::RingDispenserCommand:
+        SetAllRingsDetected(true);
+    }
+    else if (cmd.state == RingDispenserState::ForceDeactivate)
     {
-        RingDispenserCommand cmd;
-        cmd.serialize(message.deserializer);
+        SetAllRingsDetected(false);
+    }
+    status.state   = cmd.state;
+    last_cmd_rings = cmd.rings_detected;
 
-        Serial.println(F("RingDispenserCommand"));
+    if (cmd.ask_for_ack)
+    {
+        status.ask_for_ack = false;
+        auto ser           = Serializer(SerializerMode::Serialize,
+                              {packet_buffer, udp_packet_size});
 
-        if (cmd.state == RingDispenserState::ForceActivate)
-        {
-            SetAllRingsDetected(true);
-        }
-        else if (cmd.state == RingDispenserState::ForceDeactivate)
-        {
-            SetAllRingsDetected(false);
-        }
-        status.state   = cmd.state;
-        last_cmd_rings = cmd.rings_detected;
+        status.getHeader().serialize(ser);
+        status.serialize(ser);
 
-        if (cmd.ask_for_ack)
-        {
-            status.ask_for_ack = false;
-            auto ser           = Serializer(SerializerMode::Serialize,
-                                  {packet_buffer, udp_packet_size});
+        SendToServer(ser);
+    }
+}
 
-            status.getHeader().serialize(ser);
-            status.serialize(ser);
+void
+ReceiveReset(Message& message)
+{
+    delay(1000);
+    ESP.restart();
+}
 
-            udp.beginPacket(server_connection.address, server_connection.port);
-            BufferPtr buffer = {ser.full_buffer.start, ser.buffer.start};
-            udp.write(buffer.start, buffer.end - buffer.start);
-            udp.endPacket();
-        }
-    }
-    break;
-    case MessageType::Reset:
-    {
-        delay(1000);
-        ESP.restart();
-    }
-    break;
-    }
+void
+loop()
+{
+    DispatchMessages();
 
-    if (wifi_state != WifiState::Connected)
+    if (!IsServerConnected())
     {
         status.state = RingDispenserState::DetectRings;
     }
@@ -358,7 +361,7 @@ loop()
 
     if (last_cmd_rings != status.rings_detected
         && millis() > time_last_state_sent + resend_period
-        && wifi_state == WifiState::Connected)
+        && IsServerConnected())
     {
         status.ask_for_ack = true;
 
@@ -368,10 +371,7 @@ loop()
         status.getHeader().serialize(ser);
         status.serialize(ser);
 
-        udp.beginPacket(server_connection.address, server_connection.port);
-        BufferPtr buffer = {ser.full_buffer.start, ser.buffer.start};
-        udp.write(buffer.start, buffer.end - buffer.start);
-        udp.endPacket();
+        SendToServer(ser);
         time_last_state_sent = millis();
     }
 
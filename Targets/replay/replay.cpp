@@ -0,0 +1,364 @@
+/*
+   Runs a recorded ADC trace through the detection and game logic of the
+   targets (targets_logic.cpp), as fast as possible. It prints the hits, the
+   detection latency when the trace marks the real hits, and the number of
+   samples processed per second.
+
+   Trace formats, the times are the micros() of the samples:
+   - CSV: one sample per line, "time_us,target,value[,onset]". onset is 1 on
+     the first sample of a real hit. The lines that don't start with a digit
+     are skipped (header, comments).
+   - Binary (.bin): TraceRecord one after the other, little endian.
+
+   Exit code 1 when the trace can't be read, or when a limit given with -r,
+   -e or -n is not met, so it can run in CI. sample_trace.csv is replayed by
+   the test of CMakeLists.txt.
+*/
+#include "targets_logic.hpp"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+ClientId this_client_id = ClientId::Targets;
+
+struct TraceRecord
+{
+    u64 time   = 0;
+    s16 value  = 0;
+    u8  target = 0;
+    u8  onset  = 0;
+    u8  unused[4];
+};
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord is written as is");
+
+// A hit this long after a marked onset detects it
+constexpr u64 max_hit_latency = 100000;
+// udp_packet_size of msg.hpp, the size of the graph messages
+constexpr u32 packet_size = 1024;
+
+struct Hit
+{
+    u64 time;
+    u8  target;
+};
+
+std::vector<u8> dead_targets;
+u32             graph_messages = 0;
+
+void
+TargetDead(u8 target, const char* /*cause*/)
+{
+    dead_targets.push_back(target);
+}
+
+void
+SendTargetsGraphMessage()
+{
+    graph_messages++;
+    for (u8 i = 0; i < max_target_count; i++)
+    {
+        graph.buffer_count[i] = 0;
+    }
+}
+
+bool
+IsClockSynced()
+{
+    return false;
+}
+
+u64
+ToServerMicros(u64 local_time)
+{
+    return local_time;
+}
+
+bool
+EndsWith(const char* str, const char* end)
+{
+    size_t length     = strlen(str);
+    size_t end_length = strlen(end);
+    return length >= end_length
+           && strcmp(str + length - end_length, end) == 0;
+}
+
+bool
+LoadTrace(const char* path, std::vector<TraceRecord>& trace)
+{
+    bool  binary = EndsWith(path, ".bin");
+    FILE* file   = fopen(path, binary ? "rb" : "r");
+    if (!file)
+    {
+        fprintf(stderr, "Can't open %s\n", path);
+        return false;
+    }
+
+    if (binary)
+    {
+        TraceRecord record;
+        while (fread(&record, sizeof(record), 1, file) == 1)
+        {
+            trace.push_back(record);
+        }
+    }
+    else
+    {
+        char line[256];
+        u32  line_number = 0;
+        while (fgets(line, sizeof(line), file))
+        {
+            line_number++;
+            if (line[0] < '0' || line[0] > '9')
+                continue;
+
+            unsigned long long time   = 0;
+            int                target = 0;
+            int                value  = 0;
+            int                onset  = 0;
+            int read = sscanf(line, "%llu,%d,%d,%d", &time, &target, &value,
+                              &onset);
+            if (read < 3 || target < 0 || target >= max_target_count)
+            {
+                fprintf(stderr, "%s:%u: invalid sample\n", path, line_number);
+                fclose(file);
+                return false;
+            }
+            TraceRecord record;
+            record.time   = time;
+            record.target = (u8)target;
+            record.value  = (s16)value;
+            record.onset  = (read == 4 && onset);
+            trace.push_back(record);
+        }
+    }
+    fclose(file);
+
+    for (const auto& record : trace)
+    {
+        if (record.target >= max_target_count)
+        {
+            fprintf(stderr, "%s: invalid target %u\n", path, record.target);
+            return false;
+        }
+    }
+    return true;
+}
+
+void
+PrintUsage()
+{
+    printf("Usage: targets_replay [options] trace.csv|trace.bin\n"
+           "  -t threshold  Threshold of all the targets (peak to peak)\n"
+           "  -w window     Envelope hold of all the targets, in samples\n"
+           "  -g            Fill the graph buffers like the Controller asks\n"
+           "  -q            Don't print each hit\n"
+           "  -r rate       Fail below rate samples per second\n"
+           "  -e            Fail when a marked hit is missed or a hit is "
+           "not marked\n"
+           "  -n count      Fail when there are not count hits\n");
+}
+
+int
+main(int argc, char* argv[])
+{
+    const char* path         = nullptr;
+    s32         threshold    = -1;
+    s32         window       = -1;
+    bool        graph_output = false;
+    bool        quiet        = false;
+    f64         min_rate     = 0;
+    bool        exact        = false;
+    s32         hit_count    = -1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg       = argv[i];
+        bool        has_value = (i + 1 < argc);
+        if (strcmp(arg, "-t") == 0 && has_value)
+            threshold = atoi(argv[++i]);
+        else if (strcmp(arg, "-w") == 0 && has_value)
+            window = atoi(argv[++i]);
+        else if (strcmp(arg, "-g") == 0)
+            graph_output = true;
+        else if (strcmp(arg, "-q") == 0)
+            quiet = true;
+        else if (strcmp(arg, "-r") == 0 && has_value)
+            min_rate = atof(argv[++i]);
+        else if (strcmp(arg, "-e") == 0)
+            exact = true;
+        else if (strcmp(arg, "-n") == 0 && has_value)
+            hit_count = atoi(argv[++i]);
+        else if (arg[0] != '-' && !path)
+            path = arg;
+        else
+        {
+            PrintUsage();
+            return 1;
+        }
+    }
+    if (!path)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    std::vector<TraceRecord> trace;
+    if (!LoadTrace(path, trace))
+        return 1;
+    if (trace.empty())
+    {
+        fprintf(stderr, "%s is empty\n", path);
+        return 1;
+    }
+
+    // The board has the targets up to the last one in the trace
+    u8 board_target_count = 0;
+    for (const auto& record : trace)
+    {
+        if (record.target >= board_target_count)
+            board_target_count = record.target + 1;
+    }
+    SetTargetCount(board_target_count, packet_size);
+
+    for (u8 i = 0; i < max_target_count; i++)
+    {
+        if (threshold >= 0)
+            sensors[i].threshold = (u16)threshold;
+        if (window >= 0)
+            sensors[i].dsp.hold.reset((u16)window);
+    }
+
+    // Every target enabled with enough hitpoints to count all the hits
+    TargetsCommand cmd;
+    cmd.enable           = all_targets;
+    cmd.send_sensor_data = graph_output;
+    for (u8 i = 0; i < max_target_count; i++)
+    {
+        cmd.set_hitpoints[i] = 100;
+    }
+    SetCommand(cmd);
+
+    std::vector<Hit> hits;
+    hits.reserve(1024);
+    u32 detections = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& record : trace)
+    {
+        s8   hitpoints = status.hitpoints[record.target];
+        bool over      = sensors[record.target].dsp.over;
+
+        NewSample(record.target, record.value, record.time);
+
+        if (!over && sensors[record.target].dsp.over)
+            detections++;
+        if (status.hitpoints[record.target] < hitpoints)
+            hits.push_back(Hit{record.time, record.target});
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    // Each marked onset is matched with the first hit on its target
+    u32 onsets      = 0;
+    u32 missed      = 0;
+    u32 matched     = 0;
+    u64 latency_sum = 0;
+    u64 latency_min = UINT64_MAX;
+    u64 latency_max = 0;
+
+    std::vector<bool> hit_matched(hits.size(), false);
+    for (const auto& record : trace)
+    {
+        if (!record.onset)
+            continue;
+        onsets++;
+
+        bool found = false;
+        for (size_t i = 0; i < hits.size(); i++)
+        {
+            const auto& hit = hits[i];
+            if (hit_matched[i] || hit.target != record.target
+                || hit.time < record.time
+                || hit.time - record.time > max_hit_latency)
+            {
+                continue;
+            }
+            u64 latency    = hit.time - record.time;
+            hit_matched[i] = true;
+            found          = true;
+            matched++;
+            latency_sum += latency;
+            if (latency < latency_min)
+                latency_min = latency;
+            if (latency > latency_max)
+                latency_max = latency;
+            break;
+        }
+        if (!found)
+        {
+            missed++;
+            if (!quiet)
+            {
+                printf("Missed   target %u at %.6f s\n", record.target,
+                       record.time / 1000000.0);
+            }
+        }
+    }
+
+    u32 unmarked = 0;
+    for (size_t i = 0; i < hits.size(); i++)
+    {
+        bool is_unmarked = onsets && !hit_matched[i];
+        if (is_unmarked)
+            unmarked++;
+        if (!quiet)
+        {
+            printf("Hit      target %u at %.6f s%s\n", hits[i].target,
+                   hits[i].time / 1000000.0, is_unmarked ? " (unmarked)" : "");
+        }
+    }
+
+    f64 seconds  = std::chrono::duration<f64>(end - start).count();
+    f64 rate     = (seconds > 0) ? trace.size() / seconds : 0;
+    f64 duration = (trace.back().time - trace.front().time) / 1000000.0;
+
+    printf("\n");
+    printf("Samples:     %zu, %.1f s of trace\n", trace.size(), duration);
+    printf("Detections:  %u\n", detections);
+    printf("Hits:        %zu, %zu targets dead\n", hits.size(),
+           dead_targets.size());
+    if (onsets)
+    {
+        printf("Marked hits: %u, %u missed, %u hits not marked\n", onsets,
+               missed, unmarked);
+    }
+    if (matched)
+    {
+        printf("Latency:     min %.2f ms, avg %.2f ms, max %.2f ms\n",
+               latency_min / 1000.0, latency_sum / 1000.0 / matched,
+               latency_max / 1000.0);
+    }
+    if (graph_output)
+        printf("Graph:       %u messages\n", graph_messages);
+    printf("Throughput:  %.0f samples/s, %.1f ns per sample\n", rate,
+           seconds * 1e9 / trace.size());
+
+    int result = 0;
+    if (min_rate > 0 && rate < min_rate)
+    {
+        printf("Slower than %.0f samples/s\n", min_rate);
+        result = 1;
+    }
+    if (exact && (missed || unmarked))
+    {
+        printf("The hits don't match the marked hits\n");
+        result = 1;
+    }
+    if (hit_count >= 0 && hits.size() != (size_t)hit_count)
+    {
+        printf("%zu hits instead of %d\n", hits.size(), hit_count);
+        result = 1;
+    }
+    return result;
+}
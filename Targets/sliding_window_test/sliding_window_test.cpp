@@ -0,0 +1,462 @@
+/*
+   Checks SlidingPeakToPeak against the loop the targets used before, which
+   rescans the whole window on every sample, for every window from 1 to
+   max_window, and that an add removes at most window + 1 entries from the
+   deques. Then the same piezo signal goes through a copy of the original
+   NewSample of the firmware and through the one with SlidingPeakToPeak, and
+   the hits must be the same. Then it times both for a few windows, and the
+   worst case of an add.
+
+   sliding_window_test [benchmark_samples]
+
+   Exit code 1 when a peak to peak or a hit differs.
+*/
+#include "sliding_window.hpp"
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+// The old detector: the last window samples, rescanned for each sample
+struct BruteForcePeakToPeak
+{
+    s16 samples[SlidingPeakToPeak::max_window] = {};
+    u16 next_sample                            = 0;
+    u16 window                                 = 1;
+
+    void
+    reset(u16 window_in)
+    {
+        window      = window_in;
+        next_sample = 0;
+        for (u16 i = 0; i < window; i++)
+        {
+            samples[i] = 0;
+        }
+    }
+
+    u16
+    add(s16 value)
+    {
+        samples[next_sample] = value;
+        next_sample          = (next_sample + 1) % window;
+
+        s16 min = samples[0];
+        s16 max = samples[0];
+        for (u16 i = 1; i < window; i++)
+        {
+            if (samples[i] < min)
+                min = samples[i];
+            if (samples[i] > max)
+                max = samples[i];
+        }
+        return (u16)((s32)max - (s32)min);
+    }
+};
+
+/*
+   Noise with bursts, and runs of the same value and of the extremes so that
+   the deques see ties and long monotonic runs.
+*/
+s16
+NextSample(std::mt19937& rng, u32 i)
+{
+    std::uniform_int_distribution<s32> noise(-50, 50);
+    std::uniform_int_distribution<s32> full(INT16_MIN, INT16_MAX);
+    switch ((i / 500) % 5)
+    {
+    case 0: return (s16)noise(rng);
+    case 1: return (s16)full(rng);
+    case 2: return (s16)(i % 7 ? 100 : -100);
+    case 3: return (s16)((i % 300) * 100 - 15000);
+    default: return (i % 2) ? INT16_MAX : INT16_MIN;
+    }
+}
+
+u32
+CheckWindow(u16 window, u32 sample_count)
+{
+    SlidingPeakToPeak    sliding;
+    BruteForcePeakToPeak brute;
+    sliding.reset(window);
+    brute.reset(window);
+
+    std::mt19937 rng(window);
+    u32          max_removed = 0;
+    for (u32 i = 0; i < sample_count; i++)
+    {
+        s16 value    = NextSample(rng, i);
+        u32 before   = sliding.mins.count + sliding.maxs.count;
+        u16 expected = brute.add(value);
+        u16 result   = sliding.add(value);
+        if (result != expected)
+        {
+            printf("Window %u, sample %u: %u instead of %u\n", window, i,
+                   result, expected);
+            return 1;
+        }
+        // add pushes one entry in each deque
+        u32 removed = before + 2 - (sliding.mins.count + sliding.maxs.count);
+        if (removed > max_removed)
+            max_removed = removed;
+    }
+    if (max_removed > (u32)window + 1)
+    {
+        printf("Window %u: an add removed %u entries\n", window, max_removed);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+   Time of the slowest add: a falling run fills the max deque, then a bigger
+   sample empties it. Each of these adds is timed alone, the median time to
+   read the clock is taken off the median.
+*/
+f64
+WorstAddNanos(u16 window, u32 repeat, u32& sum)
+{
+    SlidingPeakToPeak sliding;
+    sliding.reset(window);
+    // Not a constant, or the compiler sees that nothing is bigger
+    volatile s16 spike = 1000;
+
+    std::vector<f64> adds(repeat);
+    std::vector<f64> clocks(repeat);
+    for (u32 r = 0; r < repeat; r++)
+    {
+        for (u16 i = 0; i < window; i++)
+        {
+            sum += sliding.add((s16)(-100 * i));
+        }
+        auto start = std::chrono::steady_clock::now();
+        sum += sliding.add(spike);
+        auto end = std::chrono::steady_clock::now();
+        adds[r]  = std::chrono::duration<f64, std::nano>(end - start).count();
+
+        start     = std::chrono::steady_clock::now();
+        end       = std::chrono::steady_clock::now();
+        clocks[r] = std::chrono::duration<f64, std::nano>(end - start).count();
+    }
+    std::nth_element(adds.begin(), adds.begin() + repeat / 2, adds.end());
+    std::nth_element(clocks.begin(), clocks.begin() + repeat / 2,
+                     clocks.end());
+    return adds[repeat / 2] - clocks[repeat / 2];
+}
+
+// A hit counted by NewSample
+struct Hit
+{
+    u32 sample;
+    s8  hitpoints;
+
+    bool
+    operator!=(const Hit& other) const
+    {
+        return sample != other.sample || hitpoints != other.hitpoints;
+    }
+};
+
+// The state of a target that NewSample uses, in place of the globals of the
+// firmware
+struct Target
+{
+    bool             enabled   = true;
+    s8               hitpoints = 5;
+    u32              sample    = 0; // Index of the current sample
+    std::vector<Hit> hits;
+};
+
+// The Sensor of the firmware before SlidingPeakToPeak
+struct OriginalSensor
+{
+    static constexpr u16 sample_count = 8;
+
+    s16  samples[sample_count] = {};
+    u16  next_sample           = 0;
+    bool over_threshold        = false;
+    u32  hit_time              = 0;
+    u16  threshold             = 2000;
+
+    // What the signal went through, so that the test checks it is covered
+    u16 last_peak_to_peak = 0;
+    u32 rearm_count       = 0; // Under threshold / 2 after being over it
+    u32 held_count        = 0; // Over it again without going under / 2
+    u32 cooldown_count    = 0; // Over it again during the cooldown
+};
+
+// The original NewSample, without the graph and the network
+void
+OriginalNewSample(OriginalSensor& ch, Target& target, s16 value, u64 time)
+{
+    ch.samples[ch.next_sample] = value;
+    ch.next_sample             = (ch.next_sample + 1) % ch.sample_count;
+
+    s16 min = ch.samples[0];
+    s16 max = ch.samples[0];
+    for (u16 i = 1; i < ch.sample_count; i++)
+    {
+        if (ch.samples[i] < min)
+            min = ch.samples[i];
+        if (ch.samples[i] > max)
+            max = ch.samples[i];
+    }
+
+    u16 peak_to_peak = (s32)max - (s32)min;
+
+    bool was_high        = ch.last_peak_to_peak >= ch.threshold;
+    ch.last_peak_to_peak = peak_to_peak;
+    if (peak_to_peak >= ch.threshold)
+    {
+        if (ch.over_threshold && !was_high)
+            ch.held_count++;
+        if (!ch.over_threshold)
+        {
+            ch.over_threshold = true;
+            if (target.enabled)
+            {
+                constexpr s8  hp_min       = -10;
+                constexpr u32 hit_cooldown = 1000;
+                u32           time_ms      = time / 1000;
+                if (ch.hit_time == 0 || time_ms > ch.hit_time + hit_cooldown)
+                {
+                    ch.hit_time = time_ms;
+                    if (target.hitpoints > hp_min)
+                    {
+                        target.hitpoints--;
+                        target.hits.push_back(
+                            {target.sample, target.hitpoints});
+                    }
+                }
+                else
+                {
+                    ch.cooldown_count++;
+                }
+            }
+        }
+    }
+    else if (peak_to_peak < ch.threshold / 2)
+    {
+        if (ch.over_threshold)
+            ch.rearm_count++;
+        ch.over_threshold = false;
+    }
+}
+
+// The Sensor of the firmware with SlidingPeakToPeak
+struct SlidingSensor
+{
+    SlidingPeakToPeak peak_to_peak;
+    bool              over_threshold = false;
+    u32               hit_time       = 0;
+    u16               threshold      = 2000;
+};
+
+// NewSample with SlidingPeakToPeak, without the graph and the network
+void
+SlidingNewSample(SlidingSensor& ch, Target& target, s16 value, u64 time)
+{
+    u16 peak_to_peak = ch.peak_to_peak.add(value);
+
+    if (peak_to_peak >= ch.threshold)
+    {
+        if (!ch.over_threshold)
+        {
+            ch.over_threshold = true;
+            if (target.enabled)
+            {
+                constexpr s8  hp_min       = -10;
+                constexpr u32 hit_cooldown = 1000;
+                u32           time_ms      = time / 1000;
+                if (ch.hit_time == 0 || time_ms > ch.hit_time + hit_cooldown)
+                {
+                    ch.hit_time = time_ms;
+                    if (target.hitpoints > hp_min)
+                    {
+                        target.hitpoints--;
+                        target.hits.push_back(
+                            {target.sample, target.hitpoints});
+                    }
+                }
+            }
+        }
+    }
+    else if (peak_to_peak < ch.threshold / 2)
+    {
+        ch.over_threshold = false;
+    }
+}
+
+/*
+   A piezo made of segments of constant amplitude, with noise. The peak to
+   peak of a segment is a fraction of the threshold: under half of it, between
+   half and the threshold, where the hysteresis holds, or over it. Most
+   segments are much shorter than the cooldown, some are long silences.
+   The target is disabled from time to time.
+*/
+u32
+CheckHits(u16 threshold, u32 sample_count)
+{
+    // An ADS1115 at 860 SPS shared by 2 channels
+    constexpr u64 sample_period = 1000000 / 430;
+    const f32     fractions[]   = {0.1f, 0.4f, 0.6f, 0.9f, 1.1f, 2.f, 4.f};
+
+    std::mt19937                       rng(threshold);
+    std::uniform_int_distribution<s32> noise(-30, 30);
+    std::uniform_int_distribution<u32> fraction(0, 6);
+    std::uniform_int_distribution<u32> length(1, 40);
+    std::uniform_int_distribution<u32> silence(100, 800);
+    std::uniform_int_distribution<u32> one_in(0, 9);
+
+    OriginalSensor original;
+    SlidingSensor  sliding;
+    original.threshold = threshold;
+    sliding.threshold  = threshold;
+    sliding.peak_to_peak.reset(OriginalSensor::sample_count);
+    Target original_target;
+    Target sliding_target;
+
+    f32 amplitude = 0.f;
+    u32 remaining = 0;
+    u64 time      = 1000000;
+    for (u32 i = 0; i < sample_count; i++, time += sample_period)
+    {
+        if (remaining == 0)
+        {
+            if (one_in(rng) == 0)
+            {
+                amplitude = 0.f;
+                remaining = silence(rng);
+            }
+            else
+            {
+                // Half the peak to peak, the sign alternates every sample
+                amplitude = threshold * fractions[fraction(rng)] / 2.f;
+                remaining = length(rng);
+            }
+            if (one_in(rng) == 0)
+            {
+                original_target.enabled = !original_target.enabled;
+                sliding_target.enabled  = original_target.enabled;
+            }
+        }
+        remaining--;
+
+        s32 value = (s32)((i % 2) ? amplitude : -amplitude) + noise(rng);
+        if (value > INT16_MAX)
+            value = INT16_MAX;
+        if (value < INT16_MIN)
+            value = INT16_MIN;
+
+        original_target.sample = i;
+        sliding_target.sample  = i;
+        OriginalNewSample(original, original_target, (s16)value, time);
+        SlidingNewSample(sliding, sliding_target, (s16)value, time);
+
+        // Like the Controller after a death
+        if (original_target.hitpoints <= 0)
+            original_target.hitpoints = 5;
+        if (sliding_target.hitpoints <= 0)
+            sliding_target.hitpoints = 5;
+    }
+
+    auto& expected = original_target.hits;
+    auto& result   = sliding_target.hits;
+    printf("Threshold %u: %u hits, %u rearms, %u held by the hysteresis, %u "
+           "in the cooldown\n",
+           threshold, (u32)expected.size(), original.rearm_count,
+           original.held_count, original.cooldown_count);
+    if (expected.empty() || !original.rearm_count || !original.held_count
+        || !original.cooldown_count)
+    {
+        printf("Threshold %u: the signal doesn't cover the detection\n",
+               threshold);
+        return 1;
+    }
+    for (u32 i = 0; i < expected.size() || i < result.size(); i++)
+    {
+        if (i >= expected.size() || i >= result.size()
+            || expected[i] != result[i])
+        {
+            printf("Threshold %u: hit %u differs", threshold, i);
+            if (i < expected.size())
+                printf(", expected sample %u", expected[i].sample);
+            if (i < result.size())
+                printf(", got sample %u", result[i].sample);
+            printf("\n");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+template<typename Detector>
+f64
+NanosPerSample(Detector& detector, const s16* samples, u32 count, u32& sum)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (u32 i = 0; i < count; i++)
+    {
+        sum += detector.add(samples[i]);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<f64, std::nano>(end - start).count() / count;
+}
+
+int
+main(int argc, char* argv[])
+{
+    u32 benchmark_samples = (argc > 1) ? (u32)atoi(argv[1]) : 2000000;
+
+    u32 failures = 0;
+    for (u16 window = 1; window <= SlidingPeakToPeak::max_window; window++)
+    {
+        failures += CheckWindow(window, 20000);
+    }
+    // Out of range windows are clamped
+    SlidingPeakToPeak clamped;
+    clamped.reset(0);
+    failures += (clamped.window != 1);
+    clamped.reset(SlidingPeakToPeak::max_window + 1);
+    failures += (clamped.window != SlidingPeakToPeak::max_window);
+
+    for (u16 threshold : {300, 2000, 12000})
+    {
+        failures += CheckHits(threshold, 200000);
+    }
+
+    std::vector<s16> samples(benchmark_samples);
+    std::mt19937     rng(1);
+    for (u32 i = 0; i < benchmark_samples; i++)
+    {
+        samples[i] = NextSample(rng, i);
+    }
+    printf("window  sliding ns  brute force ns  worst add ns\n");
+    // Printed so that the loops are not optimized out
+    u32 sum = 0;
+    for (u16 window : {1, 8, 32, 128})
+    {
+        SlidingPeakToPeak    sliding;
+        BruteForcePeakToPeak brute;
+        sliding.reset(window);
+        brute.reset(window);
+        f64 sliding_ns =
+            NanosPerSample(sliding, samples.data(), benchmark_samples, sum);
+        f64 brute_ns =
+            NanosPerSample(brute, samples.data(), benchmark_samples, sum);
+        f64 worst_ns = WorstAddNanos(window, 10000, sum);
+        printf("%6u  %10.1f  %14.1f  %12.1f\n", window, sliding_ns, brute_ns,
+               worst_ns);
+    }
+    printf("(%u)\n", sum);
+
+    if (failures)
+    {
+        printf("%u checks failed\n", failures);
+        return 1;
+    }
+    printf("Passed\n");
+    return 0;
+}
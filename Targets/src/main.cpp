@@ -5,8 +5,14 @@
 
 #include "alias.hpp"
 #include "msg.hpp"
+#include "net_msg.hpp"
 #include "message_targets.hpp"
 #include "serial_in.hpp"
+#include "spsc_queue.hpp"
+#include "targets_logic.hpp"
+
+#include <esp_timer.h>
+#include <soc/soc_caps.h>
 
 ClientId this_client_id = ClientId::Targets;
 
@@ -52,72 +58,189 @@ struct Button
     u32 debounce      = 0;
 };
 
+struct I2cPins
+{
+    u8 sda;
+    u8 scl;
+};
+
+/*
+   An ADS1115 has 4 possible addresses (its ADDR pin to GND, VDD, SDA or SCL),
+   a second I2C bus takes 4 more. The targets are numbered in the order of the
+   ADC channels in adcs, SERVO_COMMAND and buttons have one entry per target.
+
+   The S3 board has the 4 ADS1115 of its bus, so 8 targets. That is as many
+   servos as it has LEDC channels, and it has no free pins left for more
+   buttons. The 16 targets of the messages take the second bus and a chip
+   with 16 LEDC channels, the ESP32.
+*/
 #if MINI_C3
-constexpr u8 I2C_SDA = 2;
-constexpr u8 I2C_SCL = 1;
+constexpr I2cPins I2C_BUSES[] = {{2, 1}};
 #elif WROOM
-constexpr u8 I2C_SDA = 32;
-constexpr u8 I2C_SCL = 33;
+constexpr I2cPins I2C_BUSES[] = {{32, 33}};
 #elif ESP32S3
-constexpr u8 I2C_SDA = 4;
-constexpr u8 I2C_SCL = 5;
+constexpr I2cPins I2C_BUSES[] = {{4, 5}};
 
 constexpr u8 INBUILT_LED_OUT = 48;
 
-constexpr u8 SERVO_COMMAND[target_count] = {6, 7, 15, 17};
-Button       buttons[target_count]       = {{9}, {10}, {11}, {12}};
+constexpr u8 SERVO_COMMAND[] = {6, 7, 15, 17, 16, 18, 8, 14};
+Button       buttons[]       = {{9}, {10}, {11}, {12}, {38}, {39}, {40}, {41}};
 
 constexpr u8 SWITCH        = 21;
 constexpr u8 DOOR_LOCK_OUT = 13;
+
+// ALERT/RDY pins of the ADS1115, in the order of adcs
+constexpr u8 ADC_READY[] = {1, 2, 42, 47};
 #endif
 
-TwoWire i2c = TwoWire(0);
+constexpr u8 i2c_bus_count = sizeof(I2C_BUSES) / sizeof(I2C_BUSES[0]);
+TwoWire      i2c_buses[]   = {TwoWire(0), TwoWire(1)};
+static_assert(i2c_bus_count <= sizeof(i2c_buses) / sizeof(i2c_buses[0]),
+              "The ESP32 has 2 I2C controllers");
 
 constexpr u16 servo_pwm_bits   = 12;
 constexpr u16 servo_closed_pwm = ((u16)1 << servo_pwm_bits) / 20.0 * 2;
 constexpr u16 servo_open_pwm   = ((u16)1 << servo_pwm_bits) / 20.0 * 1;
 
-u32           last_servo_command_time[target_count] = {};
-constexpr u32 servo_command_duration                = 1000;
-f32           servos_closed[target_count]           = {};
-bool          servos_closing[target_count]          = {}; // Closing or opening
-
-struct Sensor
-{
-    static constexpr u16 sample_count = 8;
-
-    s16  samples[sample_count] = {};
-    u16  next_sample           = 0;
-    u8   target_index          = 0;
-    bool over_threshold        = false;
-    u32  hit_time              = 0;
-    u16  threshold             = 2000;
-};
-
 struct Adc
 {
-    Adc(u8 addr) : ads(addr, &i2c) {}
+    Adc(u8 addr, u8 bus) : ads(addr, &i2c_buses[bus]) {}
 
     ADS1115 ads;
-    Sensor  channels[2];
+    u8      targets[2]   = {}; // Of the channels
     u8      curr_request = 0;
+    bool    connected    = false;
 };
 
 Adc adcs[] = {
-    Adc(0x48 | 0b00), //
-    Adc(0x48 | 0b01), //
+    Adc(0x48 | 0b00, 0), //
+    Adc(0x48 | 0b01, 0), //
+    Adc(0x48 | 0b10, 0), //
+    Adc(0x48 | 0b11, 0), //
 };
 constexpr u8 adc_count = sizeof(adcs) / sizeof(adcs[0]);
+static_assert(sizeof(ADC_READY) == adc_count, "One ALERT/RDY pin per ADC");
+
+constexpr u8 board_target_count = adc_count * 2;
+static_assert(board_target_count <= max_target_count, "Too many targets");
+static_assert(sizeof(SERVO_COMMAND) == board_target_count,
+              "One servo per target");
+static_assert(sizeof(buttons) / sizeof(buttons[0]) == board_target_count,
+              "One button per target");
+
+// The LEDC channel of a servo is its target index. The ESP32 has a low and a
+// high speed group of channels, the S3 and the C3 only the low speed one.
+#ifdef SOC_LEDC_SUPPORT_HS_MODE
+constexpr u8 ledc_channel_count = SOC_LEDC_CHANNEL_NUM * 2;
+#else
+constexpr u8 ledc_channel_count = SOC_LEDC_CHANNEL_NUM;
+#endif
+static_assert(board_target_count <= ledc_channel_count,
+              "One LEDC channel per servo");
+
+u32           last_servo_command_time[board_target_count] = {};
+constexpr u32 servo_command_duration                      = 1000;
+f32           servos_closed[board_target_count]           = {};
+bool          servos_closing[board_target_count]          = {}; // Or opening
+
+/*
+   The ADS1115 convert continuously and pulse their ALERT/RDY pin when a
+   conversion is ready. The interrupt wakes the acquisition task, it switches
+   the ADC to its other channel, reads the conversion and pushes it to
+   adc_samples. loop only reads the samples from there, it never waits for the
+   I2C bus. Each channel gets half of the 860 SPS, minus the time to switch.
+   When adc_samples is full the sample is counted in samples_dropped (msg.hpp),
+   sent in the telemetry.
+*/
+struct AdcSample
+{
+    u64 time   = 0; // esp_timer_get_time()
+    s16 value  = 0;
+    u8  sensor = 0; // Index in sensors
+};
+SpscQueue<AdcSample, 64> adc_samples;
+
+TaskHandle_t          adc_task          = nullptr;
+constexpr UBaseType_t adc_task_priority = 3; // Above loop
+constexpr TickType_t  adc_ready_timeout = pdMS_TO_TICKS(10);
 
-TargetsStatus status;
-bool          need_resend_status   = false;
 constexpr u32 resend_period        = 100;
 u32           time_last_state_sent = 0;
 
-TargetsGraph graph;
-
 CRGB led_color;
 
+void IRAM_ATTR
+AdcReadyIsr(void* arg)
+{
+    BaseType_t woken = pdFALSE;
+    xTaskNotifyFromISR(adc_task, 1 << (u32)arg, eSetBits, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+void
+RequestChannel(Adc& adc)
+{
+    if (adc.curr_request == 0)
+    {
+        adc.ads.requestADC_Differential_0_1();
+    }
+    else
+    {
+        adc.ads.requestADC_Differential_2_3();
+    }
+}
+
+void
+RequestNextChannel(Adc& adc)
+{
+    adc.curr_request = (adc.curr_request == 0) ? 1 : 0;
+    RequestChannel(adc);
+}
+
+void
+AdcTask(void*)
+{
+    while (true)
+    {
+        u32 ready = 0;
+        if (!xTaskNotifyWait(0, UINT32_MAX, &ready, adc_ready_timeout))
+        {
+            // A pulse was missed, the conversions are restarted
+            for (auto& adc : adcs)
+            {
+                if (adc.connected)
+                    RequestChannel(adc);
+            }
+            continue;
+        }
+
+        for (u8 j = 0; j < adc_count; j++)
+        {
+            auto& adc = adcs[j];
+            if (!(ready & (1 << j)) || !adc.connected)
+                continue;
+
+            u8 channel = adc.curr_request;
+            // The next conversion starts while we read this one
+            RequestNextChannel(adc);
+
+            AdcSample sample;
+            sample.time   = esp_timer_get_time();
+            sample.value  = adc.ads.getValue();
+            sample.sensor = adc.targets[channel];
+            if (AdcSample* slot = adc_samples.back())
+            {
+                *slot = sample;
+                adc_samples.push();
+            }
+            else
+            {
+                samples_dropped++;
+            }
+        }
+    }
+}
+
 void
 CloseServo(u8 index, f32 closed)
 {
@@ -145,6 +268,7 @@ PrintSerialCommands()
     Serial.println(F("reset"));
     Serial.println(F("scan"));
     Serial.println(F("thresholds 2000 2000 2000 2000"));
+    Serial.println(F("windows 8 8 8 8"));
     Serial.println(F(""));
 }
 
@@ -229,10 +353,81 @@ StringMatch(const char* str1, const char* end1, const char* str2)
     return false;
 }
 
+// Length of the peak to peak window of each sensor, in samples
+void
+SaveWindows()
+{
+    if (!LittleFS.begin())
+    {
+        Serial.println(F("LittleFS Mount Failed"));
+        return;
+    }
+    File file = LittleFS.open("/windows", "w");
+    if (file)
+    {
+        for (u8 i = 0; i < board_target_count; i++)
+        {
+            u16 window = sensors[i].dsp.hold.window;
+            file.write((u8*)&window, sizeof(window));
+        }
+        file.close();
+    }
+    else
+    {
+        Serial.println(F("Can't create window file"));
+    }
+    LittleFS.end();
+}
+
+void
+LoadWindows()
+{
+    if (!LittleFS.begin())
+    {
+        Serial.println(F("LittleFS Mount Failed"));
+        return;
+    }
+    File file = LittleFS.open("/windows", "r");
+    if (file)
+    {
+        Serial.println(F("Loading window file"));
+        for (u8 i = 0; i < board_target_count; i++)
+        {
+            u16 window = SlidingPeakToPeak::default_window;
+            file.read((u8*)&window, sizeof(window));
+            sensors[i].dsp.hold.reset(window);
+        }
+        file.close();
+    }
+    LittleFS.end();
+}
+
+void
+PrintWindows()
+{
+    Serial.println();
+    for (u8 i = 0; i < board_target_count; i++)
+    {
+        Serial.printf("window %d = %d\n", i, sensors[i].dsp.hold.window);
+    }
+    Serial.println();
+}
+
+void
+PrintThresholds()
+{
+    Serial.println();
+    for (u8 i = 0; i < board_target_count; i++)
+    {
+        Serial.printf("threshold %d = %d\n", i, sensors[i].threshold);
+    }
+    Serial.println();
+}
+
 void
 UpdateSerial()
 {
-    if (auto* str = ReadSerial())
+    if (auto* str = ReadNetSerial())
     {
         auto* cmd = ReadWord(&str);
 
@@ -247,39 +442,22 @@ UpdateSerial()
         }
         else if (StringMatch(cmd, str, "thresholds"))
         {
-            for (u8 j = 0; j < adc_count; j++)
-            {
-                for (u8 i = 0; i < 2; i++)
-                {
-                    ReadSpaces(&str);
-                    auto& th = adcs[j].channels[i].threshold = ReadU16(&str);
-                }
-            }
-
-            Serial.println();
-            for (u8 j = 0; j < adc_count; j++)
+            for (u8 i = 0; i < board_target_count; i++)
             {
-                for (u8 i = 0; i < 2; i++)
-                {
-                    Serial.printf("threshold %d = %d\n",
-                                  adcs[j].channels[i].target_index,
-                                  adcs[j].channels[i].threshold);
-                }
+                ReadSpaces(&str);
+                sensors[i].threshold = ReadU16(&str);
             }
-            Serial.println();
+            PrintThresholds();
 
             if (LittleFS.begin())
             {
                 File file = LittleFS.open("/thresholds", "w");
                 if (file)
                 {
-                    for (u8 j = 0; j < adc_count; j++)
+                    for (u8 i = 0; i < board_target_count; i++)
                     {
-                        for (u8 i = 0; i < 2; i++)
-                        {
-                            auto& th = adcs[j].channels[i].threshold;
-                            file.write((u8*)&th, sizeof(th));
-                        }
+                        auto& th = sensors[i].threshold;
+                        file.write((u8*)&th, sizeof(th));
                     }
                     file.close();
                 }
@@ -295,6 +473,16 @@ UpdateSerial()
                 Serial.println(F("LittleFS Mount Failed"));
             }
         }
+        else if (StringMatch(cmd, str, "windows"))
+        {
+            for (u8 i = 0; i < board_target_count; i++)
+            {
+                ReadSpaces(&str);
+                sensors[i].dsp.hold.reset(ReadU16(&str));
+            }
+            PrintWindows();
+            SaveWindows();
+        }
         else
         {
             Serial.print(F("Unknown command: "));
@@ -309,6 +497,9 @@ UpdateSerial()
     }
 }
 
+void ReceiveTargetsCommand(Message& message);
+void ReceiveReset(Message& message);
+
 void
 setup()
 {
@@ -326,13 +517,19 @@ setup()
 
     PrintSerialCommands();
 
-    if (!i2c.setPins(I2C_SDA, I2C_SCL))
+    for (u8 i = 0; i < i2c_bus_count; i++)
     {
-        Serial.print(F("i2c.setPins error\n"));
-    }
-    if (!i2c.begin())
-    {
-        Serial.print(F("i2c.begin error\n"));
+        auto& i2c = i2c_buses[i];
+        if (!i2c.setPins(I2C_BUSES[i].sda, I2C_BUSES[i].scl))
+        {
+            Serial.print(F("i2c.setPins error\n"));
+        }
+        if (!i2c.begin())
+        {
+            Serial.print(F("i2c.begin error\n"));
+        }
+        // Each conversion is a read and a write of the config
+        i2c.setClock(400000);
     }
 
     for (u8 j = 0; j < adc_count; j++)
@@ -341,11 +538,12 @@ setup()
 
         for (u8 i = 0; i < 2; i++)
         {
-            adc.channels[i].target_index = j * 2 + i;
+            adc.targets[i] = j * 2 + i;
         }
 
         adc.ads.begin();
-        if (adc.ads.isConnected())
+        adc.connected = adc.ads.isConnected();
+        if (adc.connected)
         {
             Serial.print(F("ADS1115 is connected\n"));
         }
@@ -364,9 +562,14 @@ setup()
          *  16 	         ±0.256V
          */
         adc.ads.setGain(8);
-        adc.ads.setMode(1);     // Single shot mode
+        adc.ads.setMode(0);     // Continuous mode
         adc.ads.setDataRate(7); // 6: 475 SPS, 7: 860
 
+        // ALERT/RDY pulses low when a conversion is ready
+        adc.ads.setComparatorThresholdHigh((s16)0x8000);
+        adc.ads.setComparatorThresholdLow(0x0000);
+        adc.ads.setComparatorQueConvert(0);
+
         adc.curr_request = 0;
         adc.ads.requestADC_Differential_0_1();
     }
@@ -377,13 +580,10 @@ setup()
         if (file)
         {
             Serial.println(F("Loading threshold file"));
-            for (u8 j = 0; j < adc_count; j++)
+            for (u8 i = 0; i < board_target_count; i++)
             {
-                for (u8 i = 0; i < 2; i++)
-                {
-                    auto& th = adcs[j].channels[i].threshold;
-                    file.read((u8*)&th, sizeof(th));
-                }
+                auto& th = sensors[i].threshold;
+                file.read((u8*)&th, sizeof(th));
             }
             file.close();
         }
@@ -399,19 +599,12 @@ setup()
         Serial.println(F("LittleFS Mount Failed"));
     }
 
-    Serial.println();
-    for (u8 j = 0; j < adc_count; j++)
-    {
-        for (u8 i = 0; i < 2; i++)
-        {
-            Serial.printf("threshold %d = %d\n",
-                          adcs[j].channels[i].target_index,
-                          adcs[j].channels[i].threshold);
-        }
-    }
-    Serial.println();
+    PrintThresholds();
+
+    LoadWindows();
+    PrintWindows();
 
-    for (u8 i = 0; i < target_count; i++)
+    for (u8 i = 0; i < board_target_count; i++)
     {
         ledcSetup(i, 50 /*Hz*/, servo_pwm_bits);
         ledcAttachPin(SERVO_COMMAND[i], i);
@@ -424,25 +617,52 @@ setup()
     pinMode(SWITCH, INPUT_PULLUP);
     bool AP_mode = (digitalRead(SWITCH) == LOW);
 
+    SetTargetCount(board_target_count, udp_packet_size);
+    SetMessageHandler(MessageType::TargetsCommand, ReceiveTargetsCommand);
+    SetMessageHandler(MessageType::Reset, ReceiveReset);
+
+    xTaskCreatePinnedToCore(AdcTask, "adc", 4096, nullptr, adc_task_priority,
+                            &adc_task, ARDUINO_RUNNING_CORE);
+    for (u8 j = 0; j < adc_count; j++)
+    {
+        pinMode(ADC_READY[j], INPUT_PULLUP);
+        attachInterruptArg(ADC_READY[j], AdcReadyIsr, (void*)(u32)j, FALLING);
+    }
+
     Serial.println(F("Start wifi"));
-    StartWifi(AP_mode);
+    // The network runs on core 0, the sensors are read on core 1
+    StartNetMsgTask(AP_mode);
 }
 
 void
 SendTargetsGraphMessage()
 {
-    auto ser =
-        Serializer(SerializerMode::Serialize, {packet_buffer, udp_packet_size});
+    auto ser = Serializer(SerializerMode::Serialize,
+                          {app_packet_buffer, udp_packet_size});
+
+    graph.server_time = IsClockSynced();
+    for (u8 i = 0; i < board_target_count; i++)
+    {
+        u16 count = graph.buffer_count[i];
+        if (!count)
+            continue;
+        graph.start_time[i] = graph_first_time[i];
+        if (graph.server_time)
+            graph.start_time[i] = ToServerMicros(graph_first_time[i]);
+        graph.sample_period[i] = 0;
+        if (count > 1)
+        {
+            graph.sample_period[i] =
+                (u32)((graph_last_time[i] - graph_first_time[i]) / (count - 1));
+        }
+    }
 
     graph.getHeader().serialize(ser);
     graph.serialize(ser);
 
-    udp.beginPacket(server_connection.address, server_connection.port);
-    BufferPtr buffer = {ser.full_buffer.start, ser.buffer.start};
-    udp.write(buffer.start, buffer.end - buffer.start);
-    udp.endPacket();
+    QueueToServer(ser);
 
-    for (u8 i = 0; i < target_count; i++)
+    for (u8 i = 0; i < board_target_count; i++)
     {
         graph.buffer_count[i] = 0;
     }
@@ -456,231 +676,85 @@ Kill(u8 i)
 }
 
 void
-SetCommand(TargetsCommand cmd)
+TargetDead(u8 target, const char* cause)
 {
-    need_resend_status = false;
-    for (u8 i = 0; i < target_count; i++)
-    {
-        if (cmd.set_hitpoints[i] >= 0)
-        {
-            status.hitpoints[i] = cmd.set_hitpoints[i];
-
-            if (status.hitpoints[i] <= 0)
-            {
-                Serial.printf("Target %hhd dead from command\n", i);
-                Kill(i);
-            }
-        }
-        else if (cmd.hitpoints[i] != status.hitpoints[i])
-        {
-            need_resend_status = true;
-        }
-
-        u8 bit = (1 << i);
-        if (status.enabled & bit != cmd.enable & bit)
-        {
-            if (cmd.enable & bit)
-            {
-                // Enabled
-            }
-            else
-            {
-                // Disabled
-            }
-        }
-    }
-
-    for (u8 j = 0; j < adc_count; j++)
-    {
-        for (u8 i = 0; i < 2; i++)
-        {
-            const auto& th           = adcs[j].channels[i].threshold;
-            const auto& index        = adcs[j].channels[i].target_index;
-            status.thresholds[index] = th;
-        }
-    }
-
-    status.enabled    = cmd.enable;
-    status.door_state = cmd.door_state;
-    if (status.send_sensor_data != cmd.send_sensor_data)
-    {
-        if (status.send_sensor_data && graph.buffer_count)
-        {
-            // We send what's in the buffer
-            SendTargetsGraphMessage();
-        }
-        status.send_sensor_data = cmd.send_sensor_data;
-    }
+    Serial.printf("Target %hhd dead from %s\n", target, cause);
+    Kill(target);
 }
 
 void
-NewSample(Sensor& ch, s16 value)
+ReceiveTargetsCommand(Message& message)
 {
-    ch.samples[ch.next_sample] = value;
-    ch.next_sample             = (ch.next_sample + 1) % ch.sample_count;
+    TargetsCommand cmd;
+    cmd.serialize(message.deserializer);
 
-    s16 min = ch.samples[0];
-    s16 max = ch.samples[0];
-    for (u16 i = 1; i < ch.sample_count; i++)
-    {
-        if (ch.samples[i] < min)
-            min = ch.samples[i];
-        if (ch.samples[i] > max)
-            max = ch.samples[i];
-    }
+    Serial.println(F("TargetsCommand"));
 
-    u16 peak_to_peak = (s32)max - (s32)min;
+    SetCommand(cmd);
 
-    if (status.send_sensor_data)
+    if (cmd.ask_for_ack)
     {
-        auto& count = graph.buffer_count[ch.target_index];
-        if (count >= graph.buffer_max_count)
-        {
-            SendTargetsGraphMessage();
-        }
-        graph.buffer[ch.target_index][count] = peak_to_peak;
-        count++;
-    }
+        status.ask_for_ack = false;
 
-    // if (status.enabled & (1 << ch.target_index))
-    // {
-    // Serial.printf(">piezo%d:%d\n", ch.target_index, peak_to_peak);
-    // Serial.printf(">piezo_value%d:%d\n", ch.target_index, value);
-    // Serial.printf(">avg%d:%d\n", ch.target_index, ch.average / 256);
-    // }
+        auto ser = Serializer(SerializerMode::Serialize,
+                              {app_packet_buffer, udp_packet_size});
 
-    if (peak_to_peak >= ch.threshold)
-    {
-        if (!ch.over_threshold)
-        {
-            ch.over_threshold = true;
-            if (status.enabled & (1 << ch.target_index))
-            {
-                constexpr s8  hp_min       = -10;
-                constexpr u32 hit_cooldown = 1000;
-                auto          time         = millis();
-                if (ch.hit_time == 0 || time > ch.hit_time + hit_cooldown)
-                {
-                    ch.hit_time = time;
-                    if (status.hitpoints[ch.target_index] > hp_min)
-                    {
-                        status.hitpoints[ch.target_index]--;
-                        need_resend_status = true;
-
-                        if (status.hitpoints[ch.target_index] <= 0)
-                        {
-                            Serial.printf("Target %hhd dead from hit\n",
-                                          ch.target_index);
-                            Kill(ch.target_index);
-                        }
-                    }
-                }
-            }
-        }
-    }
-    else if (peak_to_peak < ch.threshold / 2)
-    {
-        ch.over_threshold = false;
+        status.getHeader().serialize(ser);
+        status.serialize(ser);
+
+        QueueToServer(ser);
+        time_last_state_sent = millis();
     }
 }
 
+void
+ReceiveReset(Message& message)
+{
+    delay(1000);
+    ESP.restart();
+}
+
 void
 loop()
 {
-    if (need_resend_status && wifi_state == WifiState::Connected)
+    if (need_resend_status && IsServerConnected())
     {
         if (millis() > time_last_state_sent + resend_period)
         {
             status.ask_for_ack = true;
 
             auto ser = Serializer(SerializerMode::Serialize,
-                                  {packet_buffer, udp_packet_size});
+                                  {app_packet_buffer, udp_packet_size});
 
             status.getHeader().serialize(ser);
             status.serialize(ser);
 
-            udp.beginPacket(server_connection.address, server_connection.port);
-            BufferPtr buffer = {ser.full_buffer.start, ser.buffer.start};
-            udp.write(buffer.start, buffer.end - buffer.start);
-            udp.endPacket();
+            QueueToServer(ser);
             time_last_state_sent = millis();
         }
     }
 
-    constexpr u32 receive_message_period = 50;
-    static u32    next_receive_message   = millis();
-    if (millis() >= next_receive_message)
-    {
-        next_receive_message += receive_message_period;
-
-        Message message = ReceiveMessage();
-        switch (message.header.type)
-        {
-        case MessageType::TargetsCommand:
-        {
-            TargetsCommand cmd;
-            cmd.serialize(message.deserializer);
-
-            Serial.println(F("TargetsCommand"));
-
-            SetCommand(cmd);
-
-            if (cmd.ask_for_ack)
-            {
-                status.ask_for_ack = false;
-
-                auto ser = Serializer(SerializerMode::Serialize,
-                                      {packet_buffer, udp_packet_size});
-
-                status.getHeader().serialize(ser);
-                status.serialize(ser);
-
-                udp.beginPacket(server_connection.address,
-                                server_connection.port);
-                BufferPtr buffer = {ser.full_buffer.start, ser.buffer.start};
-                udp.write(buffer.start, buffer.end - buffer.start);
-                udp.endPacket();
-                time_last_state_sent = millis();
-            }
-        }
-        break;
-        case MessageType::Reset:
-        {
-            delay(1000);
-            ESP.restart();
-        }
-        break;
-        }
+    DispatchNetMessages();
 
+    constexpr u32 update_serial_period = 50;
+    static u32    next_update_serial   = millis();
+    if (millis() >= next_update_serial)
+    {
+        next_update_serial += update_serial_period;
         UpdateSerial();
     }
 
-    for (u8 j = 0; j < adc_count; j++)
+    while (AdcSample* sample = adc_samples.front())
     {
-        auto& adc = adcs[j];
-        if (adc.ads.isReady())
-        {
-            s16 value = adc.ads.getValue();
-
-            NewSample(adc.channels[adc.curr_request], value);
-
-            adc.curr_request = (adc.curr_request == 0) ? 1 : 0;
-            if (adc.curr_request == 0)
-            {
-                adc.ads.requestADC_Differential_0_1();
-            }
-            else
-            {
-                adc.ads.requestADC_Differential_2_3();
-            }
-        }
+        NewSample(sample->sensor, sample->value, sample->time);
+        adc_samples.pop();
     }
 
     static u32 last_time   = millis();
     u32        time        = millis();
     u32        update_time = time - last_time;
     last_time              = time;
-    for (u8 i = 0; i < target_count; i++)
+    for (u8 i = 0; i < board_target_count; i++)
     {
         auto button_state = buttons[i].getState();
 
@@ -730,23 +804,5 @@ loop()
         }
     }
 
-    switch (status.door_state)
-    {
-    case TargetsDoorState::OpenWhenTargetsAreDead:
-    {
-        u8 to_write = 0; // Open
-        for (const auto& hp : status.hitpoints)
-        {
-            if (hp > 0)
-            {
-                to_write = 1; // Close
-                break;
-            }
-        }
-        digitalWrite(DOOR_LOCK_OUT, to_write);
-    }
-    break;
-    case TargetsDoorState::Open: digitalWrite(DOOR_LOCK_OUT, 0); break;
-    case TargetsDoorState::Close: digitalWrite(DOOR_LOCK_OUT, 1); break;
-    }
+    digitalWrite(DOOR_LOCK_OUT, DoorLockLevel());
 }
\ No newline at end of file
@@ -0,0 +1,98 @@
+#pragma once
+#include "alias.hpp"
+#include "sliding_window.hpp"
+
+/*
+   Integer pipeline run on every sample of a piezo:
+   - DC blocking high-pass: y += (x - x_prev) - y / 2^dc_shift. The pole is at
+     1 - 1/32, about 2 Hz at 430 SPS, the slow drift of the input is removed.
+   - Envelope: the peak of |y| is held for the window of the sensor, then it
+     decays by 1/2^release_shift per sample.
+   - Noise floor: follows the envelope, down quickly and up slowly.
+   A hit starts when the envelope reaches trigger_ratio times the noise floor,
+   and at least min_level. It ends when the envelope drops below half of that.
+   The filter states are Q8 fixed point (8 fractional bits), there is no
+   division and no float.
+
+   The cost of a sample still depends on the signal, through the sliding
+   window of the envelope. Its deques are amortized O(1), but one sample can
+   empty them: after a falling run, a big sample removes up to window + 1
+   entries, 129 with the longest window. sliding_window_test checks that
+   bound and times that case on the host, it is not measured on the ESP32.
+
+   min_level is set by NewSample from the threshold of the target: threshold
+   << 7 is half the peak to peak in Q8, like the envelope. Quiet targets hit
+   when the envelope reaches it, the noise floor only raises it.
+*/
+struct PiezoDsp
+{
+    static constexpr u8  dc_shift         = 5;
+    static constexpr u8  release_shift    = 4;
+    static constexpr u8  noise_up_shift   = 9;
+    static constexpr u8  noise_down_shift = 2;
+    static constexpr u32 trigger_ratio    = 4;
+
+    // Returns true on the sample where a hit starts
+    bool
+    process(s16 sample)
+    {
+        s32 x = (s32)sample << 8;
+        if (!started)
+        {
+            // No step from 0 to the offset of the piezo
+            x_prev  = x;
+            started = true;
+        }
+        y += x - x_prev - (y >> dc_shift);
+        x_prev = x;
+
+        s32 rectified = ((y < 0) ? -y : y) >> 8;
+        if (rectified > INT16_MAX)
+            rectified = INT16_MAX;
+        hold.add((s16)rectified);
+
+        u32 held     = (u32)hold.highest() << 8;
+        u32 released = envelope - (envelope >> release_shift);
+        envelope     = (held > released) ? held : released;
+
+        u32 trigger = noise * trigger_ratio;
+        if (trigger < min_level)
+            trigger = min_level;
+
+        // A hit is too short to move it much. When the noise gets louder the
+        // floor rises until the hit ends, it can't stay over forever.
+        if (envelope < noise)
+            noise -= (noise - envelope) >> noise_down_shift;
+        else
+            noise += (envelope - noise) >> noise_up_shift;
+
+        if (over)
+        {
+            if (envelope < trigger / 2)
+                over = false;
+            return false;
+        }
+        if (envelope >= trigger)
+        {
+            over = true;
+            return true;
+        }
+        return false;
+    }
+
+    // Envelope without the fractional bits
+    u16
+    level()
+    {
+        return (u16)(envelope >> 8);
+    }
+
+    SlidingPeakToPeak hold; // Of |y|, its window is the hold time
+    s32               x_prev    = 0;
+    s32               y         = 0;
+    u32               envelope  = 0;
+    u32               noise     = 0;
+    u32               min_level = 1000 << 8;
+    bool              over      = false;
+    bool              started   = false;
+};
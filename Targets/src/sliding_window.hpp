@@ -0,0 +1,112 @@
+#pragma once
+#include "alias.hpp"
+
+/*
+   Peak to peak amplitude of the last `window` samples, in O(1) amortized per
+   sample. Two monotonic deques keep the candidates for the min and the max: a
+   sample leaves the max deque as soon as a newer sample is bigger, it can
+   never be the max of the window again, and it leaves from the front when it
+   gets out of the window. The window starts filled with zeros.
+   One add removes at most window + 1 entries: apart from the newest sample,
+   a sample can't be both the max and the min of the rest of the window.
+*/
+struct SlidingPeakToPeak
+{
+    static constexpr u16 max_window     = 128; // A power of 2
+    static constexpr u16 default_window = 8;
+    static constexpr u16 mask           = max_window - 1;
+
+    struct Entry
+    {
+        u32 index = 0;
+        s16 value = 0;
+    };
+
+    struct MonotonicDeque
+    {
+        Entry entries[max_window];
+        u16   first = 0;
+        u16   count = 0;
+
+        Entry&
+        front()
+        {
+            return entries[first];
+        }
+        Entry&
+        back()
+        {
+            return entries[(first + count - 1) & mask];
+        }
+    };
+
+    SlidingPeakToPeak()
+    {
+        reset(default_window);
+    }
+
+    void
+    reset(u16 window_in)
+    {
+        window = window_in;
+        if (window < 1)
+            window = 1;
+        if (window > max_window)
+            window = max_window;
+
+        mins       = {};
+        maxs       = {};
+        next_index = 0;
+        for (u16 i = 0; i < window; i++)
+        {
+            add(0);
+        }
+    }
+
+    // Max and min of the window after the last add
+    s16
+    highest()
+    {
+        return maxs.front().value;
+    }
+    s16
+    lowest()
+    {
+        return mins.front().value;
+    }
+
+    u16
+    add(s16 value)
+    {
+        u32 index = next_index++;
+        push<false>(mins, index, value);
+        push<true>(maxs, index, value);
+        return (u16)((s32)highest() - (s32)lowest());
+    }
+
+    template<bool keep_max>
+    void
+    push(MonotonicDeque& deque, u32 index, s16 value)
+    {
+        if (deque.count && index - deque.front().index >= window)
+        {
+            deque.first = (deque.first + 1) & mask;
+            deque.count--;
+        }
+        while (deque.count
+               && (keep_max ? deque.back().value <= value :
+                              deque.back().value >= value))
+        {
+            deque.count--;
+        }
+        auto& entry = deque.entries[(deque.first + deque.count) & mask];
+        entry.index = index;
+        entry.value = value;
+        deque.count++;
+    }
+
+    MonotonicDeque mins;
+    MonotonicDeque maxs;
+    u32            next_index = 0;
+    u16            window     = default_window;
+};
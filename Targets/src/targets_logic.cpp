@@ -0,0 +1,132 @@
+#include "targets_logic.hpp"
+
+Sensor        sensors[max_target_count];
+TargetsStatus status;
+bool          need_resend_status = false;
+
+TargetsGraph graph;
+u64          graph_first_time[max_target_count] = {};
+u64          graph_last_time[max_target_count]  = {};
+// Samples per target in a graph message
+u16 graph_buffer_limit = TargetsGraph::buffer_max_count;
+
+void
+SetTargetCount(u8 count, u32 packet_size)
+{
+    if (count > max_target_count)
+        count = max_target_count;
+    status.count       = count;
+    graph.count        = count;
+    graph_buffer_limit = TargetsGraph::bufferLimit(count, packet_size);
+}
+
+void
+SetCommand(TargetsCommand cmd)
+{
+    need_resend_status = false;
+    for (u8 i = 0; i < status.count; i++)
+    {
+        status.thresholds[i] = sensors[i].threshold;
+        if (i >= cmd.count)
+        {
+            // The Controller doesn't know this target yet
+            need_resend_status = true;
+            continue;
+        }
+
+        if (cmd.set_hitpoints[i] >= 0)
+        {
+            status.hitpoints[i] = cmd.set_hitpoints[i];
+
+            if (status.hitpoints[i] <= 0)
+            {
+                TargetDead(i, "command");
+            }
+        }
+        else if (cmd.hitpoints[i] != status.hitpoints[i])
+        {
+            need_resend_status = true;
+        }
+    }
+
+    status.enabled    = cmd.enable;
+    status.door_state = cmd.door_state;
+    if (status.send_sensor_data != cmd.send_sensor_data)
+    {
+        if (status.send_sensor_data)
+        {
+            // We send what's in the buffer
+            SendTargetsGraphMessage();
+        }
+        status.send_sensor_data = cmd.send_sensor_data;
+    }
+}
+
+void
+NewSample(u8 target, s16 value, u64 time)
+{
+    auto& ch = sensors[target];
+
+    // The envelope is half the peak to peak of the filtered signal
+    ch.dsp.min_level  = (u32)ch.threshold << 7;
+    bool hit          = ch.dsp.process(value);
+    u32  level        = (u32)ch.dsp.level() * 2;
+    u16  peak_to_peak = (level > UINT16_MAX) ? UINT16_MAX : (u16)level;
+
+    if (status.send_sensor_data)
+    {
+        auto& count = graph.buffer_count[target];
+        if (count >= graph_buffer_limit)
+        {
+            SendTargetsGraphMessage();
+        }
+        if (count == 0)
+            graph_first_time[target] = time;
+        graph_last_time[target]     = time;
+        graph.buffer[target][count] = peak_to_peak;
+        count++;
+    }
+
+    if (hit && (status.enabled & ((TargetMask)1 << target)))
+    {
+        constexpr s8  hp_min       = -10;
+        constexpr u32 hit_cooldown = 1000;
+        u32           time_ms      = time / 1000;
+        if (ch.hit_time == 0 || time_ms > ch.hit_time + hit_cooldown)
+        {
+            ch.hit_time = time_ms;
+            if (status.hitpoints[target] > hp_min)
+            {
+                status.hitpoints[target]--;
+                need_resend_status = true;
+                if (IsClockSynced())
+                    status.hit_time = ToServerMicros(time);
+
+                if (status.hitpoints[target] <= 0)
+                {
+                    TargetDead(target, "hit");
+                }
+            }
+        }
+    }
+}
+
+u8
+DoorLockLevel()
+{
+    switch (status.door_state)
+    {
+    case TargetsDoorState::OpenWhenTargetsAreDead:
+    {
+        for (u8 i = 0; i < status.count; i++)
+        {
+            if (status.hitpoints[i] > 0)
+                return 1; // Close
+        }
+        return 0; // Open
+    }
+    case TargetsDoorState::Open: return 0;
+    case TargetsDoorState::Close: return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "alias.hpp"
+#include "message_targets.hpp"
+#include "piezo_dsp.hpp"
+
+/*
+   The hit detection and the game logic of the targets, without the hardware.
+   It builds for the ESP32 and on a computer, the replay tool (Targets/replay)
+   runs recorded ADC traces through it. The functions at the end are provided
+   by the program that uses it: the firmware drives the servos and the
+   network, the replay tool only records what happens.
+*/
+
+struct Sensor
+{
+    PiezoDsp dsp;
+    u32      hit_time  = 0;
+    u16      threshold = 2000; // Minimum peak to peak of a hit
+};
+
+extern Sensor        sensors[max_target_count];
+extern TargetsStatus status;
+extern bool          need_resend_status;
+
+extern TargetsGraph graph;
+// micros() of the first and last sample in the graph buffer of each target
+extern u64 graph_first_time[max_target_count];
+extern u64 graph_last_time[max_target_count];
+
+// Targets of the board, the graph messages must fit in packet_size
+void SetTargetCount(u8 count, u32 packet_size);
+// time is the micros() of the sample
+void NewSample(u8 target, s16 value, u64 time);
+void SetCommand(TargetsCommand cmd);
+// Level of the door lock output, 1 to close the door
+u8   DoorLockLevel();
+
+// Provided by the program
+void TargetDead(u8 target, const char* cause); // Opens the latch
+void SendTargetsGraphMessage();                 // Empties the graph buffers
+bool IsClockSynced();                           // msg.hpp on the firmware
+u64  ToServerMicros(u64 local_time);
@@ -28,8 +28,21 @@ ClientId this_client_id = ClientId::Timer;
 
 TimerStatus status;
 
+/*
+   The time left is corrected slowly so that the seconds never jump, the timer
+   runs at most 10% faster or slower. It only jumps when the difference is too
+   big or when the timer is paused.
+*/
+constexpr s32 max_time_correction = 2000; // milliseconds
+s32           time_correction     = 0;
+// Elapsed milliseconds that didn't allow a step of 1 ms yet
+u32 time_correction_budget = 0;
+
 s16 digit_width = 0;
 
+void ReceiveTimerCommand(Message& message);
+void ReceiveReset(Message& message);
+
 void
 setup()
 {
@@ -60,6 +73,9 @@ setup()
         Serial.println(F("LittleFS.begin() failed!"));
     }
 
+    SetMessageHandler(MessageType::TimerCommand, ReceiveTimerCommand);
+    SetMessageHandler(MessageType::Reset, ReceiveReset);
+
     Serial.println("Start wifi");
     StartWifi();
 
@@ -80,45 +96,56 @@ GetFrameTime()
 }
 
 void
-loop()
+ReceiveTimerCommand(Message& message)
 {
-    Message message = ReceiveMessage();
-    switch (message.header.type)
+    TimerCommand cmd;
+    cmd.serialize(message.deserializer);
+
+    Serial.println(F("TimerCommand"));
+
+    status.paused = cmd.paused;
+    s32 time_left = cmd.time_left;
+    if (cmd.server_time && IsClockSynced() && !cmd.paused)
     {
-    case MessageType::TimerCommand:
+        // The time the command took to arrive
+        time_left -= (s32)((s64)(ServerMicros() - cmd.server_time) / 1000);
+    }
+
+    s32 error = time_left - status.time_left;
+    if (abs(error) > max_time_correction || status.paused)
+    {
+        status.time_left = time_left;
+        time_correction  = 0;
+    }
+    else
     {
-        TimerCommand cmd;
-        cmd.serialize(message.deserializer);
+        time_correction = error;
+    }
 
-        Serial.println(F("TimerCommand"));
+    auto ser = Serializer(SerializerMode::Serialize,
+                          {packet_buffer, udp_packet_size});
 
-        status.paused = cmd.paused;
-        if (abs(status.time_left - cmd.time_left) > 200 || status.paused)
-        {
-            status.time_left = cmd.time_left;
-        }
+    status.getHeader().serialize(ser);
+    status.serialize(ser);
 
-        auto ser = Serializer(SerializerMode::Serialize,
-                              {packet_buffer, udp_packet_size});
+    SendToServer(ser);
+}
 
-        status.getHeader().serialize(ser);
-        status.serialize(ser);
+void
+ReceiveReset(Message& message)
+{
+    ESP.restart();
+}
 
-        udp.beginPacket(server_connection.address, server_connection.port);
-        BufferPtr buffer = {ser.full_buffer.start, ser.buffer.start};
-        udp.write(buffer.start, buffer.end - buffer.start);
-        udp.endPacket();
-    }
-    break;
-    case MessageType::Reset: { ESP.restart();
-    }
-    break;
-    }
+void
+loop()
+{
+    DispatchMessages();
 
     u32 frame_time = GetFrameTime();
 
     static bool was_connected = true;
-    if (wifi_state == WifiState::Connected)
+    if (IsServerConnected())
     {
         if (!was_connected)
         {
@@ -127,7 +154,12 @@ loop()
 
         if (!status.paused)
         {
-            status.time_left -= frame_time;
+            time_correction_budget += frame_time;
+            s32 max_step = time_correction_budget / 10;
+            time_correction_budget %= 10;
+            s32 step = constrain(time_correction, -max_step, max_step);
+            time_correction -= step;
+            status.time_left -= frame_time - step;
         }
 
         static s32 curr_time = 0; // seconds
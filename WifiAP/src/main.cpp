@@ -17,4 +17,6 @@ setup()
 
 void
 loop()
-{}
\ No newline at end of file
+{
+    UpdateAccessPoint();
+}
\ No newline at end of file